@@ -0,0 +1,37 @@
+# Construction cost of Cgroup objects.
+#
+#   before : Cgroup.reload_mounts on every construction, which is what each
+#            constructor used to do by calling cgroup_init()
+#   after  : the mount table parsed once at gem init is shared
+#
+# The before case only runs on the real mount (backend "host"): under
+# MRUBY_CGROUP_ROOT the table is built from the directory and cgroup_init()
+# is never called, so there is nothing to compare.
+#
+# Output is in the format of bench/hotpath.rb.
+#
+# usage: mruby bench/construct.rb [backend label] [count]
+
+backend = ARGV[0] || "host"
+count = (ARGV[1] || 10000).to_i
+group = "/"
+
+def bench(name, backend, count)
+  t = Time.now
+  count.times { yield }
+  nsec = (Time.now - t) * 1000000000 / count
+  puts [name, backend, count, nsec.round(1), "-"].join("\t")
+end
+
+[Cgroup::CPU, Cgroup::CPUSET, Cgroup::MEMORY].each do |klass|
+  name = klass.to_s.split("::").last.downcase
+  if backend == "host"
+    bench("construct_#{name}_reload", backend, count) do
+      Cgroup.reload_mounts
+      klass.new group
+    end
+  end
+  bench("construct_#{name}", backend, count) do
+    klass.new group
+  end
+end
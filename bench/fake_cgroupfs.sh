@@ -0,0 +1,85 @@
+#!/bin/sh
+# Builds a directory tree mimicking cgroupfs for Cgroup.root / MRUBY_CGROUP_ROOT,
+# so the gem can be exercised without root or a real cgroup mount.
+#
+# usage: bench/fake_cgroupfs.sh <dir> v1|v2
+#
+# Put <dir> on tmpfs (/dev/shm) to keep disk latency out of the numbers.
+
+set -e
+
+dir=$1
+version=${2:-v1}
+[ -n "$dir" ] || { echo "usage: $0 <dir> v1|v2" >&2; exit 1; }
+
+# an empty value makes an empty file, as tasks and cgroup.procs of a group without tasks read
+put() {
+    if [ -n "$2" ]; then
+        printf '%b\n' "$2" > "$1"
+    else
+        : > "$1"
+    fi
+}
+
+v1() {
+    mkdir -p "$dir/cpu" "$dir/cpuacct" "$dir/cpuset" "$dir/blkio" "$dir/memory" "$dir/pids"
+    for c in cpu cpuacct cpuset blkio memory pids; do
+        put "$dir/$c/tasks" ""
+        put "$dir/$c/cgroup.procs" ""
+        put "$dir/$c/notify_on_release" 0
+    done
+    put "$dir/cpu/cpu.cfs_quota_us" -1
+    put "$dir/cpu/cpu.cfs_period_us" 100000
+    put "$dir/cpu/cpu.rt_period_us" 1000000
+    put "$dir/cpu/cpu.rt_runtime_us" 0
+    put "$dir/cpu/cpu.shares" 1024
+    put "$dir/cpu/cpu.stat" "nr_periods 1000\nnr_throttled 10\nthrottled_time 123456789"
+    put "$dir/cpuacct/cpuacct.usage" 987654321
+    put "$dir/cpuacct/cpuacct.stat" "user 4000\nsystem 1000"
+    put "$dir/cpuacct/cpuacct.usage_percpu" "246913580 246913580 246913580 246913581"
+    put "$dir/cpuset/cpuset.cpus" 0-3
+    put "$dir/cpuset/cpuset.mems" 0
+    put "$dir/blkio/blkio.throttle.read_bps_device" ""
+    put "$dir/blkio/blkio.throttle.write_bps_device" ""
+    put "$dir/blkio/blkio.throttle.read_iops_device" ""
+    put "$dir/blkio/blkio.throttle.write_iops_device" ""
+    put "$dir/blkio/blkio.throttle.io_service_bytes" "8:0 Read 4096000\n8:0 Write 8192000\n8:0 Sync 8192000\n8:0 Async 4096000\n8:0 Total 12288000\nTotal 12288000"
+    put "$dir/blkio/blkio.throttle.io_serviced" "8:0 Read 1000\n8:0 Write 2000\n8:0 Sync 2000\n8:0 Async 1000\n8:0 Total 3000\nTotal 3000"
+    put "$dir/memory/memory.limit_in_bytes" 9223372036854771712
+    put "$dir/memory/memory.usage_in_bytes" 104857600
+    put "$dir/memory/memory.max_usage_in_bytes" 209715200
+    put "$dir/memory/memory.oom_control" "oom_kill_disable 0\nunder_oom 0\noom_kill 0"
+    put "$dir/memory/cgroup.event_control" ""
+    put "$dir/pids/pids.max" max
+    put "$dir/pids/pids.current" 12
+}
+
+v2() {
+    mkdir -p "$dir"
+    put "$dir/cgroup.controllers" "cpuset cpu io memory pids"
+    put "$dir/cgroup.subtree_control" "cpuset cpu io memory pids"
+    put "$dir/cgroup.procs" ""
+    put "$dir/cgroup.threads" ""
+    put "$dir/cgroup.events" "populated 0\nfrozen 0"
+    put "$dir/cpu.max" "max 100000"
+    put "$dir/cpu.weight" 100
+    put "$dir/cpu.stat" "usage_usec 987654\nuser_usec 800000\nsystem_usec 187654\nnr_periods 1000\nnr_throttled 10\nthrottled_usec 123456"
+    put "$dir/cpuset.cpus" 0-3
+    put "$dir/cpuset.mems" 0
+    put "$dir/io.max" ""
+    put "$dir/io.stat" "8:0 rbytes=4096000 wbytes=8192000 rios=1000 wios=2000 dbytes=0 dios=0"
+    put "$dir/memory.max" max
+    put "$dir/memory.current" 104857600
+    put "$dir/memory.peak" 209715200
+    put "$dir/memory.swap.max" max
+    put "$dir/memory.swap.current" 0
+    put "$dir/memory.events" "low 0\nhigh 0\nmax 0\noom 0\noom_kill 0"
+    put "$dir/pids.max" max
+    put "$dir/pids.current" 12
+}
+
+case $version in
+v1) v1 ;;
+v2) v2 ;;
+*) echo "unknown version: $version" >&2; exit 1 ;;
+esac
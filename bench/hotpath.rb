@@ -0,0 +1,77 @@
+# Latency and allocations of the hot paths, one tab separated line per case:
+#
+#   case <TAB> backend <TAB> count <TAB> nsec/op <TAB> allocs/op
+#
+# Run against a fake tree (bench/fake_cgroupfs.sh) with MRUBY_CGROUP_ROOT set,
+# or as root on a real hierarchy. allocs/op counts heap objects with the GC off.
+#
+# usage: mruby bench/hotpath.rb [backend label] [count]
+
+backend = ARGV[0] || "host"
+count = (ARGV[1] || 10000).to_i
+group = "/mruby-cgroup-bench"
+
+def live_objects
+  c = ObjectSpace.count_objects
+  c[:TOTAL] - c[:FREE]
+end
+
+def bench(name, backend, count)
+  GC.start
+  GC.disable
+  objs = live_objects
+  t = Time.now
+  count.times { yield }
+  nsec = (Time.now - t) * 1000000000 / count
+  allocs = (live_objects - objs).to_f / count
+  GC.enable
+  puts [name, backend, count, nsec.round(1), allocs.round(2)].join("\t")
+end
+
+cpu = Cgroup::CPU.new group
+cpu.create
+acct = Cgroup::CPUACCT.new group
+acct.create
+
+bench("construct_cpu", backend, count) { Cgroup::CPU.new group }
+bench("construct_memory", backend, count) { Cgroup::MEMORY.new group }
+bench("get_cfs_quota_us", backend, count) { cpu.cfs_quota_us }
+bench("get_generic_cfs_quota_us", backend, count) { cpu.get "cpu.cfs_quota_us" }
+bench("set_cfs_quota_us", backend, count) { cpu.cfs_quota_us = 50000 }
+bench("set_modify_cfs_quota_us", backend, count) do
+  cpu.cfs_quota_us = 50000
+  cpu.modify
+end
+bench("attach_self", backend, count) { cpu.attach }
+
+acct.live = true
+bench("live_get_usage", backend, count) { acct.usage }
+stat = {}
+bench("parse_cpuacct_stat", backend, count) { acct.stat_hash stat }
+percpu = []
+bench("parse_usage_percpu", backend, count) { acct.usage_percpu_array percpu }
+cpu.live = true
+bench("parse_cpu_stat", backend, count) { cpu.stat_hash stat }
+
+io = Cgroup::BLKIO.new "/"
+io.live = true
+iostat = {}
+bench("parse_io_service_bytes", backend, count) { io.io_service_bytes_hash iostat }
+bench("set_throttle_hash", backend, count) { io.throttle_read_bps_device = {"8:0" => 1000000, "8:16" => 2000000} }
+
+tmp = Cgroup::CPU.new "#{group}/tmp"
+bench("create_delete", backend, count / 10) do
+  tmp.create
+  tmp.delete
+end
+
+pool = Cgroup::Pool.new "#{group}/pool", ["cpu", "memory"], min_idle: 4
+bench("pool_lease_release", backend, count / 10) do
+  pool.release pool.lease
+end
+pool.close
+
+bench("measure_empty", backend, count) { Cgroup.measure {} }
+
+cpu.delete
+acct.delete
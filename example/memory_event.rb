@@ -0,0 +1,16 @@
+c = Cgroup::MEMORY.new "/test"
+if !c.exist?
+  puts "create cgroup memory /test"
+  c.limit_in_bytes = 256 * 1024 * 1024
+  c.create
+end
+
+oom = c.on_oom { |ev, count| puts "oom in /test (#{count})" }
+high = c.on_threshold(200 * 1024 * 1024) { |ev, count| puts "/test is over 200MB" }
+pressure = c.on_pressure("medium") { |ev, count| puts "/test is under memory pressure" }
+
+# ev.fd and ev.events can be handed to an external epoll loop instead
+puts "waiting memory events of /test"
+loop do
+  Cgroup::Event.wait [oom, high, pressure], 1000
+end
@@ -1,4 +1,13 @@
 module Cgroup
+  def self.measure group = "/mruby-measure"
+    m = Measurement.start group
+    begin
+      yield
+    ensure
+      m.finish
+    end
+    m
+  end
   def root_attach root
     if !root.exist?
       raise "root group not found"
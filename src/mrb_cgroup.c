@@ -26,77 +26,1297 @@
 */
 
 #include <ctype.h>
-#include <libcgroup.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "mruby.h"
 #include "mruby/array.h"
 #include "mruby/class.h"
 #include "mruby/data.h"
+#include "mruby/hash.h"
 #include "mruby/numeric.h"
 #include "mruby/string.h"
 #include "mruby/variable.h"
 
-#define BLKIO_STRING_SIZE 64
+#include "mrb_cgroup.h"
+
 #define DONE mrb_gc_arena_restore(mrb, 0);
 
-typedef enum {
-    MRB_CGROUP_cpu,
-    MRB_CGROUP_cpuset,
-    MRB_CGROUP_cpuacct,
-    MRB_CGROUP_blkio,
-    MRB_CGROUP_memory,
-    MRB_CGROUP_pids
-} group_type_t;
-typedef struct cgroup cgroup_t;
-typedef struct cgroup_controller cgroup_controller_t;
+#define CGROUP2_ROOT "/sys/fs/cgroup"
+#ifndef CGROUP2_SUPER_MAGIC
+#define CGROUP2_SUPER_MAGIC 0x63677270
+#endif
+#ifndef CGROUP_SUPER_MAGIC
+#define CGROUP_SUPER_MAGIC 0x27e0eb
+#endif
+
+static const char *mrb_cgroup_type_names[] = {"cpu",    "cpuset", "cpuacct", "blkio",
+                                              "memory", "pids",   "freezer", "hugetlb"};
+// controllers of the unified hierarchy serving each type, "" for the core files (cgroup.freeze) of every group
+static const char *mrb_cgroup_v2_controllers[] = {"cpu", "cpuset", "cpu", "io", "memory", "pids", "", "hugetlb"};
+#define MRB_CGROUP_TYPE_SIZE (sizeof(mrb_cgroup_type_names) / sizeof(mrb_cgroup_type_names[0]))
+
+// per mrb_state: Cgroup.root and the mount table of the process serving it
 typedef struct {
-    int already_exist;
-    mrb_value group_name;
-    group_type_t type;
-    cgroup_t *cg;
-    cgroup_controller_t *cgc;
-} mrb_cgroup_context;
+    // Cgroup.root: the hierarchy is taken from this directory instead of the mount table, libcgroup is not used
+    char *root;
+    const mrb_cgroup_mounts *mounts;
+    // mrb_cgroup_mounts_gen when mounts was taken
+    unsigned gen;
+} mrb_cgroup_state;
+
+// the state last looked up on this thread, good while no state was freed since (an mrb_state opened later may
+// get the address of a closed one)
+static unsigned mrb_cgroup_state_gen;
+static __thread struct {
+    mrb_state *mrb;
+    mrb_cgroup_state *st;
+    unsigned gen;
+} mrb_cgroup_state_last;
 
 //
 // private
 //
 
+static void mrb_cgroup_live_close(mrb_cgroup_context *ctx)
+{
+    if (ctx->entry) {
+        mrb_cgroup_entry_release(ctx->entry);
+        ctx->entry = NULL;
+    }
+}
+
+// the cached fds of ctx point at a removed directory: the entry is evicted for every holder
+static void mrb_cgroup_live_drop(mrb_cgroup_context *ctx)
+{
+    mrb_cgroup_entry_evict(ctx->entry);
+    mrb_cgroup_live_close(ctx);
+}
+
 static void mrb_cgroup_context_free(mrb_state *mrb, void *p)
 {
     mrb_cgroup_context *ctx = p;
     //    cgroup_free_controllers(c->cg);
+    mrb_cgroup_live_close(ctx);
     cgroup_free(&ctx->cg);
+    mrb_free(mrb, ctx);
 }
 
 static const struct mrb_data_type mrb_cgroup_context_type = {
     "mrb_cgroup_context", mrb_cgroup_context_free,
 };
 
-static mrb_cgroup_context *mrb_cgroup_get_context(mrb_state *mrb, mrb_value self, const char *ctx_flag)
+static void mrb_cgroup_state_free(mrb_state *mrb, void *p)
+{
+    mrb_cgroup_state *st = p;
+
+    __atomic_fetch_add(&mrb_cgroup_state_gen, 1, __ATOMIC_RELEASE);
+    free(st->root);
+    mrb_free(mrb, st);
+}
+
+static const struct mrb_data_type mrb_cgroup_state_type = {
+    "mrb_cgroup_state", mrb_cgroup_state_free,
+};
+
+static mrb_cgroup_state *mrb_cgroup_get_state(mrb_state *mrb)
+{
+    unsigned gen = __atomic_load_n(&mrb_cgroup_state_gen, __ATOMIC_ACQUIRE);
+    mrb_value cgroup, state;
+
+    if (mrb_cgroup_state_last.mrb == mrb && mrb_cgroup_state_last.gen == gen) {
+        return mrb_cgroup_state_last.st;
+    }
+    cgroup = mrb_obj_value(mrb_module_get(mrb, "Cgroup"));
+    state = mrb_iv_get(mrb, cgroup, mrb_intern_lit(mrb, "mrb_cgroup_state"));
+    mrb_cgroup_state_last.st = (mrb_cgroup_state *)mrb_data_get_ptr(mrb, state, &mrb_cgroup_state_type);
+    mrb_cgroup_state_last.mrb = mrb;
+    mrb_cgroup_state_last.gen = gen;
+
+    return mrb_cgroup_state_last.st;
+}
+
+// builds the table of m->root: cgroup_init() parses /proc/mounts and rebuilds the mount table of libcgroup, so
+// it runs once for the process and again only on Cgroup.reload_mounts (or after a failure)
+static void mrb_cgroup_mounts_fill(mrb_cgroup_mounts *m)
+{
+    const char *root = m->root ? m->root : CGROUP2_ROOT;
+    char path[FILENAME_MAX], *point;
+    struct statfs fs;
+    size_t i;
+
+    snprintf(path, sizeof(path), "%s/cgroup.controllers", root);
+    m->unified = (statfs(root, &fs) == 0 && fs.f_type == CGROUP2_SUPER_MAGIC) || (m->root && access(path, F_OK) == 0);
+    if (m->root == NULL) {
+        if (m->unified || (m->init_code = cgroup_init())) {
+            return;
+        }
+        for (i = 0; i < MRB_CGROUP_TYPE_SIZE; i++) {
+            if (cgroup_get_subsys_mount_point(mrb_cgroup_type_names[i], &point) == 0) {
+                m->points[i] = point;
+            }
+        }
+        return;
+    }
+
+    // v1 controllers are taken as <root>/<controller>
+    if (m->unified) {
+        m->fake = (fs.f_type != CGROUP2_SUPER_MAGIC);
+        return;
+    }
+    for (i = 0; i < MRB_CGROUP_TYPE_SIZE; i++) {
+        snprintf(path, sizeof(path), "%s/%s", root, mrb_cgroup_type_names[i]);
+        if (statfs(path, &fs) == 0) {
+            m->points[i] = strdup(path);
+            m->fake |= (fs.f_type != CGROUP_SUPER_MAGIC);
+        }
+    }
+}
+
+// takes the table of the process for the root of st, returns the code of cgroup_init()
+static int mrb_cgroup_state_init(mrb_cgroup_state *st, int reload)
+{
+    st->gen = __atomic_load_n(&mrb_cgroup_mounts_gen, __ATOMIC_ACQUIRE);
+    st->mounts = mrb_cgroup_shared_init(st->root, reload, mrb_cgroup_mounts_fill);
+    return st->mounts->init_code;
+}
+
+// the current table of the root, taken again once another mrb_state reloaded a table
+static const mrb_cgroup_mounts *mrb_cgroup_mounts_get(mrb_state *mrb)
+{
+    mrb_cgroup_state *st = mrb_cgroup_get_state(mrb);
+
+    if (st->gen != __atomic_load_n(&mrb_cgroup_mounts_gen, __ATOMIC_ACQUIRE)) {
+        mrb_cgroup_state_init(st, 0);
+    }
+
+    return st->mounts;
+}
+
+// the directory of the unified hierarchy, or Cgroup.root
+static const char *mrb_cgroup_mounts_top(const mrb_cgroup_mounts *m)
 {
-    mrb_cgroup_context *c;
-    mrb_value context;
+    return m->root ? m->root : CGROUP2_ROOT;
+}
+
+static const char *mrb_cgroup_root(mrb_state *mrb)
+{
+    mrb_cgroup_state *st = mrb_cgroup_get_state(mrb);
+
+    return st->root ? st->root : CGROUP2_ROOT;
+}
+
+// returns non-zero when the groups are in the unified hierarchy
+static int mrb_cgroup_check_init(mrb_state *mrb, const char *gname)
+{
+    mrb_cgroup_state *st = mrb_cgroup_get_state(mrb);
+    int code;
+
+    if (mrb_cgroup_mounts_get(mrb)->init_code && (code = mrb_cgroup_state_init(st, 0))) {
+        mrb_raisef(mrb, E_RUNTIME_ERROR, "cgroup_init %S failed: %S(%S)", mrb_str_new_cstr(mrb, gname),
+                   mrb_str_new_cstr(mrb, cgroup_strerror(code)), mrb_fixnum_value(code));
+    }
+
+    return st->mounts->unified;
+}
+
+mrb_cgroup_context *mrb_cgroup_get_context(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_context *c = (mrb_cgroup_context *)mrb_data_get_ptr(mrb, self, &mrb_cgroup_context_type);
 
-    context = mrb_iv_get(mrb, self, mrb_intern_cstr(mrb, ctx_flag));
-    Data_Get_Struct(mrb, context, &mrb_cgroup_context_type, c);
     if (!c)
         mrb_raise(mrb, E_RUNTIME_ERROR, "get mrb_cgroup_context failed");
 
     return c;
 }
 
+// builds "<mount point>/<group>[/<key>]", returns -1 with errno set when the controller is not mounted
+static int mrb_cgroup_build_path(const mrb_cgroup_mounts *m, group_type_t type, int v2, const char *group,
+                                 const char *key, char *path, size_t size)
+{
+    const char *mount_point = mrb_cgroup_mounts_top(m);
+
+    if (!v2 && (mount_point = m->points[type]) == NULL) {
+        errno = ENOENT;
+        return -1;
+    }
+    if (key) {
+        snprintf(path, size, "%s/%s/%s", mount_point, group, key);
+    } else {
+        snprintf(path, size, "%s/%s", mount_point, group);
+    }
+
+    return 0;
+}
+
+int mrb_cgroup_path(mrb_state *mrb, mrb_cgroup_context *ctx, const char *key, char *path, size_t size)
+{
+    return mrb_cgroup_build_path(ctx->mounts, ctx->type, ctx->v2, RSTRING_PTR(ctx->group_name), key, path, size);
+}
+
+static int mrb_cgroup_group_exist(mrb_state *mrb, mrb_cgroup_context *ctx)
+{
+    char path[FILENAME_MAX];
+    struct stat st;
+
+    MRB_CGROUP_SYSCALL(1);
+    if (mrb_cgroup_path(mrb, ctx, NULL, path, sizeof(path)) < 0 || stat(path, &st) < 0) {
+        return 0;
+    }
+
+    return S_ISDIR(st.st_mode);
+}
+
+// copy the current values of the group into ctx->cgc, values already set by setters are kept
+static void mrb_cgroup_load(mrb_state *mrb, mrb_cgroup_context *ctx)
+{
+    const char *gname = mrb_cgroup_type_names[ctx->type];
+    cgroup_t *cg;
+    cgroup_controller_t *cgc;
+    char *name, *val;
+    int i, count;
+
+    if (ctx->loaded) {
+        return;
+    }
+    ctx->loaded = 1;
+    if (!ctx->already_exist || ctx->direct) {
+        return;
+    }
+
+    if ((cg = cgroup_new_cgroup(RSTRING_PTR(ctx->group_name))) == NULL) {
+        mrb_raise(mrb, E_RUNTIME_ERROR, "cgroup_new_cgroup failed");
+    }
+    if (cgroup_get_cgroup(cg) || (cgc = cgroup_get_controller(cg, gname)) == NULL) {
+        cgroup_free(&cg);
+        return;
+    }
+
+    count = cgroup_get_value_name_count(cgc);
+    for (i = 0; i < count; i++) {
+        name = cgroup_get_value_name(cgc, i);
+        if (cgroup_get_value_string(ctx->cgc, name, &val) == 0) {
+            free(val);
+            continue;
+        }
+        if (cgroup_get_value_string(cgc, name, &val) == 0) {
+            cgroup_add_value_string(ctx->cgc, name, val);
+            free(val);
+        }
+    }
+    cgroup_free(&cg);
+}
+
 //
-// group
+// cgroup v2
+//
+
+typedef enum {
+    V2_PLAIN,      // same value
+    V2_MAX,        // "max" <-> -1
+    V2_CPU_QUOTA,  // first field of cpu.max
+    V2_CPU_PERIOD, // second field of cpu.max
+    V2_CPU_WEIGHT, // cpu.shares <-> cpu.weight
+    V2_CPU_USAGE,  // usage_usec of cpu.stat in nsec, read only
+    V2_CPU_STAT,   // user_usec/system_usec of cpu.stat in USER_HZ, read only
+    V2_IO_MAX,     // one field of io.max as "major:minor value" lines
+    V2_IO_STAT,    // r/w bytes or ios of io.stat as the "major:minor Op value" lines of blkio.throttle.io_*, read only
+    V2_KV          // one "name value" line of a flat keyed file, read only
+} mrb_cgroup_v2_conv;
+
+struct mrb_cgroup_v2_key {
+    const char *key;
+    const char *file;
+    mrb_cgroup_v2_conv conv;
+    const char *field;
+};
+
+// v1 keys used by the getters/setters and the unified hierarchy file serving them
+static const mrb_cgroup_v2_key mrb_cgroup_v2_keys[] = {
+    {"cpu.cfs_quota_us", "cpu.max", V2_CPU_QUOTA, NULL},
+    {"cpu.cfs_period_us", "cpu.max", V2_CPU_PERIOD, NULL},
+    {"cpu.shares", "cpu.weight", V2_CPU_WEIGHT, NULL},
+    {"cpu.stat", "cpu.stat", V2_PLAIN, NULL},
+    {"cpuacct.usage", "cpu.stat", V2_CPU_USAGE, "usage_usec"},
+    {"cpuacct.stat", "cpu.stat", V2_CPU_STAT, NULL},
+    {"cpuset.cpus", "cpuset.cpus", V2_PLAIN, NULL},
+    {"cpuset.mems", "cpuset.mems", V2_PLAIN, NULL},
+    {"memory.limit_in_bytes", "memory.max", V2_MAX, NULL},
+    {"memory.usage_in_bytes", "memory.current", V2_PLAIN, NULL},
+    {"memory.max_usage_in_bytes", "memory.peak", V2_PLAIN, NULL},
+    // swap only on v2, v1 counts memory+swap
+    {"memory.memsw.limit_in_bytes", "memory.swap.max", V2_MAX, NULL},
+    {"memory.memsw.usage_in_bytes", "memory.swap.current", V2_PLAIN, NULL},
+    {"memory.memsw.max_usage_in_bytes", "memory.swap.peak", V2_PLAIN, NULL},
+    // best-effort protection on both, as container runtimes map it
+    {"memory.soft_limit_in_bytes", "memory.low", V2_MAX, NULL},
+    {"memory.high", "memory.high", V2_MAX, NULL},
+    {"memory.low", "memory.low", V2_MAX, NULL},
+    {"memory.stat", "memory.stat", V2_PLAIN, NULL},
+    {"pids.max", "pids.max", V2_MAX, NULL},
+    {"pids.current", "pids.current", V2_PLAIN, NULL},
+    {"blkio.throttle.read_bps_device", "io.max", V2_IO_MAX, "rbps"},
+    {"blkio.throttle.write_bps_device", "io.max", V2_IO_MAX, "wbps"},
+    {"blkio.throttle.read_iops_device", "io.max", V2_IO_MAX, "riops"},
+    {"blkio.throttle.write_iops_device", "io.max", V2_IO_MAX, "wiops"},
+    {"blkio.throttle.io_service_bytes", "io.stat", V2_IO_STAT, "bytes"},
+    {"blkio.throttle.io_serviced", "io.stat", V2_IO_STAT, "ios"},
+    // "*" is the page size ("2MB", "1GB"), the same component in both names
+    {"hugetlb.*.limit_in_bytes", "hugetlb.*.max", V2_MAX, NULL},
+    {"hugetlb.*.usage_in_bytes", "hugetlb.*.current", V2_PLAIN, NULL},
+    {"hugetlb.*.failcnt", "hugetlb.*.events", V2_KV, "max"},
+};
+
+// "*" in a table key matches one non-empty name component of key
+static int mrb_cgroup_v2_key_match(const char *pattern, const char *key)
+{
+    const char *star = strchr(pattern, '*');
+    size_t len;
+
+    if (star == NULL) {
+        return !strcmp(pattern, key);
+    }
+    if (strncmp(pattern, key, star - pattern)) {
+        return 0;
+    }
+    key += star - pattern;
+    len = strcspn(key, ".");
+
+    return len > 0 && !strcmp(star + 1, key + len);
+}
+
+static const mrb_cgroup_v2_key *mrb_cgroup_v2_key_get(const char *key)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(mrb_cgroup_v2_keys) / sizeof(mrb_cgroup_v2_keys[0]); i++) {
+        if (mrb_cgroup_v2_key_match(mrb_cgroup_v2_keys[i].key, key)) {
+            return &mrb_cgroup_v2_keys[i];
+        }
+    }
+
+    return NULL;
+}
+
+// the unified hierarchy file of key, built into buf when the table entry has a "*"
+static const char *mrb_cgroup_v2_file(const mrb_cgroup_v2_key *k, const char *key, char *buf, size_t size)
+{
+    const char *star = strchr(k->file, '*');
+    size_t len;
+
+    if (star == NULL) {
+        return k->file;
+    }
+    key += strchr(k->key, '*') - k->key;
+    len = strcspn(key, ".");
+    snprintf(buf, size, "%.*s%.*s%s", (int)(star - k->file), k->file, (int)len, key, star + 1);
+
+    return buf;
+}
+
+int mrb_cgroup_kv_get(const char *buf, const char *name, int64_t *val)
+{
+    size_t len = strlen(name);
+    const char *p = buf;
+
+    while (p && *p) {
+        if (!strncmp(p, name, len) && p[len] == ' ') {
+            *val = strtoll(p + len + 1, NULL, 10);
+            return 0;
+        }
+        if ((p = strchr(p, '\n'))) {
+            p++;
+        }
+    }
+
+    return -1;
+}
+
+// rewrites the v2 text in buf into what the v1 key reads, returns the new length
+ssize_t mrb_cgroup_v2_to_v1(const mrb_cgroup_v2_key *k, char *buf, size_t size)
+{
+    char src[LIVE_BUF_SIZE], field[32], *line, *save, *p;
+    long long quota, period, weight, rd, wr;
+    int64_t user, system;
+    int dev;
+    size_t len = 0;
+
+    switch (k->conv) {
+    case V2_PLAIN:
+        return strlen(buf);
+    case V2_MAX:
+        if (!strcmp(buf, "max")) {
+            return snprintf(buf, size, "-1");
+        }
+        return strlen(buf);
+    case V2_CPU_QUOTA:
+    case V2_CPU_PERIOD:
+        quota = -1;
+        period = 0;
+        if (sscanf(buf, "%lld %lld", &quota, &period) != 2 && sscanf(buf, "max %lld", &period) != 1) {
+            break;
+        }
+        return snprintf(buf, size, "%lld", (k->conv == V2_CPU_QUOTA) ? quota : period);
+    case V2_CPU_WEIGHT:
+        weight = strtoll(buf, NULL, 10);
+        return snprintf(buf, size, "%lld", 2 + ((weight - 1) * 262142) / 9999);
+    case V2_CPU_USAGE:
+        if (mrb_cgroup_kv_get(buf, k->field, &user) < 0) {
+            break;
+        }
+        return snprintf(buf, size, "%lld", (long long)user * 1000);
+    case V2_KV:
+        if (mrb_cgroup_kv_get(buf, k->field, &user) < 0) {
+            break;
+        }
+        return snprintf(buf, size, "%lld", (long long)user);
+    case V2_CPU_STAT:
+        if (mrb_cgroup_kv_get(buf, "user_usec", &user) < 0 || mrb_cgroup_kv_get(buf, "system_usec", &system) < 0) {
+            break;
+        }
+        return snprintf(buf, size, "user %lld\nsystem %lld", (long long)(user * sysconf(_SC_CLK_TCK) / 1000000),
+                        (long long)(system * sysconf(_SC_CLK_TCK) / 1000000));
+    case V2_IO_MAX:
+        // "8:0 rbps=1000 wbps=max riops=max wiops=max" lines into "8:0 1000" lines
+        snprintf(src, sizeof(src), "%s", buf);
+        snprintf(field, sizeof(field), " %s=", k->field);
+        buf[0] = '\0';
+        for (line = strtok_r(src, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+            if ((p = strstr(line, field)) == NULL || !strncmp(p + strlen(field), "max", 3)) {
+                continue;
+            }
+            len += snprintf(buf + len, size - len, "%s%.*s %lld", len ? "\n" : "", (int)strcspn(line, " "), line,
+                            strtoll(p + strlen(field), NULL, 10));
+            if (len >= size) {
+                len = size - 1;
+                break;
+            }
+        }
+        return len;
+    case V2_IO_STAT:
+        // "8:0 rbytes=1 wbytes=2 rios=3 wios=4 ..." lines into "8:0 Read 1", "8:0 Write 2", "8:0 Total 3"
+        snprintf(src, sizeof(src), "%s", buf);
+        buf[0] = '\0';
+        for (line = strtok_r(src, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+            snprintf(field, sizeof(field), " r%s=", k->field);
+            rd = (p = strstr(line, field)) ? strtoll(p + strlen(field), NULL, 10) : 0;
+            snprintf(field, sizeof(field), " w%s=", k->field);
+            wr = (p = strstr(line, field)) ? strtoll(p + strlen(field), NULL, 10) : 0;
+            dev = (int)strcspn(line, " ");
+            len += snprintf(buf + len, size - len, "%s%.*s Read %lld\n%.*s Write %lld\n%.*s Total %lld",
+                            len ? "\n" : "", dev, line, rd, dev, line, wr, dev, line, rd + wr);
+            if (len >= size) {
+                len = size - 1;
+                break;
+            }
+        }
+        return len;
+    }
+    buf[0] = '\0';
+
+    return 0;
+}
+
+// writes the v1 value val of key into the unified hierarchy, returns -1 with errno set
+static int mrb_cgroup_v2_write(mrb_state *mrb, mrb_cgroup_context *ctx, const char *key, const char *val)
+{
+    const mrb_cgroup_v2_key *k = mrb_cgroup_v2_key_get(key);
+    char buf[LIVE_BUF_SIZE], quota[32], name[64];
+    char path[FILENAME_MAX];
+    long long num = strtoll(val, NULL, 10);
+    const char *file;
+    FILE *fp;
+
+    if (k == NULL) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    file = mrb_cgroup_v2_file(k, key, name, sizeof(name));
+
+    switch (k->conv) {
+    case V2_PLAIN:
+        return mrb_cgroup_write_file(mrb, ctx, file, val);
+    case V2_MAX:
+    case V2_CPU_QUOTA:
+        if (num < 0) {
+            return mrb_cgroup_write_file(mrb, ctx, file, "max");
+        }
+        snprintf(buf, sizeof(buf), "%lld", num);
+        return mrb_cgroup_write_file(mrb, ctx, file, buf);
+    case V2_CPU_PERIOD:
+        // cpu.max takes "$MAX $PERIOD", keep the current quota
+        snprintf(quota, sizeof(quota), "max");
+        if (mrb_cgroup_path(mrb, ctx, file, path, sizeof(path)) == 0 && (fp = fopen(path, "r"))) {
+            if (fscanf(fp, "%31s", quota) != 1) {
+                snprintf(quota, sizeof(quota), "max");
+            }
+            fclose(fp);
+        }
+        snprintf(buf, sizeof(buf), "%s %lld", quota, num);
+        return mrb_cgroup_write_file(mrb, ctx, file, buf);
+    case V2_CPU_WEIGHT:
+        num = 1 + ((num - 2) * 9999) / 262142;
+        snprintf(buf, sizeof(buf), "%lld", (num < 1) ? 1 : (num > 10000) ? 10000 : num);
+        return mrb_cgroup_write_file(mrb, ctx, file, buf);
+    case V2_IO_MAX: {
+        // "8:0 100000000" lines into "8:0 rbps=100000000", 0 removes the limit as on v1
+        size_t len = 0, dlen;
+        const char *line;
+
+        buf[0] = '\0';
+        for (line = val; *line && len < sizeof(buf); line += strcspn(line, "\n"), line += (*line == '\n')) {
+            dlen = strcspn(line, " \n");
+            if (dlen == 0) {
+                continue;
+            }
+            num = (line[dlen] == ' ') ? strtoll(line + dlen, NULL, 10) : 0;
+            if (num > 0) {
+                len += snprintf(buf + len, sizeof(buf) - len, "%.*s %s=%lld\n", (int)dlen, line, k->field, num);
+            } else {
+                len += snprintf(buf + len, sizeof(buf) - len, "%.*s %s=max\n", (int)dlen, line, k->field);
+            }
+        }
+        return mrb_cgroup_write_file(mrb, ctx, file, buf);
+    }
+    default:
+        errno = EROFS;
+        return -1;
+    }
+}
+
+// path of the group directory without trailing slashes
+static int mrb_cgroup_dir(mrb_state *mrb, mrb_cgroup_context *ctx, char *path, size_t size)
+{
+    size_t len;
+
+    if (mrb_cgroup_path(mrb, ctx, NULL, path, size) < 0) {
+        return -1;
+    }
+    for (len = strlen(path); len > 1 && path[len - 1] == '/'; len--) {
+        path[len - 1] = '\0';
+    }
+
+    return 0;
+}
+
+void mrb_cgroup_v2_enable(const char *dir, const char *ctrl)
+{
+    char file[FILENAME_MAX];
+    int fd;
+
+    snprintf(file, sizeof(file), "%s/cgroup.subtree_control", dir);
+    if ((fd = open(file, O_WRONLY | O_CLOEXEC)) < 0) {
+        return;
+    }
+    // a failure here shows up as a failure of the first write into the group
+    if (write(fd, ctrl, strlen(ctrl)) < 0) {
+    }
+    close(fd);
+}
+
+// the kernel fills a new cgroupfs directory with control files, a fake root gets a copy of the files of
+// the parent with the task lists left empty
+static void mrb_cgroup_fake_populate(const char *dir)
+{
+    char parent[FILENAME_MAX], src[FILENAME_MAX], dst[FILENAME_MAX], buf[LIVE_BUF_SIZE];
+    struct dirent *ent;
+    struct stat st;
+    ssize_t len;
+    int in, out;
+    DIR *dp;
+
+    snprintf(parent, sizeof(parent), "%s/..", dir);
+    if ((dp = opendir(parent)) == NULL) {
+        return;
+    }
+    while ((ent = readdir(dp))) {
+        snprintf(src, sizeof(src), "%s/%s", parent, ent->d_name);
+        if (stat(src, &st) < 0 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        snprintf(dst, sizeof(dst), "%s/%s", dir, ent->d_name);
+        if ((out = open(dst, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644)) < 0) {
+            continue;
+        }
+        if (strcmp(ent->d_name, "tasks") && strcmp(ent->d_name, "cgroup.procs") &&
+            strcmp(ent->d_name, "cgroup.threads") && (in = open(src, O_RDONLY | O_CLOEXEC)) >= 0) {
+            while ((len = read(in, buf, sizeof(buf))) > 0 && write(out, buf, len) == len) {
+            }
+            close(in);
+        }
+        close(out);
+    }
+    closedir(dp);
+}
+
+int mrb_cgroup_mkdir_excl(const char *path, int fake)
+{
+    MRB_CGROUP_SYSCALL(1);
+    if (mkdir(path, 0755) < 0) {
+        return -1;
+    }
+    if (fake) {
+        mrb_cgroup_fake_populate(path);
+    }
+
+    return 0;
+}
+
+int mrb_cgroup_mkdir_one(const char *path, int fake)
+{
+    return (mrb_cgroup_mkdir_excl(path, fake) < 0 && errno != EEXIST) ? -1 : 0;
+}
+
+int mrb_cgroup_mkdir_tree(const char *dir, size_t top, const char *ctrl, int fake)
+{
+    char path[FILENAME_MAX], c;
+    size_t len;
+
+    snprintf(path, sizeof(path), "%s", dir);
+    for (len = top;;) {
+        c = path[len];
+        path[len] = '\0';
+        if (len > top && mrb_cgroup_mkdir_one(path, fake) < 0) {
+            return -1;
+        }
+        if (ctrl) {
+            mrb_cgroup_v2_enable(path, ctrl);
+        }
+        path[len] = c;
+        while (path[len] == '/') {
+            len++;
+        }
+        if (path[len] == '\0') {
+            break;
+        }
+        len += strcspn(path + len, "/");
+    }
+
+    return 0;
+}
+
+// creates the group, on v2 the controller is enabled in cgroup.subtree_control of every ancestor
+static int mrb_cgroup_mkdir(mrb_state *mrb, mrb_cgroup_context *ctx)
+{
+    char path[FILENAME_MAX], ctrl[32], c;
+    int fake = ctx->mounts->fake;
+    size_t len;
+
+    if (mrb_cgroup_dir(mrb, ctx, path, sizeof(path)) < 0) {
+        return -1;
+    }
+    if (!ctx->v2) {
+        return mrb_cgroup_mkdir_one(path, fake);
+    }
+
+    snprintf(ctrl, sizeof(ctrl), "+%s", mrb_cgroup_v2_controllers[ctx->type]);
+    if (ctrl[1] == '\0') {
+        return mrb_cgroup_mkdir_tree(path, strlen(mrb_cgroup_mounts_top(ctx->mounts)), NULL, fake);
+    }
+    for (len = strlen(mrb_cgroup_mounts_top(ctx->mounts));;) {
+        c = path[len];
+        path[len] = '\0';
+        if (mrb_cgroup_mkdir_one(path, fake) < 0) {
+            return -1;
+        }
+        if (c == '\0') {
+            break;
+        }
+        mrb_cgroup_v2_enable(path, ctrl);
+        path[len] = c;
+        while (path[len] == '/') {
+            len++;
+        }
+        len += strcspn(path + len, "/");
+    }
+
+    return 0;
+}
+
+int mrb_cgroup_rmdir_one(const char *path, int fake)
+{
+    char file[FILENAME_MAX];
+    struct dirent *ent;
+    DIR *dp;
+
+    // cgroupfs drops the control files with the directory, a fake root has to unlink them
+    if (fake && (dp = opendir(path))) {
+        while ((ent = readdir(dp))) {
+            snprintf(file, sizeof(file), "%s/%s", path, ent->d_name);
+            if (ent->d_type == DT_REG) {
+                unlink(file);
+            }
+        }
+        closedir(dp);
+    }
+
+    MRB_CGROUP_SYSCALL(1);
+    if (rmdir(path) < 0) {
+        return -1;
+    }
+    mrb_cgroup_registry_evict(path);
+
+    return 0;
+}
+
+// moves the processes to the parent group and removes the group (v2, or v1 without libcgroup)
+static int mrb_cgroup_rmdir(mrb_state *mrb, mrb_cgroup_context *ctx)
+{
+    const char *tasks = ctx->v2 ? "cgroup.procs" : "tasks";
+    char path[FILENAME_MAX], procs[FILENAME_MAX], parent[FILENAME_MAX], pid[32];
+    char *slash;
+    size_t top;
+    FILE *fp;
+    int fd;
+
+    if (mrb_cgroup_dir(mrb, ctx, path, sizeof(path)) < 0) {
+        return -1;
+    }
+    // the root group itself can not be removed
+    top = strlen(ctx->v2 ? mrb_cgroup_mounts_top(ctx->mounts) : ctx->mounts->points[ctx->type]);
+    snprintf(procs, sizeof(procs), "%s/%s", path, tasks);
+    snprintf(parent, sizeof(parent), "%s", path);
+    if ((slash = strrchr(parent, '/')) == NULL || strlen(parent) <= top) {
+        errno = EBUSY;
+        return -1;
+    }
+    snprintf(slash, sizeof(parent) - (slash - parent), "/%s", tasks);
+
+    if ((fp = fopen(procs, "r"))) {
+        if ((fd = open(parent, O_WRONLY | O_CLOEXEC)) >= 0) {
+            while (fscanf(fp, "%31s", pid) == 1) {
+                MRB_CGROUP_SYSCALL(1);
+                // a process left behind makes the rmdir below fail with EBUSY
+                if (write(fd, pid, strlen(pid)) < 0) {
+                }
+            }
+            close(fd);
+        }
+        fclose(fp);
+    }
+
+    return mrb_cgroup_rmdir_one(path, ctx->mounts->fake);
+}
+
+int mrb_cgroup_key_path(mrb_state *mrb, const char *group, const char *key, char *path, size_t size,
+                        const mrb_cgroup_v2_key **conv)
+{
+    size_t i, len = strcspn(key, ".");
+    const mrb_cgroup_mounts *m = mrb_cgroup_mounts_get(mrb);
+    const mrb_cgroup_v2_key *k;
+    char name[64];
+
+    *conv = NULL;
+    if (m->unified) {
+        // keys without a mapping are taken as unified hierarchy file names
+        if ((k = mrb_cgroup_v2_key_get(key))) {
+            *conv = k;
+            key = mrb_cgroup_v2_file(k, key, name, sizeof(name));
+        }
+        return mrb_cgroup_build_path(m, MRB_CGROUP_cpu, 1, group, key, path, size);
+    }
+    for (i = 0; i < MRB_CGROUP_TYPE_SIZE; i++) {
+        if (strlen(mrb_cgroup_type_names[i]) == len && !strncmp(mrb_cgroup_type_names[i], key, len)) {
+            return mrb_cgroup_build_path(m, (group_type_t)i, 0, group, key, path, size);
+        }
+    }
+    errno = ENOENT;
+
+    return -1;
+}
+
+int mrb_cgroup_unified(mrb_state *mrb)
+{
+    return mrb_cgroup_mounts_get(mrb)->unified;
+}
+
+int mrb_cgroup_fake(mrb_state *mrb)
+{
+    return mrb_cgroup_mounts_get(mrb)->fake;
+}
+
+const char *mrb_cgroup_v2_controller(const char *controller)
+{
+    size_t i;
+
+    for (i = 0; i < MRB_CGROUP_TYPE_SIZE; i++) {
+        if (!strcmp(mrb_cgroup_type_names[i], controller)) {
+            return mrb_cgroup_v2_controllers[i];
+        }
+    }
+
+    return NULL;
+}
+
+int mrb_cgroup_controller_path(mrb_state *mrb, const char *controller, const char *group, char *path, size_t size)
+{
+    const mrb_cgroup_mounts *m = mrb_cgroup_mounts_get(mrb);
+    size_t i;
+
+    if (m->unified) {
+        return mrb_cgroup_build_path(m, MRB_CGROUP_cpu, 1, group, NULL, path, size);
+    }
+    for (i = 0; i < MRB_CGROUP_TYPE_SIZE; i++) {
+        if (!strcmp(mrb_cgroup_type_names[i], controller)) {
+            return mrb_cgroup_build_path(m, (group_type_t)i, 0, group, NULL, path, size);
+        }
+    }
+    errno = ENOENT;
+
+    return -1;
+}
+
+//
+// live read
+//
+
+// the fd of file from the registry entry of the group; *owned is set for a fd of its own, to be closed
+// by the caller, when the entry is full
+static int mrb_cgroup_live_open(mrb_state *mrb, mrb_cgroup_context *ctx, const char *file, int write, int *owned)
+{
+    char path[FILENAME_MAX];
+    int fd;
+
+    *owned = 0;
+    // the group was removed, by this or another mrb_state, since the entry was taken
+    if (ctx->entry && mrb_cgroup_entry_stale(ctx->entry)) {
+        mrb_cgroup_live_close(ctx);
+    }
+    if (ctx->entry == NULL) {
+        if (mrb_cgroup_dir(mrb, ctx, path, sizeof(path)) < 0) {
+            return -1;
+        }
+        if ((ctx->entry = mrb_cgroup_entry_acquire(path)) == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+    if ((fd = mrb_cgroup_entry_fd(ctx->entry, file, write)) >= 0 || errno != ENOSPC) {
+        return fd;
+    }
+
+    MRB_CGROUP_SYSCALL(2);
+    if (mrb_cgroup_path(mrb, ctx, file, path, sizeof(path)) < 0 ||
+        (fd = open(path, (write ? O_WRONLY : O_RDONLY) | O_CLOEXEC)) < 0) {
+        return -1;
+    }
+    *owned = 1;
+
+    return fd;
+}
+
+// the entry taken without a fd, by create: the group is kept from a Cgroup::Reaper of the process while the
+// object lives
+static void mrb_cgroup_live_hold(mrb_state *mrb, mrb_cgroup_context *ctx)
+{
+    char path[FILENAME_MAX];
+
+    if (ctx->entry && mrb_cgroup_entry_stale(ctx->entry)) {
+        mrb_cgroup_live_close(ctx);
+    }
+    if (ctx->entry == NULL && mrb_cgroup_dir(mrb, ctx, path, sizeof(path)) == 0) {
+        ctx->entry = mrb_cgroup_entry_acquire(path);
+    }
+}
+
+// through the shared write fd, so threads attaching into one group do not open the file each time
+static int mrb_cgroup_attach_pid(mrb_state *mrb, mrb_cgroup_context *ctx, pid_t pid)
+{
+    char buf[32];
+    int fd, owned, len, err, retry;
+
+    len = snprintf(buf, sizeof(buf), "%d", (int)pid);
+    for (retry = 1;; retry--) {
+        if ((fd = mrb_cgroup_live_open(mrb, ctx, ctx->v2 ? "cgroup.procs" : "tasks", 1, &owned)) < 0) {
+            return -1;
+        }
+        MRB_CGROUP_SYSCALL(1);
+        err = (pwrite(fd, buf, len, 0) == len) ? 0 : errno;
+        if (owned) {
+            close(fd);
+        }
+        // removed elsewhere and made again at the same path, the file is opened once more
+        if (!owned && retry && (err == ENODEV || err == ENOENT)) {
+            mrb_cgroup_live_drop(ctx);
+            continue;
+        }
+        break;
+    }
+    errno = err;
+
+    return err ? -1 : 0;
+}
+
+// returns the length of the value read into buf, or -1 with errno set
+static ssize_t mrb_cgroup_live_read(mrb_state *mrb, mrb_cgroup_context *ctx, const char *key, char *buf,
+                                    size_t size)
+{
+    const mrb_cgroup_v2_key *k = NULL;
+    const char *file = key;
+    char name[64];
+    ssize_t len;
+    int fd, owned, err, retry;
+
+    if (ctx->v2 && (k = mrb_cgroup_v2_key_get(key)) == NULL) {
+        errno = ENOENT;
+        return -1;
+    }
+    if (k) {
+        file = mrb_cgroup_v2_file(k, key, name, sizeof(name));
+    }
+    for (retry = 1;; retry--) {
+        if ((fd = mrb_cgroup_live_open(mrb, ctx, file, 0, &owned)) < 0) {
+            return -1;
+        }
+        MRB_CGROUP_SYSCALL(1);
+        len = pread(fd, buf, size - 1, 0);
+        err = errno;
+        if (owned) {
+            close(fd);
+        }
+        if (len < 0 && !owned && retry && (err == ENODEV || err == ENOENT)) {
+            mrb_cgroup_live_drop(ctx);
+            continue;
+        }
+        break;
+    }
+    if (len < 0) {
+        errno = err;
+        return -1;
+    }
+    while (len > 0 && isspace((unsigned char)buf[len - 1])) {
+        len--;
+    }
+    buf[len] = '\0';
+
+    return k ? mrb_cgroup_v2_to_v1(k, buf, size) : len;
+}
+
+static mrb_value mrb_cgroup_live_get_int64(mrb_state *mrb, mrb_cgroup_context *ctx, const char *key)
+{
+    char buf[64];
+
+    if (mrb_cgroup_live_read(mrb, ctx, key, buf, sizeof(buf)) < 0) {
+        if (errno == ENOENT) {
+            return mrb_nil_value();
+        }
+        mrb_sys_fail(mrb, key);
+    }
+    return mrb_fixnum_value((int64_t)strtoll(buf, NULL, 10));
+}
+
+static mrb_value mrb_cgroup_live_get_string(mrb_state *mrb, mrb_cgroup_context *ctx, const char *key)
+{
+    char buf[LIVE_BUF_SIZE];
+    ssize_t len;
+
+    if ((len = mrb_cgroup_live_read(mrb, ctx, key, buf, sizeof(buf))) < 0) {
+        if (errno == ENOENT) {
+            return mrb_nil_value();
+        }
+        mrb_sys_fail(mrb, key);
+    }
+    return (len == 0) ? mrb_nil_value() : mrb_str_new(mrb, buf, len);
+}
+
+// a plain 0/1, or the oom_kill_disable line of memory.oom_control
+static mrb_value mrb_cgroup_live_get_bool(mrb_state *mrb, mrb_cgroup_context *ctx, const char *key)
+{
+    char buf[LIVE_BUF_SIZE];
+    int64_t val;
+
+    if (mrb_cgroup_live_read(mrb, ctx, key, buf, sizeof(buf)) < 0) {
+        if (errno == ENOENT) {
+            return mrb_nil_value();
+        }
+        mrb_sys_fail(mrb, key);
+    }
+    if (mrb_cgroup_kv_get(buf, "oom_kill_disable", &val) < 0) {
+        val = strtoll(buf, NULL, 10);
+    }
+    return mrb_bool_value(val != 0);
+}
+
+//
+// parsed values
 //
 
-static mrb_value mrb_cgroup_create(mrb_state *mrb, mrb_value self)
+// reads the raw text of key through the live fd or from the loaded controller, returns -1 when it does not exist
+ssize_t mrb_cgroup_read_raw(mrb_state *mrb, mrb_cgroup_context *ctx, const char *key, char *buf, size_t size)
 {
+    ssize_t len;
+    char *val;
     int code;
-    mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self, "mrb_cgroup_context");
+
+    if (ctx->live || ctx->direct) {
+        if ((len = mrb_cgroup_live_read(mrb, ctx, key, buf, size)) < 0 && errno != ENOENT) {
+            mrb_sys_fail(mrb, key);
+        }
+        return len;
+    }
+
+    mrb_cgroup_load(mrb, ctx);
+    if ((code = cgroup_get_value_string(ctx->cgc, key, &val)) == ECGROUPVALUENOTEXIST) {
+        return -1;
+    } else if (code) {
+        mrb_raisef(mrb, E_RUNTIME_ERROR, "cgroup_get_value_string %S failed: %S(%S)", mrb_str_new_cstr(mrb, key),
+                   mrb_str_new_cstr(mrb, cgroup_strerror(code)), mrb_fixnum_value(code));
+    }
+    len = snprintf(buf, size, "%s", val);
+    free(val);
+
+    return (len < (ssize_t)size) ? len : (ssize_t)size - 1;
+}
+
+// "name value" lines into hash as {:name => value}, existing entries are overwritten
+mrb_value mrb_cgroup_parse_kv(mrb_state *mrb, const char *buf, mrb_value hash)
+{
+    const char *p = buf, *name;
+    char *end;
+    size_t len;
+    int64_t val;
+
+    while (*p) {
+        while (isspace((unsigned char)*p)) {
+            p++;
+        }
+        name = p;
+        while (*p && !isspace((unsigned char)*p)) {
+            p++;
+        }
+        if ((len = p - name) == 0) {
+            break;
+        }
+        val = strtoll(p, &end, 10);
+        if (end != p) {
+            mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern(mrb, name, len)), mrb_fixnum_value(val));
+        }
+        p = end;
+        while (*p && *p != '\n') {
+            p++;
+        }
+    }
+
+    return hash;
+}
+
+// space separated integers into ary, which is truncated to the number of values
+mrb_value mrb_cgroup_parse_list(mrb_state *mrb, const char *buf, mrb_value ary)
+{
+    const char *p = buf;
+    char *end;
+    mrb_int i = 0;
+    int64_t val;
+
+    for (;;) {
+        val = strtoll(p, &end, 10);
+        if (end == p) {
+            break;
+        }
+        mrb_ary_set(mrb, ary, i++, mrb_fixnum_value(val));
+        p = end;
+    }
+    while (RARRAY_LEN(ary) > i) {
+        mrb_ary_pop(mrb, ary);
+    }
+
+    return ary;
+}
+
+static mrb_value mrb_cgroup_set_live(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self);
+    mrb_bool live;
+    mrb_get_args(mrb, "b", &live);
+
+    if (!live) {
+        mrb_cgroup_live_close(mrb_cg_cxt);
+    }
+    mrb_cg_cxt->live = live;
+
+    return self;
+}
+
+static mrb_value mrb_cgroup_live_p(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self);
+    return mrb_bool_value(mrb_cg_cxt->live);
+}
+
+//
+// apply
+//
+
+void mrb_cgroup_mark_dirty(mrb_state *mrb, mrb_cgroup_context *ctx, const char *key)
+{
+    int i;
+
+    for (i = 0; i < ctx->ndirty; i++) {
+        if (ctx->dirty[i] == key || !strcmp(ctx->dirty[i], key)) {
+            return;
+        }
+    }
+    if (ctx->ndirty == DIRTY_KEYS_SIZE) {
+        mrb_raise(mrb, E_RUNTIME_ERROR, "too many keys set before apply");
+    }
+    ctx->dirty[ctx->ndirty++] = key;
+}
+
+// returns 0 on success or -1 with errno set, each line of val is a write of its own
+// (blkio.throttle.* and io.max take one device per write)
+int mrb_cgroup_write_file(mrb_state *mrb, mrb_cgroup_context *ctx, const char *file, const char *val)
+{
+    char path[FILENAME_MAX];
+    size_t len;
+    int fd, err = 0;
+
+    MRB_CGROUP_SYSCALL(2);
+    if (mrb_cgroup_path(mrb, ctx, file, path, sizeof(path)) < 0 ||
+        (fd = open(path, O_WRONLY | O_TRUNC | O_CLOEXEC)) < 0) {
+        return -1;
+    }
+    do {
+        len = strcspn(val, "\n");
+        MRB_CGROUP_SYSCALL(1);
+        // an empty value is written as is, empty lines between devices are skipped
+        if ((len > 0 || *val == '\0') && write(fd, val, len) != (ssize_t)len) {
+            err = errno ? errno : EIO;
+            break;
+        }
+        val += len;
+    } while (*val && *++val);
+    close(fd);
+    if (err) {
+        errno = err;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int mrb_cgroup_write_value(mrb_state *mrb, mrb_cgroup_context *ctx, const char *key, const char *val)
+{
+    return ctx->v2 ? mrb_cgroup_v2_write(mrb, ctx, key, val) : mrb_cgroup_write_file(mrb, ctx, key, val);
+}
+
+int mrb_cgroup_write_key(mrb_state *mrb, const char *group, const char *key, const char *val)
+{
+    mrb_cgroup_context ctx;
+    size_t i, len = strcspn(key, ".");
+
+    // a context on the stack, only what the path builders look at
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.mounts = mrb_cgroup_mounts_get(mrb);
+    ctx.v2 = ctx.mounts->unified;
+    ctx.direct = 1;
+    ctx.group_name = mrb_str_new_cstr(mrb, group);
+    for (i = 0; i < MRB_CGROUP_TYPE_SIZE; i++) {
+        if (strlen(mrb_cgroup_type_names[i]) == len && !strncmp(mrb_cgroup_type_names[i], key, len)) {
+            ctx.type = (group_type_t)i;
+            return mrb_cgroup_write_value(mrb, &ctx, key, val);
+        }
+    }
+    errno = ENOENT;
+
+    return -1;
+}
+
+// writes the dirty keys, per-key failures are stored into failures as {"key" => "message"} and counted
+static int mrb_cgroup_apply_context(mrb_state *mrb, mrb_cgroup_context *ctx, mrb_value failures)
+{
+    const char *key;
+    char *val;
+    int i, code, nfailures = 0;
+
+    if (!ctx->already_exist) {
+        if (mrb_cgroup_mkdir(mrb, ctx) < 0) {
+            mrb_sys_fail(mrb, RSTRING_PTR(ctx->group_name));
+        }
+        ctx->already_exist = 1;
+        ctx->loaded = 0;
+    }
+
+    for (i = 0; i < ctx->ndirty; i++) {
+        key = ctx->dirty[i];
+        if ((code = cgroup_get_value_string(ctx->cgc, key, &val))) {
+            mrb_hash_set(mrb, failures, mrb_str_new_cstr(mrb, key), mrb_str_new_cstr(mrb, cgroup_strerror(code)));
+            nfailures++;
+            continue;
+        }
+        if (mrb_cgroup_write_value(mrb, ctx, key, val) < 0) {
+            mrb_hash_set(mrb, failures, mrb_str_new_cstr(mrb, key), mrb_str_new_cstr(mrb, strerror(errno)));
+            nfailures++;
+        }
+        free(val);
+    }
+    ctx->ndirty = 0;
+
+    return nfailures;
+}
+
+// obj.apply => {} or Cgroup.apply([cpu, cpuset, memory]) => [{}, {}, {}]
+static mrb_value mrb_cgroup_apply_body(mrb_state *mrb, mrb_value self)
+{
+    mrb_value list = mrb_nil_value();
+    mrb_value failures, result;
+    mrb_int i;
+    int ai, nfailures = 0;
+    mrb_get_args(mrb, "|A", &list);
+
+    // failed keys are returned, not raised, and counted as an error of the whole call
+    if (mrb_nil_p(list)) {
+        failures = mrb_hash_new(mrb);
+        if (mrb_cgroup_apply_context(mrb, mrb_cgroup_get_context(mrb, self), failures)) {
+            mrb_cgroup_metrics_fail();
+        }
+        return failures;
+    }
+
+    result = mrb_ary_new_capa(mrb, RARRAY_LEN(list));
+    ai = mrb_gc_arena_save(mrb);
+    for (i = 0; i < RARRAY_LEN(list); i++) {
+        failures = mrb_hash_new(mrb);
+        nfailures += mrb_cgroup_apply_context(mrb, mrb_cgroup_get_context(mrb, mrb_ary_ref(mrb, list, i)), failures);
+        mrb_ary_push(mrb, result, failures);
+        mrb_gc_arena_restore(mrb, ai);
+    }
+    if (nfailures > 0) {
+        mrb_cgroup_metrics_fail();
+    }
+
+    return result;
+}
+MRB_CGROUP_TIMED(MRB_CGROUP_OP_CREATE, mrb_cgroup_apply)
+
+static mrb_value mrb_cgroup_modify_body(mrb_state *mrb, mrb_value self)
+{
+    mrb_value failures = mrb_hash_new(mrb);
+
+    if (mrb_cgroup_apply_context(mrb, mrb_cgroup_get_context(mrb, self), failures)) {
+        mrb_raisef(mrb, E_RUNTIME_ERROR, "cgroup_modify failed: %S", mrb_inspect(mrb, failures));
+    }
+
+    return self;
+}
+MRB_CGROUP_TIMED(MRB_CGROUP_OP_CREATE, mrb_cgroup_modify)
+
+//
+// group
+//
+
+static mrb_value mrb_cgroup_create_body(mrb_state *mrb, mrb_value self)
+{
+    int i, code;
+    char *val;
+    mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self);
 
     // BUG1 : cgroup_create_cgroup returns an error(Invalid argument:50016:ECGOTHER), despite actually succeeding
     // BUG2 : cgroup_delete_cgroup returns an error(This kernel does not support this
@@ -126,21 +1346,51 @@ static mrb_value mrb_cgroup_create(mrb_state *mrb, mrb_value self)
     //        }
     //
 
+    if (mrb_cg_cxt->direct) {
+        mrb_cgroup_modify_body(mrb, self);
+        mrb_cgroup_live_hold(mrb, mrb_cg_cxt);
+        return self;
+    }
     if ((code = cgroup_create_cgroup(mrb_cg_cxt->cg, 1)) && code != ECGOTHER && code != ECGCANTSETVALUE) {
         mrb_raisef(mrb, E_RUNTIME_ERROR, "cgroup_create failed: %S(%S)", mrb_str_new_cstr(mrb, cgroup_strerror(code)),
                    mrb_fixnum_value(code));
     }
+    if (!mrb_cg_cxt->already_exist) {
+        // the defaults of a new group are loaded on the next getter call
+        mrb_cg_cxt->loaded = 0;
+    }
     mrb_cg_cxt->already_exist = 1;
-    mrb_iv_set(mrb, self, mrb_intern_cstr(mrb, "mrb_cgroup_context"),
-               mrb_obj_value(Data_Wrap_Struct(mrb, mrb->object_class, &mrb_cgroup_context_type, (void *)mrb_cg_cxt)));
+    // libcgroup writes a value in one write, per device blkio lines are written again one by one
+    for (i = 0; i < mrb_cg_cxt->ndirty; i++) {
+        if (cgroup_get_value_string(mrb_cg_cxt->cgc, mrb_cg_cxt->dirty[i], &val) == 0) {
+            if (strchr(val, '\n')) {
+                mrb_cgroup_write_file(mrb, mrb_cg_cxt, mrb_cg_cxt->dirty[i], val);
+            }
+            free(val);
+        }
+    }
+    mrb_cg_cxt->ndirty = 0;
+    mrb_cgroup_live_hold(mrb, mrb_cg_cxt);
 
     return self;
 }
+MRB_CGROUP_TIMED(MRB_CGROUP_OP_CREATE, mrb_cgroup_create)
 
-static mrb_value mrb_cgroup_delete(mrb_state *mrb, mrb_value self)
+static mrb_value mrb_cgroup_delete_body(mrb_state *mrb, mrb_value self)
 {
     int code;
-    mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self, "mrb_cgroup_context");
+    char path[FILENAME_MAX];
+    mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self);
+
+    // the fds of the removed directory are of no use to a group made again at the same path
+    mrb_cgroup_live_close(mrb_cg_cxt);
+    if (mrb_cg_cxt->direct) {
+        if (mrb_cgroup_rmdir(mrb, mrb_cg_cxt) < 0 && errno != ENOENT) {
+            mrb_sys_fail(mrb, "cgroup_delete failed");
+        }
+        mrb_cg_cxt->already_exist = 0;
+        return self;
+    }
 
     // BUG1 : cgroup_delete_cgroup returns an error(No such file or directory:50016:ECGOTHER), despite actually
     // succeeding
@@ -148,13 +1398,18 @@ static mrb_value mrb_cgroup_delete(mrb_state *mrb, mrb_value self)
         mrb_raisef(mrb, E_RUNTIME_ERROR, "cgroup_delete faild: %S(%S)", mrb_str_new_cstr(mrb, cgroup_strerror(code)),
                    mrb_fixnum_value(code));
     }
+    if (mrb_cgroup_dir(mrb, mrb_cg_cxt, path, sizeof(path)) == 0) {
+        mrb_cgroup_registry_evict(path);
+    }
+    mrb_cg_cxt->already_exist = 0;
 
     return self;
 }
+MRB_CGROUP_TIMED(MRB_CGROUP_OP_DELETE, mrb_cgroup_delete)
 
 static mrb_value mrb_cgroup_exist_p(mrb_state *mrb, mrb_value self)
 {
-    mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self, "mrb_cgroup_context");
+    mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self);
     return (mrb_cg_cxt->already_exist) ? mrb_true_value() : mrb_false_value();
 }
 
@@ -162,26 +1417,101 @@ static mrb_value mrb_cgroup_exist_p(mrb_state *mrb, mrb_value self)
 // task
 //
 
-static mrb_value mrb_cgroup_attach(mrb_state *mrb, mrb_value self)
+static mrb_value mrb_cgroup_attach_body(mrb_state *mrb, mrb_value self)
 {
-    mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self, "mrb_cgroup_context");
+    mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self);
     mrb_value pid = mrb_nil_value();
-    mrb_get_args(mrb, "|i", &pid);
+    int code;
+    mrb_get_args(mrb, "|o", &pid);
 
+    if (!mrb_nil_p(pid) && !mrb_fixnum_p(pid)) {
+        mrb_raise(mrb, E_TYPE_ERROR, "pid must be an Integer");
+    }
+    if (mrb_cg_cxt->direct) {
+        if (mrb_cgroup_attach_pid(mrb, mrb_cg_cxt, mrb_nil_p(pid) ? getpid() : (pid_t)mrb_fixnum(pid)) < 0) {
+            mrb_sys_fail(mrb, "cgroup_attach failed");
+        }
+        return self;
+    }
     if (mrb_nil_p(pid)) {
-        cgroup_attach_task(mrb_cg_cxt->cg);
+        code = cgroup_attach_task(mrb_cg_cxt->cg);
     } else {
-        cgroup_attach_task_pid(mrb_cg_cxt->cg, mrb_fixnum(pid));
+        code = cgroup_attach_task_pid(mrb_cg_cxt->cg, mrb_fixnum(pid));
+    }
+    if (code) {
+        mrb_raisef(mrb, E_RUNTIME_ERROR, "cgroup_attach failed: %S(%S)", mrb_str_new_cstr(mrb, cgroup_strerror(code)),
+                   mrb_fixnum_value(code));
     }
-    mrb_iv_set(mrb, self, mrb_intern_cstr(mrb, "mrb_cgroup_context"),
-               mrb_obj_value(Data_Wrap_Struct(mrb, mrb->object_class, &mrb_cgroup_context_type, (void *)mrb_cg_cxt)));
 
     return self;
 }
+MRB_CGROUP_TIMED(MRB_CGROUP_OP_ATTACH, mrb_cgroup_attach)
+
+// writes every id of the Array argument into file through one open fd, returns the ids that failed
+static mrb_value mrb_cgroup_attach_list(mrb_state *mrb, mrb_value self, const char *file)
+{
+    mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self);
+    mrb_value list, failed, id;
+    struct timespec start, end;
+    char path[FILENAME_MAX], buf[32];
+    mrb_int i;
+    int fd, len;
+    mrb_get_args(mrb, "A", &list);
+
+    for (i = 0; i < RARRAY_LEN(list); i++) {
+        if (!mrb_fixnum_p(mrb_ary_ref(mrb, list, i))) {
+            mrb_raise(mrb, E_TYPE_ERROR, "pid must be an Integer");
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    MRB_CGROUP_SYSCALL(RARRAY_LEN(list) + 2);
+    if (mrb_cgroup_path(mrb, mrb_cg_cxt, file, path, sizeof(path)) < 0 || (fd = open(path, O_WRONLY | O_CLOEXEC)) < 0) {
+        mrb_sys_fail(mrb, file);
+    }
+    // the kernel takes one id per write(2), the open fd saves the open/close of every id
+    failed = mrb_ary_new(mrb);
+    for (i = 0; i < RARRAY_LEN(list); i++) {
+        id = mrb_ary_ref(mrb, list, i);
+        len = snprintf(buf, sizeof(buf), "%lld", (long long)mrb_fixnum(id));
+        if (write(fd, buf, len) != len) {
+            mrb_ary_push(mrb, failed, id);
+        }
+    }
+    close(fd);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    mrb_cg_cxt->attach_usec = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
+    if (RARRAY_LEN(failed) > 0) {
+        mrb_cgroup_metrics_fail();
+    }
+
+    return failed;
+}
+
+static mrb_value mrb_cgroup_attach_many_body(mrb_state *mrb, mrb_value self)
+{
+    return mrb_cgroup_attach_list(mrb, self, "cgroup.procs");
+}
+MRB_CGROUP_TIMED(MRB_CGROUP_OP_ATTACH, mrb_cgroup_attach_many)
+
+static mrb_value mrb_cgroup_attach_threads_body(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self);
+
+    return mrb_cgroup_attach_list(mrb, self, mrb_cg_cxt->v2 ? "cgroup.threads" : "tasks");
+}
+MRB_CGROUP_TIMED(MRB_CGROUP_OP_ATTACH, mrb_cgroup_attach_threads)
+
+static mrb_value mrb_cgroup_attach_usec(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self);
+
+    return mrb_fixnum_value(mrb_cg_cxt->attach_usec);
+}
 
 static mrb_value mrb_cgroup_group_name(mrb_state *mrb, mrb_value self)
 {
-    mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self, "mrb_cgroup_context");
+    mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self);
     if (mrb_cg_cxt) {
         return mrb_cg_cxt->group_name;
     } else {
@@ -193,42 +1523,44 @@ static mrb_value mrb_cgroup_group_name(mrb_state *mrb, mrb_value self)
 // init
 //
 #define SET_MRB_CGROUP_INIT_GROUP(gname)                                                                               \
-    static mrb_value mrb_cgroup_##gname##_init(mrb_state *mrb, mrb_value self)                                         \
+    static mrb_value mrb_cgroup_##gname##_init##_body(mrb_state *mrb, mrb_value self)                                  \
     {                                                                                                                  \
-        mrb_cgroup_context *mrb_cg_cxt = (mrb_cgroup_context *)mrb_malloc(mrb, sizeof(mrb_cgroup_context));            \
+        mrb_cgroup_context *mrb_cg_cxt = (mrb_cgroup_context *)DATA_PTR(self);                                         \
+        mrb_value group_name;                                                                                          \
+        int v2;                                                                                                        \
                                                                                                                        \
-        mrb_cg_cxt->type = MRB_CGROUP_##gname;                                                                         \
-        if (cgroup_init()) {                                                                                           \
-            mrb_raise(mrb, E_RUNTIME_ERROR, "cgroup_init " #gname " failed");                                           \
+        mrb_get_args(mrb, "S", &group_name);                                                                           \
+        if (mrb_cg_cxt) {                                                                                              \
+            mrb_cgroup_context_free(mrb, mrb_cg_cxt);                                                                  \
         }                                                                                                              \
-        mrb_get_args(mrb, "o", &mrb_cg_cxt->group_name);                                                               \
+        DATA_TYPE(self) = &mrb_cgroup_context_type;                                                                    \
+        DATA_PTR(self) = NULL;                                                                                         \
+        v2 = mrb_cgroup_check_init(mrb, #gname);                                                                       \
+                                                                                                                       \
+        /* self owns the context from here, so a raise below does not leak it */                                       \
+        mrb_cg_cxt = (mrb_cgroup_context *)mrb_calloc(mrb, 1, sizeof(mrb_cgroup_context));                             \
+        DATA_PTR(self) = mrb_cg_cxt;                                                                                   \
+        mrb_cg_cxt->type = MRB_CGROUP_##gname;                                                                         \
+        mrb_cg_cxt->v2 = v2;                                                                                           \
+        mrb_cg_cxt->mounts = mrb_cgroup_get_state(mrb)->mounts;                                                        \
+        mrb_cg_cxt->direct = v2 || mrb_cg_cxt->mounts->root;                                                           \
+        mrb_cg_cxt->group_name = group_name;                                                                           \
+        /* the context is not marked by the GC, keep the name reachable from self */                                   \
+        mrb_iv_set(mrb, self, mrb_intern_lit(mrb, "mrb_cgroup_group_name"), group_name);                               \
         mrb_cg_cxt->cg = cgroup_new_cgroup(RSTRING_PTR(mrb_cg_cxt->group_name));                                       \
         if (mrb_cg_cxt->cg == NULL) {                                                                                  \
             mrb_raise(mrb, E_RUNTIME_ERROR, "cgroup_new_cgroup failed");                                                \
         }                                                                                                              \
                                                                                                                        \
-        if (cgroup_get_cgroup(mrb_cg_cxt->cg)) {                                                                       \
-            mrb_cg_cxt->already_exist = 0;                                                                             \
-            mrb_cg_cxt->cgc = cgroup_add_controller(mrb_cg_cxt->cg, #gname);                                           \
-            if (mrb_cg_cxt->cgc == NULL) {                                                                             \
-                mrb_raise(mrb, E_RUNTIME_ERROR, "cgroup_add_controller " #gname " failed");                             \
-            }                                                                                                          \
-        } else {                                                                                                       \
-            mrb_cg_cxt->already_exist = 1;                                                                             \
-            mrb_cg_cxt->cgc = cgroup_get_controller(mrb_cg_cxt->cg, #gname);                                           \
-            if (mrb_cg_cxt->cgc == NULL) {                                                                             \
-                mrb_cg_cxt->cgc = cgroup_add_controller(mrb_cg_cxt->cg, #gname);                                       \
-                if (mrb_cg_cxt->cgc == NULL) {                                                                         \
-                    mrb_raise(mrb, E_RUNTIME_ERROR, "get_cgroup success, but add_controller " #gname " failed");       \
-                }                                                                                                      \
-            }                                                                                                          \
+        mrb_cg_cxt->cgc = cgroup_add_controller(mrb_cg_cxt->cg, #gname);                                               \
+        if (mrb_cg_cxt->cgc == NULL) {                                                                                 \
+            mrb_raise(mrb, E_RUNTIME_ERROR, "cgroup_add_controller " #gname " failed");                                \
         }                                                                                                              \
-        mrb_iv_set(                                                                                                    \
-            mrb, self, mrb_intern_cstr(mrb, "mrb_cgroup_context"),                                                     \
-            mrb_obj_value(Data_Wrap_Struct(mrb, mrb->object_class, &mrb_cgroup_context_type, (void *)mrb_cg_cxt)));    \
+        mrb_cg_cxt->already_exist = mrb_cgroup_group_exist(mrb, mrb_cg_cxt);                                           \
                                                                                                                        \
         return self;                                                                                                   \
-    }
+    }                                                                                                                  \
+    MRB_CGROUP_TIMED(MRB_CGROUP_OP_INIT, mrb_cgroup_##gname##_init)
 
 SET_MRB_CGROUP_INIT_GROUP(cpu);
 SET_MRB_CGROUP_INIT_GROUP(cpuset);
@@ -236,14 +1568,16 @@ SET_MRB_CGROUP_INIT_GROUP(cpuacct);
 SET_MRB_CGROUP_INIT_GROUP(blkio);
 SET_MRB_CGROUP_INIT_GROUP(memory);
 SET_MRB_CGROUP_INIT_GROUP(pids);
+SET_MRB_CGROUP_INIT_GROUP(freezer);
+SET_MRB_CGROUP_INIT_GROUP(hugetlb);
 
 //
 // cgroup_set_value_int64
 //
 #define SET_VALUE_INT64_MRB_CGROUP(gname, key)                                                                         \
-    static mrb_value mrb_cgroup_set_##gname##_##key(mrb_state *mrb, mrb_value self)                                    \
+    static mrb_value mrb_cgroup_set_##gname##_##key##_body(mrb_state *mrb, mrb_value self)                             \
     {                                                                                                                  \
-        mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self, "mrb_cgroup_context");                      \
+        mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self);                                            \
         mrb_value val;                                                                                                 \
         int code;                                                                                                      \
         mrb_get_args(mrb, "o", &val);                                                                                  \
@@ -252,12 +1586,11 @@ SET_MRB_CGROUP_INIT_GROUP(pids);
             mrb_raisef(mrb, E_RUNTIME_ERROR, "cgroup_set_value_int64 " #gname "." #key " failed: %S",                  \
                        mrb_str_new_cstr(mrb, cgroup_strerror(code)));                                                  \
         }                                                                                                              \
-        mrb_iv_set(                                                                                                    \
-            mrb, self, mrb_intern_cstr(mrb, "mrb_cgroup_context"),                                                     \
-            mrb_obj_value(Data_Wrap_Struct(mrb, mrb->object_class, &mrb_cgroup_context_type, (void *)mrb_cg_cxt)));    \
+        mrb_cgroup_mark_dirty(mrb, mrb_cg_cxt, #gname "." #key);                                                       \
                                                                                                                        \
         return self;                                                                                                   \
-    }
+    }                                                                                                                  \
+    MRB_CGROUP_TIMED(MRB_CGROUP_OP_SET, mrb_cgroup_set_##gname##_##key)
 
 SET_VALUE_INT64_MRB_CGROUP(cpu, cfs_quota_us);
 SET_VALUE_INT64_MRB_CGROUP(cpu, cfs_period_us);
@@ -266,14 +1599,23 @@ SET_VALUE_INT64_MRB_CGROUP(cpu, rt_runtime_us);
 SET_VALUE_INT64_MRB_CGROUP(cpu, shares);
 SET_VALUE_INT64_MRB_CGROUP(cpuacct, usage);
 SET_VALUE_INT64_MRB_CGROUP(memory, limit_in_bytes);
+SET_VALUE_INT64_MRB_CGROUP(memory, soft_limit_in_bytes);
+SET_VALUE_INT64_MRB_CGROUP(memory, swappiness);
+SET_VALUE_INT64_MRB_CGROUP(memory, move_charge_at_immigrate);
+SET_VALUE_INT64_MRB_CGROUP(memory, high);
+SET_VALUE_INT64_MRB_CGROUP(memory, low);
 SET_VALUE_INT64_MRB_CGROUP(pids, max);
 
 #define GET_VALUE_INT64_MRB_CGROUP(gname, key)                                                                         \
-    static mrb_value mrb_cgroup_get_##gname##_##key(mrb_state *mrb, mrb_value self)                                    \
+    static mrb_value mrb_cgroup_get_##gname##_##key##_body(mrb_state *mrb, mrb_value self)                             \
     {                                                                                                                  \
-        mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self, "mrb_cgroup_context");                      \
+        mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self);                                            \
         int64_t val;                                                                                                   \
         int code;                                                                                                      \
+        if (mrb_cg_cxt->live || mrb_cg_cxt->direct) {                                                                  \
+            return mrb_cgroup_live_get_int64(mrb, mrb_cg_cxt, #gname "." #key);                                        \
+        }                                                                                                              \
+        mrb_cgroup_load(mrb, mrb_cg_cxt);                                                                              \
         if ((code = cgroup_get_value_int64(mrb_cg_cxt->cgc, #gname "." #key, &val)) && code != ECGROUPVALUENOTEXIST) { \
             mrb_raisef(mrb, E_RUNTIME_ERROR, "cgroup_get_value_int64 " #gname "." #key " failed: %S(%S)",              \
                        mrb_str_new_cstr(mrb, cgroup_strerror(code)), mrb_fixnum_value(code));                          \
@@ -283,7 +1625,8 @@ SET_VALUE_INT64_MRB_CGROUP(pids, max);
         } else {                                                                                                       \
             return mrb_fixnum_value(val);                                                                              \
         }                                                                                                              \
-    }
+    }                                                                                                                  \
+    MRB_CGROUP_TIMED(MRB_CGROUP_OP_GET, mrb_cgroup_get_##gname##_##key)
 
 GET_VALUE_INT64_MRB_CGROUP(cpu, cfs_quota_us);
 GET_VALUE_INT64_MRB_CGROUP(cpu, cfs_period_us);
@@ -294,6 +1637,11 @@ GET_VALUE_INT64_MRB_CGROUP(cpuacct, usage);
 GET_VALUE_INT64_MRB_CGROUP(memory, limit_in_bytes);
 GET_VALUE_INT64_MRB_CGROUP(memory, usage_in_bytes);
 GET_VALUE_INT64_MRB_CGROUP(memory, max_usage_in_bytes);
+GET_VALUE_INT64_MRB_CGROUP(memory, soft_limit_in_bytes);
+GET_VALUE_INT64_MRB_CGROUP(memory, swappiness);
+GET_VALUE_INT64_MRB_CGROUP(memory, move_charge_at_immigrate);
+GET_VALUE_INT64_MRB_CGROUP(memory, high);
+GET_VALUE_INT64_MRB_CGROUP(memory, low);
 GET_VALUE_INT64_MRB_CGROUP(pids, current);
 GET_VALUE_INT64_MRB_CGROUP(pids, max);
 
@@ -301,12 +1649,16 @@ GET_VALUE_INT64_MRB_CGROUP(pids, max);
 // cgroup_get_value_string
 //
 #define GET_VALUE_STRING_MRB_CGROUP(gname, key)                                                                        \
-    static mrb_value mrb_cgroup_get_##gname##_##key(mrb_state *mrb, mrb_value self)                                    \
+    static mrb_value mrb_cgroup_get_##gname##_##key##_body(mrb_state *mrb, mrb_value self)                             \
     {                                                                                                                  \
         int code;                                                                                                      \
         char *val;                                                                                                     \
-        mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self, "mrb_cgroup_context");                      \
+        mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self);                                            \
                                                                                                                        \
+        if (mrb_cg_cxt->live || mrb_cg_cxt->direct) {                                                                  \
+            return mrb_cgroup_live_get_string(mrb, mrb_cg_cxt, #gname "." #key);                                       \
+        }                                                                                                              \
+        mrb_cgroup_load(mrb, mrb_cg_cxt);                                                                              \
         if ((code = cgroup_get_value_string(mrb_cg_cxt->cgc, #gname "." #key, &val)) != 0 &&                           \
             code != ECGROUPVALUENOTEXIST) {                                                                            \
             mrb_raisef(mrb, E_RUNTIME_ERROR, "cgroup_get_value_string " #gname "." #key " failed: %S(%S)",             \
@@ -317,7 +1669,8 @@ GET_VALUE_INT64_MRB_CGROUP(pids, max);
         } else {                                                                                                       \
             return mrb_str_new_cstr(mrb, val);                                                                         \
         }                                                                                                              \
-    }
+    }                                                                                                                  \
+    MRB_CGROUP_TIMED(MRB_CGROUP_OP_GET, mrb_cgroup_get_##gname##_##key)
 
 GET_VALUE_STRING_MRB_CGROUP(cpu, stat);
 GET_VALUE_STRING_MRB_CGROUP(cpuset, cpus);
@@ -325,16 +1678,65 @@ GET_VALUE_STRING_MRB_CGROUP(cpuset, mems);
 GET_VALUE_STRING_MRB_CGROUP(cpuacct, stat);
 GET_VALUE_STRING_MRB_CGROUP(cpuacct, usage_percpu);
 
+//
+// parsed cgroup_get_value_string, an optional argument is filled in place instead of allocating a new object
+//
+#define GET_VALUE_HASH_MRB_CGROUP(gname, key)                                                                          \
+    static mrb_value mrb_cgroup_get_##gname##_##key##_hash##_body(mrb_state *mrb, mrb_value self)                      \
+    {                                                                                                                  \
+        mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self);                                            \
+        mrb_value hash = mrb_nil_value();                                                                              \
+        char buf[LIVE_BUF_SIZE];                                                                                       \
+        mrb_get_args(mrb, "|H", &hash);                                                                                \
+                                                                                                                       \
+        if (mrb_cgroup_read_raw(mrb, mrb_cg_cxt, #gname "." #key, buf, sizeof(buf)) < 0) {                             \
+            return mrb_nil_value();                                                                                    \
+        }                                                                                                              \
+        if (mrb_nil_p(hash)) {                                                                                         \
+            hash = mrb_hash_new(mrb);                                                                                  \
+        }                                                                                                              \
+        return mrb_cgroup_parse_kv(mrb, buf, hash);                                                                    \
+    }                                                                                                                  \
+    MRB_CGROUP_TIMED(MRB_CGROUP_OP_GET, mrb_cgroup_get_##gname##_##key##_hash)
+
+GET_VALUE_HASH_MRB_CGROUP(cpu, stat);
+GET_VALUE_HASH_MRB_CGROUP(cpuacct, stat);
+GET_VALUE_HASH_MRB_CGROUP(memory, stat);
+
+#define GET_VALUE_ARRAY_MRB_CGROUP(gname, key)                                                                         \
+    static mrb_value mrb_cgroup_get_##gname##_##key##_array##_body(mrb_state *mrb, mrb_value self)                     \
+    {                                                                                                                  \
+        mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self);                                            \
+        mrb_value ary = mrb_nil_value();                                                                               \
+        char buf[LIVE_BUF_SIZE];                                                                                       \
+        mrb_get_args(mrb, "|A", &ary);                                                                                 \
+                                                                                                                       \
+        if (mrb_cgroup_read_raw(mrb, mrb_cg_cxt, #gname "." #key, buf, sizeof(buf)) < 0) {                             \
+            return mrb_nil_value();                                                                                    \
+        }                                                                                                              \
+        if (mrb_nil_p(ary)) {                                                                                          \
+            ary = mrb_ary_new(mrb);                                                                                    \
+        }                                                                                                              \
+        return mrb_cgroup_parse_list(mrb, buf, ary);                                                                   \
+    }                                                                                                                  \
+    MRB_CGROUP_TIMED(MRB_CGROUP_OP_GET, mrb_cgroup_get_##gname##_##key##_array)
+
+GET_VALUE_ARRAY_MRB_CGROUP(cpuacct, usage_percpu);
+
 //
 // cgroup_get_value_string (a number of keys are 2)
 //
 #define GET_VALUE_STRING_MRB_CGROUP_KEY2(gname, key1, key2)                                                            \
-    static mrb_value mrb_cgroup_get_##gname##_##key1##_##key2(mrb_state *mrb, mrb_value self)                          \
+    static mrb_value mrb_cgroup_get_##gname##_##key1##_##key2##_body(mrb_state *mrb, mrb_value self)                   \
     {                                                                                                                  \
         int code;                                                                                                      \
         char *val;                                                                                                     \
-        mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self, "mrb_cgroup_context");                      \
+        mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self);                                            \
                                                                                                                        \
+        if (mrb_cg_cxt->live || mrb_cg_cxt->direct) {                                                                  \
+            return mrb_cgroup_live_get_string(mrb, mrb_cg_cxt, #gname "." #key1 "." #key2);                            \
+        }                                                                                                              \
+        mrb_cgroup_load(mrb, mrb_cg_cxt);                                                                              \
         if ((code = cgroup_get_value_string(mrb_cg_cxt->cgc, #gname "." #key1 "." #key2, &val)) != 0 &&                \
             code != ECGROUPVALUENOTEXIST) {                                                                            \
             mrb_raisef(mrb, E_RUNTIME_ERROR, "cgroup_get_value_string " #gname "." #key1 "." #key2 " failed: %S(%S)",  \
@@ -345,7 +1747,8 @@ GET_VALUE_STRING_MRB_CGROUP(cpuacct, usage_percpu);
         } else {                                                                                                       \
             return mrb_str_new_cstr(mrb, val);                                                                         \
         }                                                                                                              \
-    }
+    }                                                                                                                  \
+    MRB_CGROUP_TIMED(MRB_CGROUP_OP_GET, mrb_cgroup_get_##gname##_##key1##_##key2)
 
 GET_VALUE_STRING_MRB_CGROUP_KEY2(blkio, throttle, read_bps_device);
 GET_VALUE_STRING_MRB_CGROUP_KEY2(blkio, throttle, write_bps_device);
@@ -356,12 +1759,16 @@ GET_VALUE_STRING_MRB_CGROUP_KEY2(blkio, throttle, write_iops_device);
 // cgroup_get_value_int64 (a number of keys are 2)
 //
 #define GET_VALUE_INT64_MRB_CGROUP_KEY2(gname, key1, key2)                                                             \
-    static mrb_value mrb_cgroup_get_##gname##_##key1##_##key2(mrb_state *mrb, mrb_value self)                          \
+    static mrb_value mrb_cgroup_get_##gname##_##key1##_##key2##_body(mrb_state *mrb, mrb_value self)                   \
     {                                                                                                                  \
         int code;                                                                                                      \
         int64_t val;                                                                                                   \
-        mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self, "mrb_cgroup_context");                      \
+        mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self);                                            \
                                                                                                                        \
+        if (mrb_cg_cxt->live || mrb_cg_cxt->direct) {                                                                  \
+            return mrb_cgroup_live_get_int64(mrb, mrb_cg_cxt, #gname "." #key1 "." #key2);                             \
+        }                                                                                                              \
+        mrb_cgroup_load(mrb, mrb_cg_cxt);                                                                              \
         if ((code = cgroup_get_value_int64(mrb_cg_cxt->cgc, #gname "." #key1 "." #key2, &val)) != 0 &&                 \
             code != ECGROUPVALUENOTEXIST) {                                                                            \
             mrb_raisef(mrb, E_RUNTIME_ERROR, "cgroup_get_value_int64 " #gname "." #key1 "." #key2 " failed: %S(%S)",   \
@@ -372,7 +1779,8 @@ GET_VALUE_STRING_MRB_CGROUP_KEY2(blkio, throttle, write_iops_device);
         } else {                                                                                                       \
             return mrb_fixnum_value(val);                                                                              \
         }                                                                                                              \
-    }
+    }                                                                                                                  \
+    MRB_CGROUP_TIMED(MRB_CGROUP_OP_GET, mrb_cgroup_get_##gname##_##key1##_##key2)
 
 GET_VALUE_INT64_MRB_CGROUP_KEY2(memory, memsw, limit_in_bytes);
 GET_VALUE_INT64_MRB_CGROUP_KEY2(memory, memsw, usage_in_bytes);
@@ -382,57 +1790,33 @@ GET_VALUE_INT64_MRB_CGROUP_KEY2(memory, memsw, max_usage_in_bytes);
 // cgroup_set_value_string
 //
 #define SET_VALUE_STRING_MRB_CGROUP(gname, key)                                                                        \
-    static mrb_value mrb_cgroup_set_##gname##_##key(mrb_state *mrb, mrb_value self)                                    \
+    static mrb_value mrb_cgroup_set_##gname##_##key##_body(mrb_state *mrb, mrb_value self)                             \
     {                                                                                                                  \
-        mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self, "mrb_cgroup_context");                      \
+        mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self);                                            \
         int code;                                                                                                      \
-        char *val;                                                                                                     \
-        mrb_get_args(mrb, "z", &val);                                                                                  \
-        if ((code = cgroup_set_value_string(mrb_cg_cxt->cgc, #gname "." #key, val))) {                                 \
+        mrb_value val;                                                                                                 \
+        mrb_get_args(mrb, "o", &val);                                                                                  \
+        /* anything with a to_s in the list syntax, such as Cgroup::Bitmap */                                          \
+        val = mrb_obj_as_string(mrb, val);                                                                             \
+        if ((code = cgroup_set_value_string(mrb_cg_cxt->cgc, #gname "." #key, RSTRING_PTR(val)))) {                    \
             mrb_raisef(mrb, E_RUNTIME_ERROR, "cgroup_set_value_string " #gname "." #key " failed: %S(%S)",             \
                        mrb_str_new_cstr(mrb, cgroup_strerror(code)), mrb_fixnum_value(code));                          \
         }                                                                                                              \
-        mrb_iv_set(                                                                                                    \
-            mrb, self, mrb_intern_cstr(mrb, "mrb_cgroup_context"),                                                     \
-            mrb_obj_value(Data_Wrap_Struct(mrb, mrb->object_class, &mrb_cgroup_context_type, (void *)mrb_cg_cxt)));    \
+        mrb_cgroup_mark_dirty(mrb, mrb_cg_cxt, #gname "." #key);                                                       \
         return self;                                                                                                   \
-    }
+    }                                                                                                                  \
+    MRB_CGROUP_TIMED(MRB_CGROUP_OP_SET, mrb_cgroup_set_##gname##_##key)
 
 SET_VALUE_STRING_MRB_CGROUP(cpuset, cpus);
 SET_VALUE_STRING_MRB_CGROUP(cpuset, mems);
 
-//
-// cgroup_set_value_string (a number of keys are 2)
-//
-#define SET_VALUE_STRING_MRB_CGROUP_KEY2(gname, key1, key2)                                                            \
-    static mrb_value mrb_cgroup_set_##gname##_##key1##_##key2(mrb_state *mrb, mrb_value self)                          \
-    {                                                                                                                  \
-        mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self, "mrb_cgroup_context");                      \
-        int code;                                                                                                      \
-        char *val;                                                                                                     \
-        mrb_get_args(mrb, "z", &val);                                                                                  \
-        if ((code = cgroup_set_value_string(mrb_cg_cxt->cgc, #gname "." #key1 "." #key2, val)) != 0) {                 \
-            mrb_raisef(mrb, E_RUNTIME_ERROR, "cgroup_set_value_string " #gname "." #key1 "." #key2 " failed: %S(%S)",  \
-                       mrb_str_new_cstr(mrb, cgroup_strerror(code)), mrb_fixnum_value(code));                          \
-        }                                                                                                              \
-        mrb_iv_set(                                                                                                    \
-            mrb, self, mrb_intern_cstr(mrb, "mrb_cgroup_context"),                                                     \
-            mrb_obj_value(Data_Wrap_Struct(mrb, mrb->object_class, &mrb_cgroup_context_type, (void *)mrb_cg_cxt)));    \
-        return self;                                                                                                   \
-    }
-
-SET_VALUE_STRING_MRB_CGROUP_KEY2(blkio, throttle, read_bps_device);
-SET_VALUE_STRING_MRB_CGROUP_KEY2(blkio, throttle, write_bps_device);
-SET_VALUE_STRING_MRB_CGROUP_KEY2(blkio, throttle, read_iops_device);
-SET_VALUE_STRING_MRB_CGROUP_KEY2(blkio, throttle, write_iops_device);
-
 //
 // cgroup_set_value_int64 (a number of keys are 2)
 //
 #define SET_VALUE_INT64_CGROUP_KEY2(gname, key1, key2)                                                                 \
-    static mrb_value mrb_cgroup_set_##gname##_##key1##_##key2(mrb_state *mrb, mrb_value self)                          \
+    static mrb_value mrb_cgroup_set_##gname##_##key1##_##key2##_body(mrb_state *mrb, mrb_value self)                   \
     {                                                                                                                  \
-        mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self, "mrb_cgroup_context");                      \
+        mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self);                                            \
         int code;                                                                                                      \
         mrb_value val;                                                                                                 \
         mrb_get_args(mrb, "o", &val);                                                                                  \
@@ -440,11 +1824,10 @@ SET_VALUE_STRING_MRB_CGROUP_KEY2(blkio, throttle, write_iops_device);
             mrb_raisef(mrb, E_RUNTIME_ERROR, "cgroup_set_value_int64 " #gname "." #key1 "." #key2 " failed: %S(%S)",   \
                        mrb_str_new_cstr(mrb, cgroup_strerror(code)), mrb_fixnum_value(code));                          \
         }                                                                                                              \
-        mrb_iv_set(                                                                                                    \
-            mrb, self, mrb_intern_cstr(mrb, "mrb_cgroup_context"),                                                     \
-            mrb_obj_value(Data_Wrap_Struct(mrb, mrb->object_class, &mrb_cgroup_context_type, (void *)mrb_cg_cxt)));    \
+        mrb_cgroup_mark_dirty(mrb, mrb_cg_cxt, #gname "." #key1 "." #key2);                                            \
         return self;                                                                                                   \
-    }
+    }                                                                                                                  \
+    MRB_CGROUP_TIMED(MRB_CGROUP_OP_SET, mrb_cgroup_set_##gname##_##key1##_##key2)
 
 SET_VALUE_INT64_CGROUP_KEY2(memory, memsw, limit_in_bytes);
 
@@ -452,9 +1835,9 @@ SET_VALUE_INT64_CGROUP_KEY2(memory, memsw, limit_in_bytes);
 // cgroup_set_value_string (a number of keys are 2)
 //
 #define SET_VALUE_STRING_MRB_CGROUP_KEY2_NOT_USE_GNAME(gname, key1, key2)                                              \
-    static mrb_value mrb_cgroup_set_##gname##_##key1##_##key2(mrb_state *mrb, mrb_value self)                          \
+    static mrb_value mrb_cgroup_set_##gname##_##key1##_##key2##_body(mrb_state *mrb, mrb_value self)                   \
     {                                                                                                                  \
-        mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self, "mrb_cgroup_context");                      \
+        mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self);                                            \
         int code;                                                                                                      \
         char *val;                                                                                                     \
         mrb_get_args(mrb, "z", &val);                                                                                  \
@@ -462,11 +1845,10 @@ SET_VALUE_INT64_CGROUP_KEY2(memory, memsw, limit_in_bytes);
             mrb_raisef(mrb, E_RUNTIME_ERROR, "cgroup_set_value_string " #key1 "." #key2 " failed: %S(%S)",             \
                        mrb_str_new_cstr(mrb, cgroup_strerror(code)), mrb_fixnum_value(code));                          \
         }                                                                                                              \
-        mrb_iv_set(                                                                                                    \
-            mrb, self, mrb_intern_cstr(mrb, "mrb_cgroup_context"),                                                     \
-            mrb_obj_value(Data_Wrap_Struct(mrb, mrb->object_class, &mrb_cgroup_context_type, (void *)mrb_cg_cxt)));    \
+        mrb_cgroup_mark_dirty(mrb, mrb_cg_cxt, #key1 "." #key2);                                                       \
         return self;                                                                                                   \
-    }
+    }                                                                                                                  \
+    MRB_CGROUP_TIMED(MRB_CGROUP_OP_SET, mrb_cgroup_set_##gname##_##key1##_##key2)
 
 SET_VALUE_STRING_MRB_CGROUP_KEY2_NOT_USE_GNAME(memory, cgroup, event_control);
 
@@ -474,9 +1856,9 @@ SET_VALUE_STRING_MRB_CGROUP_KEY2_NOT_USE_GNAME(memory, cgroup, event_control);
 // cgroup_set_bool
 //
 #define SET_VALUE_BOOL_MRB_CGROUP(gname, key)                                                                          \
-    static mrb_value mrb_cgroup_set_##gname##_##key(mrb_state *mrb, mrb_value self)                                    \
+    static mrb_value mrb_cgroup_set_##gname##_##key##_body(mrb_state *mrb, mrb_value self)                             \
     {                                                                                                                  \
-        mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self, "mrb_cgroup_context");                      \
+        mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self);                                            \
         mrb_bool val;                                                                                                  \
         int code;                                                                                                      \
         mrb_get_args(mrb, "b", &val);                                                                                  \
@@ -485,21 +1867,24 @@ SET_VALUE_STRING_MRB_CGROUP_KEY2_NOT_USE_GNAME(memory, cgroup, event_control);
             mrb_raisef(mrb, E_RUNTIME_ERROR, "cgroup_set_value_book " #gname "." #key " failed: %S",                   \
                        mrb_str_new_cstr(mrb, cgroup_strerror(code)));                                                  \
         }                                                                                                              \
-        mrb_iv_set(                                                                                                    \
-            mrb, self, mrb_intern_cstr(mrb, "mrb_cgroup_context"),                                                     \
-            mrb_obj_value(Data_Wrap_Struct(mrb, mrb->object_class, &mrb_cgroup_context_type, (void *)mrb_cg_cxt)));    \
+        mrb_cgroup_mark_dirty(mrb, mrb_cg_cxt, #gname "." #key);                                                       \
                                                                                                                        \
         return self;                                                                                                   \
-    }
+    }                                                                                                                  \
+    MRB_CGROUP_TIMED(MRB_CGROUP_OP_SET, mrb_cgroup_set_##gname##_##key)
 
 SET_VALUE_BOOL_MRB_CGROUP(memory, oom_control);
 
 #define GET_VALUE_BOOL_MRB_CGROUP(gname, key)                                                                          \
-    static mrb_value mrb_cgroup_get_##gname##_##key(mrb_state *mrb, mrb_value self)                                    \
+    static mrb_value mrb_cgroup_get_##gname##_##key##_body(mrb_state *mrb, mrb_value self)                             \
     {                                                                                                                  \
-        mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self, "mrb_cgroup_context");                      \
+        mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self);                                            \
         bool val;                                                                                                      \
         int code;                                                                                                      \
+        if (mrb_cg_cxt->live || mrb_cg_cxt->direct) {                                                                  \
+            return mrb_cgroup_live_get_bool(mrb, mrb_cg_cxt, #gname "." #key);                                         \
+        }                                                                                                              \
+        mrb_cgroup_load(mrb, mrb_cg_cxt);                                                                              \
         if ((code = cgroup_get_value_bool(mrb_cg_cxt->cgc, #gname "." #key, &val)) && code != ECGROUPVALUENOTEXIST) {  \
             mrb_raisef(mrb, E_RUNTIME_ERROR, "cgroup_get_value_bool " #gname "." #key " failed: %S(%S)",               \
                        mrb_str_new_cstr(mrb, cgroup_strerror(code)), mrb_fixnum_value(code));                          \
@@ -509,23 +1894,111 @@ SET_VALUE_BOOL_MRB_CGROUP(memory, oom_control);
         } else {                                                                                                       \
             return mrb_bool_value(val);                                                                                \
         }                                                                                                              \
-    }
+    }                                                                                                                  \
+    MRB_CGROUP_TIMED(MRB_CGROUP_OP_GET, mrb_cgroup_get_##gname##_##key)
 
 GET_VALUE_BOOL_MRB_CGROUP(memory, oom_control);
 
+//
+// memory reclaim, written at once instead of by apply
+//
+
+// v1 memory.force_empty; v2 has none, so the whole usage is asked from memory.reclaim
+static mrb_value mrb_cgroup_memory_force_empty_body(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self);
+    char buf[64];
+
+    if (!mrb_cg_cxt->v2) {
+        if (mrb_cgroup_write_file(mrb, mrb_cg_cxt, "memory.force_empty", "0") < 0) {
+            mrb_sys_fail(mrb, "memory.force_empty");
+        }
+        return self;
+    }
+    if (mrb_cgroup_live_read(mrb, mrb_cg_cxt, "memory.usage_in_bytes", buf, sizeof(buf)) < 0) {
+        mrb_sys_fail(mrb, "memory.current");
+    }
+    // EAGAIN: less than asked could be reclaimed
+    if (mrb_cgroup_write_file(mrb, mrb_cg_cxt, "memory.reclaim", buf) < 0 && errno != EAGAIN) {
+        mrb_sys_fail(mrb, "memory.reclaim");
+    }
+
+    return self;
+}
+MRB_CGROUP_TIMED(MRB_CGROUP_OP_SET, mrb_cgroup_memory_force_empty)
+
+// reclaim(bytes) => true, or false when the kernel reclaimed less than bytes (v2 only)
+static mrb_value mrb_cgroup_memory_reclaim_body(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self);
+    char buf[32];
+    mrb_int bytes;
+    mrb_get_args(mrb, "i", &bytes);
+
+    if (bytes <= 0) {
+        mrb_raise(mrb, E_ARGUMENT_ERROR, "bytes must be positive");
+    }
+    snprintf(buf, sizeof(buf), "%lld", (long long)bytes);
+    if (mrb_cgroup_write_file(mrb, mrb_cg_cxt, "memory.reclaim", buf) < 0) {
+        if (errno == EAGAIN) {
+            return mrb_false_value();
+        }
+        mrb_sys_fail(mrb, "memory.reclaim");
+    }
+
+    return mrb_true_value();
+}
+MRB_CGROUP_TIMED(MRB_CGROUP_OP_SET, mrb_cgroup_memory_reclaim)
+
+static mrb_value mrb_cgroup_reload_mounts(mrb_state *mrb, mrb_value self)
+{
+    int code;
+
+    if ((code = mrb_cgroup_state_init(mrb_cgroup_get_state(mrb), 1))) {
+        mrb_raisef(mrb, E_RUNTIME_ERROR, "cgroup_init failed: %S(%S)", mrb_str_new_cstr(mrb, cgroup_strerror(code)),
+                   mrb_fixnum_value(code));
+    }
+
+    return mrb_true_value();
+}
+
+// Cgroup.root = "/tmp/cgroup" takes the hierarchy from a directory (v1: <root>/<controller>), nil restores the
+// mount table; objects created before keep the root and mount table they were created with
+static mrb_value mrb_cgroup_set_root(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_state *st = mrb_cgroup_get_state(mrb);
+    char *root = NULL;
+    int code;
+    mrb_get_args(mrb, "z!", &root);
+
+    free(st->root);
+    st->root = root ? strdup(root) : NULL;
+    if ((code = mrb_cgroup_state_init(st, 0))) {
+        mrb_raisef(mrb, E_RUNTIME_ERROR, "cgroup_init failed: %S(%S)", mrb_str_new_cstr(mrb, cgroup_strerror(code)),
+                   mrb_fixnum_value(code));
+    }
+
+    return root ? mrb_str_new_cstr(mrb, root) : mrb_nil_value();
+}
+
+static mrb_value mrb_cgroup_get_root(mrb_state *mrb, mrb_value self)
+{
+    return mrb_str_new_cstr(mrb, mrb_cgroup_root(mrb));
+}
+
 static mrb_value mrb_cgroup_get_cpuacct_obj(mrb_state *mrb, mrb_value self)
 {
     mrb_value cpuacct_value;
     struct RClass *cpuacct_class, *cgroup_class;
-    mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self, "mrb_cgroup_context");
+    mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self);
 
-    cpuacct_value = mrb_iv_get(mrb, self, mrb_intern_cstr(mrb, "cpuacct_obj"));
+    cpuacct_value = mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "cpuacct_obj"));
     if (mrb_nil_p(cpuacct_value)) {
         cgroup_class = mrb_class_get(mrb, "Cgroup");
         cpuacct_class = (struct RClass *)mrb_class_ptr(
-            mrb_const_get(mrb, mrb_obj_value(cgroup_class), mrb_intern_cstr(mrb, "CPUACCT")));
+            mrb_const_get(mrb, mrb_obj_value(cgroup_class), mrb_intern_lit(mrb, "CPUACCT")));
         cpuacct_value = mrb_obj_new(mrb, cpuacct_class, 1, &mrb_cg_cxt->group_name);
-        mrb_iv_set(mrb, self, mrb_intern_cstr(mrb, "cpuacct_obj"), cpuacct_value);
+        mrb_iv_set(mrb, self, mrb_intern_lit(mrb, "cpuacct_obj"), cpuacct_value);
     }
     return cpuacct_value;
 }
@@ -539,13 +2012,27 @@ void mrb_mruby_cgroup_gem_init(mrb_state *mrb)
     struct RClass *blkio;
     struct RClass *memory;
     struct RClass *pids;
+    struct RClass *freezer;
+    struct RClass *hugetlb;
+    mrb_cgroup_state *st;
 
     cgroup = mrb_define_module(mrb, "Cgroup");
+    st = (mrb_cgroup_state *)mrb_calloc(mrb, 1, sizeof(mrb_cgroup_state));
+    mrb_iv_set(mrb, mrb_obj_value(cgroup), mrb_intern_lit(mrb, "mrb_cgroup_state"),
+               mrb_obj_value(Data_Wrap_Struct(mrb, mrb->object_class, &mrb_cgroup_state_type, (void *)st)));
+    if (getenv("MRUBY_CGROUP_ROOT")) {
+        st->root = strdup(getenv("MRUBY_CGROUP_ROOT"));
+    }
+    // a failure here is retried by the first constructor, hosts without cgroups can still load the gem
+    mrb_cgroup_state_init(st, 0);
+    mrb_define_class_method(mrb, cgroup, "reload_mounts", mrb_cgroup_reload_mounts, MRB_ARGS_NONE());
+    mrb_define_class_method(mrb, cgroup, "root=", mrb_cgroup_set_root, MRB_ARGS_REQ(1));
+    mrb_define_class_method(mrb, cgroup, "root", mrb_cgroup_get_root, MRB_ARGS_NONE());
     mrb_define_module_function(mrb, cgroup, "create", mrb_cgroup_create, MRB_ARGS_NONE());
     // BUG? cgroup_modify_cgroup fail fclose on cg_set_control_value: line:1389 when get existing cgroup
-    // controller
-    // mrb_define_module_function(mrb, cgroup, "modify", mrb_cgroup_modify, MRB_ARGS_NONE());
-    mrb_define_module_function(mrb, cgroup, "modify", mrb_cgroup_create, MRB_ARGS_NONE());
+    // controller, so modify writes the keys set since the last apply by itself
+    mrb_define_module_function(mrb, cgroup, "modify", mrb_cgroup_modify, MRB_ARGS_NONE());
+    mrb_define_module_function(mrb, cgroup, "apply", mrb_cgroup_apply, MRB_ARGS_OPT(1));
     mrb_define_module_function(mrb, cgroup, "open", mrb_cgroup_create, MRB_ARGS_NONE());
     mrb_define_module_function(mrb, cgroup, "delete", mrb_cgroup_delete, MRB_ARGS_NONE());
     mrb_define_module_function(mrb, cgroup, "close", mrb_cgroup_delete, MRB_ARGS_NONE());
@@ -553,10 +2040,16 @@ void mrb_mruby_cgroup_gem_init(mrb_state *mrb)
     // mrb_define_module_function(mrb, cgroup, "path", mrb_cgroup_get_current_path, MRB_ARGS_OPT(1));
     mrb_define_module_function(mrb, cgroup, "exist?", mrb_cgroup_exist_p, MRB_ARGS_NONE());
     mrb_define_module_function(mrb, cgroup, "attach", mrb_cgroup_attach, MRB_ARGS_ANY());
+    mrb_define_module_function(mrb, cgroup, "attach_many", mrb_cgroup_attach_many, MRB_ARGS_REQ(1));
+    mrb_define_module_function(mrb, cgroup, "attach_threads", mrb_cgroup_attach_threads, MRB_ARGS_REQ(1));
+    mrb_define_module_function(mrb, cgroup, "attach_usec", mrb_cgroup_attach_usec, MRB_ARGS_NONE());
     mrb_define_module_function(mrb, cgroup, "group_name", mrb_cgroup_group_name, MRB_ARGS_NONE());
+    mrb_define_module_function(mrb, cgroup, "live=", mrb_cgroup_set_live, MRB_ARGS_REQ(1));
+    mrb_define_module_function(mrb, cgroup, "live?", mrb_cgroup_live_p, MRB_ARGS_NONE());
     DONE;
 
     cpu = mrb_define_class_under(mrb, cgroup, "CPU", mrb->object_class);
+    MRB_SET_INSTANCE_TT(cpu, MRB_TT_DATA);
     mrb_include_module(mrb, cpu, mrb_module_get(mrb, "Cgroup"));
     mrb_define_method(mrb, cpu, "initialize", mrb_cgroup_cpu_init, MRB_ARGS_ANY());
     mrb_define_method(mrb, cpu, "cfs_quota_us=", mrb_cgroup_set_cpu_cfs_quota_us, MRB_ARGS_ANY());
@@ -570,49 +2063,51 @@ void mrb_mruby_cgroup_gem_init(mrb_state *mrb)
     mrb_define_method(mrb, cpu, "shares=", mrb_cgroup_set_cpu_shares, MRB_ARGS_ANY());
     mrb_define_method(mrb, cpu, "shares", mrb_cgroup_get_cpu_shares, MRB_ARGS_NONE());
     mrb_define_method(mrb, cpu, "stat", mrb_cgroup_get_cpu_stat, MRB_ARGS_NONE());
+    mrb_define_method(mrb, cpu, "stat_hash", mrb_cgroup_get_cpu_stat_hash, MRB_ARGS_OPT(1));
     mrb_define_method(mrb, cpu, "cpuacct", mrb_cgroup_get_cpuacct_obj, MRB_ARGS_NONE());
     DONE;
 
     cpuacct = mrb_define_class_under(mrb, cgroup, "CPUACCT", mrb->object_class);
+    MRB_SET_INSTANCE_TT(cpuacct, MRB_TT_DATA);
     mrb_include_module(mrb, cpuacct, mrb_module_get(mrb, "Cgroup"));
     mrb_define_method(mrb, cpuacct, "initialize", mrb_cgroup_cpuacct_init, MRB_ARGS_REQ(1));
     mrb_define_method(mrb, cpuacct, "stat", mrb_cgroup_get_cpuacct_stat, MRB_ARGS_NONE());
+    mrb_define_method(mrb, cpuacct, "stat_hash", mrb_cgroup_get_cpuacct_stat_hash, MRB_ARGS_OPT(1));
     mrb_define_method(mrb, cpuacct, "usage", mrb_cgroup_get_cpuacct_usage, MRB_ARGS_NONE());
     mrb_define_method(mrb, cpuacct, "usage=", mrb_cgroup_set_cpuacct_usage, MRB_ARGS_REQ(1));
     mrb_define_method(mrb, cpuacct, "usage_percpu", mrb_cgroup_get_cpuacct_usage_percpu, MRB_ARGS_NONE());
+    mrb_define_method(mrb, cpuacct, "usage_percpu_array", mrb_cgroup_get_cpuacct_usage_percpu_array,
+                      MRB_ARGS_OPT(1));
     DONE;
 
     cpuset = mrb_define_class_under(mrb, cgroup, "CPUSET", mrb->object_class);
+    MRB_SET_INSTANCE_TT(cpuset, MRB_TT_DATA);
     mrb_include_module(mrb, cpuset, mrb_module_get(mrb, "Cgroup"));
     mrb_define_method(mrb, cpuset, "initialize", mrb_cgroup_cpuset_init, MRB_ARGS_ANY());
     mrb_define_method(mrb, cpuset, "cpus=", mrb_cgroup_set_cpuset_cpus, MRB_ARGS_REQ(1));
     mrb_define_method(mrb, cpuset, "cpus", mrb_cgroup_get_cpuset_cpus, MRB_ARGS_NONE());
     mrb_define_method(mrb, cpuset, "mems=", mrb_cgroup_set_cpuset_mems, MRB_ARGS_REQ(1));
     mrb_define_method(mrb, cpuset, "mems", mrb_cgroup_get_cpuset_mems, MRB_ARGS_NONE());
+    mrb_cgroup_cpuset_methods_init(mrb, cpuset);
     DONE;
 
     blkio = mrb_define_class_under(mrb, cgroup, "BLKIO", mrb->object_class);
+    MRB_SET_INSTANCE_TT(blkio, MRB_TT_DATA);
     mrb_include_module(mrb, blkio, mrb_module_get(mrb, "Cgroup"));
     mrb_define_method(mrb, blkio, "initialize", mrb_cgroup_blkio_init, MRB_ARGS_ANY());
-    mrb_define_method(mrb, blkio, "throttle_read_bps_device=", mrb_cgroup_set_blkio_throttle_read_bps_device,
-                      MRB_ARGS_ANY());
+    mrb_cgroup_blkio_methods_init(mrb, blkio);
     mrb_define_method(mrb, blkio, "throttle_read_bps_device", mrb_cgroup_get_blkio_throttle_read_bps_device,
                       MRB_ARGS_NONE());
-    mrb_define_method(mrb, blkio, "throttle_write_bps_device=", mrb_cgroup_set_blkio_throttle_write_bps_device,
-                      MRB_ARGS_ANY());
     mrb_define_method(mrb, blkio, "throttle_write_bps_device", mrb_cgroup_get_blkio_throttle_write_bps_device,
                       MRB_ARGS_ANY());
-    mrb_define_method(mrb, blkio, "throttle_read_iops_device=", mrb_cgroup_set_blkio_throttle_read_iops_device,
-                      MRB_ARGS_ANY());
     mrb_define_method(mrb, blkio, "throttle_read_iops_device", mrb_cgroup_get_blkio_throttle_read_iops_device,
                       MRB_ARGS_NONE());
-    mrb_define_method(mrb, blkio, "throttle_write_iops_device=", mrb_cgroup_set_blkio_throttle_write_iops_device,
-                      MRB_ARGS_ANY());
     mrb_define_method(mrb, blkio, "throttle_write_iops_device", mrb_cgroup_get_blkio_throttle_write_iops_device,
                       MRB_ARGS_NONE());
     DONE;
 
     memory = mrb_define_class_under(mrb, cgroup, "MEMORY", mrb->object_class);
+    MRB_SET_INSTANCE_TT(memory, MRB_TT_DATA);
     mrb_include_module(mrb, memory, mrb_module_get(mrb, "Cgroup"));
     mrb_define_method(mrb, memory, "initialize", mrb_cgroup_memory_init, MRB_ARGS_ANY());
     mrb_define_method(mrb, memory, "limit_in_bytes=", mrb_cgroup_set_memory_limit_in_bytes, MRB_ARGS_ANY());
@@ -627,15 +2122,58 @@ void mrb_mruby_cgroup_gem_init(mrb_state *mrb)
     mrb_define_method(mrb, memory, "memsw_usage_in_bytes", mrb_cgroup_get_memory_memsw_usage_in_bytes, MRB_ARGS_NONE());
     mrb_define_method(mrb, memory, "memsw_max_usage_in_bytes", mrb_cgroup_get_memory_memsw_max_usage_in_bytes,
                       MRB_ARGS_NONE());
+    mrb_define_method(mrb, memory, "soft_limit_in_bytes=", mrb_cgroup_set_memory_soft_limit_in_bytes, MRB_ARGS_ANY());
+    mrb_define_method(mrb, memory, "soft_limit_in_bytes", mrb_cgroup_get_memory_soft_limit_in_bytes, MRB_ARGS_NONE());
+    mrb_define_method(mrb, memory, "swappiness=", mrb_cgroup_set_memory_swappiness, MRB_ARGS_ANY());
+    mrb_define_method(mrb, memory, "swappiness", mrb_cgroup_get_memory_swappiness, MRB_ARGS_NONE());
+    mrb_define_method(mrb, memory, "move_charge_at_immigrate=", mrb_cgroup_set_memory_move_charge_at_immigrate,
+                      MRB_ARGS_ANY());
+    mrb_define_method(mrb, memory, "move_charge_at_immigrate", mrb_cgroup_get_memory_move_charge_at_immigrate,
+                      MRB_ARGS_NONE());
+    mrb_define_method(mrb, memory, "high=", mrb_cgroup_set_memory_high, MRB_ARGS_ANY());
+    mrb_define_method(mrb, memory, "high", mrb_cgroup_get_memory_high, MRB_ARGS_NONE());
+    mrb_define_method(mrb, memory, "low=", mrb_cgroup_set_memory_low, MRB_ARGS_ANY());
+    mrb_define_method(mrb, memory, "low", mrb_cgroup_get_memory_low, MRB_ARGS_NONE());
+    mrb_define_method(mrb, memory, "stat_hash", mrb_cgroup_get_memory_stat_hash, MRB_ARGS_OPT(1));
+    mrb_define_method(mrb, memory, "force_empty", mrb_cgroup_memory_force_empty, MRB_ARGS_NONE());
+    mrb_define_method(mrb, memory, "reclaim", mrb_cgroup_memory_reclaim, MRB_ARGS_REQ(1));
     DONE;
 
     pids = mrb_define_class_under(mrb, cgroup, "PIDS", mrb->object_class);
+    MRB_SET_INSTANCE_TT(pids, MRB_TT_DATA);
     mrb_include_module(mrb, pids, mrb_module_get(mrb, "Cgroup"));
     mrb_define_method(mrb, pids, "initialize", mrb_cgroup_pids_init, MRB_ARGS_ANY());
     mrb_define_method(mrb, pids, "max=", mrb_cgroup_set_pids_max, MRB_ARGS_REQ(1));
     mrb_define_method(mrb, pids, "max", mrb_cgroup_get_pids_max, MRB_ARGS_NONE());
     mrb_define_method(mrb, pids, "current", mrb_cgroup_get_pids_current, MRB_ARGS_NONE());
     DONE;
+
+    freezer = mrb_define_class_under(mrb, cgroup, "FREEZER", mrb->object_class);
+    MRB_SET_INSTANCE_TT(freezer, MRB_TT_DATA);
+    mrb_include_module(mrb, freezer, mrb_module_get(mrb, "Cgroup"));
+    mrb_define_method(mrb, freezer, "initialize", mrb_cgroup_freezer_init, MRB_ARGS_ANY());
+    mrb_cgroup_freezer_methods_init(mrb, freezer);
+    DONE;
+
+    hugetlb = mrb_define_class_under(mrb, cgroup, "HUGETLB", mrb->object_class);
+    MRB_SET_INSTANCE_TT(hugetlb, MRB_TT_DATA);
+    mrb_include_module(mrb, hugetlb, mrb_module_get(mrb, "Cgroup"));
+    mrb_define_method(mrb, hugetlb, "initialize", mrb_cgroup_hugetlb_init, MRB_ARGS_ANY());
+    mrb_cgroup_hugetlb_methods_init(mrb, hugetlb);
+    DONE;
+
+    mrb_cgroup_event_init(mrb, cgroup);
+    mrb_cgroup_sampler_init(mrb, cgroup);
+    mrb_cgroup_history_init(mrb, cgroup);
+    mrb_cgroup_autoscaler_init(mrb, cgroup);
+    mrb_cgroup_walk_init(mrb, cgroup);
+    mrb_cgroup_spawn_init(mrb, cgroup);
+    mrb_cgroup_pool_init(mrb, cgroup);
+    mrb_cgroup_measure_init(mrb, cgroup);
+    mrb_cgroup_metrics_init(mrb, cgroup);
+    mrb_cgroup_registry_init(mrb, cgroup);
+    mrb_cgroup_reaper_init(mrb, cgroup);
+    mrb_cgroup_keys_init(mrb, cgroup);
 }
 
 void mrb_mruby_cgroup_gem_final(mrb_state *mrb)
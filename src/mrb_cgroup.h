@@ -1,12 +1,197 @@
 /*
-// mrb_cgroups.h - to provide cgroups methods
+// mrb_cgroup.h - to provide cgroups methods
 //
-// See Copyright Notice in mrb_cgroups.c
+// See Copyright Notice in mrb_cgroup.c
 */
 
 #ifndef MRB_CGROUPS_H
 #define MRB_CGROUPS_H
 
-void mrb_mruby_cgroups_gem_init(mrb_state *mrb);
+#include <libcgroup.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define LIVE_FDS_SIZE 16
+#define LIVE_BUF_SIZE 8192
+#define DIRTY_KEYS_SIZE 16
+
+typedef enum {
+    MRB_CGROUP_cpu,
+    MRB_CGROUP_cpuset,
+    MRB_CGROUP_cpuacct,
+    MRB_CGROUP_blkio,
+    MRB_CGROUP_memory,
+    MRB_CGROUP_pids,
+    MRB_CGROUP_freezer,
+    MRB_CGROUP_hugetlb
+} group_type_t;
+
+typedef struct cgroup cgroup_t;
+typedef struct cgroup_controller cgroup_controller_t;
+// a group directory of the process wide registry, see mrb_cgroup_registry.c
+typedef struct mrb_cgroup_entry mrb_cgroup_entry;
+typedef struct mrb_cgroup_mounts mrb_cgroup_mounts;
+typedef struct {
+    int already_exist;
+    // controller values are read by cgroup_get_cgroup on the first getter call
+    int loaded;
+    mrb_value group_name;
+    group_type_t type;
+    // v2: the group lives in the unified hierarchy, cgc only stages values set by setters
+    int v2;
+    // v2 or Cgroup.root set: control files are read and written directly, libcgroup is not used
+    int direct;
+    // the mount table (and Cgroup.root) the object was created with, paths are built from it
+    const mrb_cgroup_mounts *mounts;
+    cgroup_t *cg;
+    cgroup_controller_t *cgc;
+    // live mode: getters pread the control file through a cached fd
+    // instead of the values loaded by cgroup_get_cgroup
+    int live;
+    // handle on the registry, taken by the first live read or attach; the fds are shared with every
+    // context of the process on the same directory
+    mrb_cgroup_entry *entry;
+    // keys set since the last apply, only these are written by apply/modify
+    int ndirty;
+    const char *dirty[DIRTY_KEYS_SIZE];
+    // duration of the last attach_many/attach_threads
+    mrb_int attach_usec;
+} mrb_cgroup_context;
+
+void mrb_mruby_cgroup_gem_init(mrb_state *mrb);
+void mrb_cgroup_event_init(mrb_state *mrb, struct RClass *cgroup);
+void mrb_cgroup_sampler_init(mrb_state *mrb, struct RClass *cgroup);
+void mrb_cgroup_history_init(mrb_state *mrb, struct RClass *cgroup);
+void mrb_cgroup_autoscaler_init(mrb_state *mrb, struct RClass *cgroup);
+void mrb_cgroup_walk_init(mrb_state *mrb, struct RClass *cgroup);
+void mrb_cgroup_spawn_init(mrb_state *mrb, struct RClass *cgroup);
+void mrb_cgroup_pool_init(mrb_state *mrb, struct RClass *cgroup);
+void mrb_cgroup_measure_init(mrb_state *mrb, struct RClass *cgroup);
+void mrb_cgroup_metrics_init(mrb_state *mrb, struct RClass *cgroup);
+void mrb_cgroup_registry_init(mrb_state *mrb, struct RClass *cgroup);
+void mrb_cgroup_reaper_init(mrb_state *mrb, struct RClass *cgroup);
+void mrb_cgroup_keys_init(mrb_state *mrb, struct RClass *cgroup);
+void mrb_cgroup_blkio_methods_init(mrb_state *mrb, struct RClass *blkio);
+void mrb_cgroup_cpuset_methods_init(mrb_state *mrb, struct RClass *cpuset);
+void mrb_cgroup_freezer_methods_init(mrb_state *mrb, struct RClass *freezer);
+void mrb_cgroup_hugetlb_methods_init(mrb_state *mrb, struct RClass *hugetlb);
+
+// maps a v1 key onto a file of the unified hierarchy
+typedef struct mrb_cgroup_v2_key mrb_cgroup_v2_key;
+
+// shared by the classes defined outside of mrb_cgroup.c
+mrb_cgroup_context *mrb_cgroup_get_context(mrb_state *mrb, mrb_value self);
+// builds "<mount point>/<group>[/<key>]", returns -1 with errno set when the controller is not mounted
+int mrb_cgroup_path(mrb_state *mrb, mrb_cgroup_context *ctx, const char *key, char *path, size_t size);
+// writes val into the control file of the group as is, one write per line, returns -1 with errno set
+int mrb_cgroup_write_file(mrb_state *mrb, mrb_cgroup_context *ctx, const char *file, const char *val);
+// reads the raw text of key (a v1 key, a string literal) through the live fd or from the loaded controller,
+// returns -1 when it does not exist
+ssize_t mrb_cgroup_read_raw(mrb_state *mrb, mrb_cgroup_context *ctx, const char *key, char *buf, size_t size);
+// "name value" lines into hash as {:name => value}, and space separated integers into ary (truncated to them)
+mrb_value mrb_cgroup_parse_kv(mrb_state *mrb, const char *buf, mrb_value hash);
+mrb_value mrb_cgroup_parse_list(mrb_state *mrb, const char *buf, mrb_value ary);
+// key (a string literal or the name of a symbol) is written by the next apply/modify
+void mrb_cgroup_mark_dirty(mrb_state *mrb, mrb_cgroup_context *ctx, const char *key);
+
+// path of the control file serving key of group on any backend, *conv is set when the value needs
+// mrb_cgroup_v2_to_v1, returns -1 with errno set when the controller of key is not mounted
+int mrb_cgroup_key_path(mrb_state *mrb, const char *group, const char *key, char *path, size_t size,
+                        const mrb_cgroup_v2_key **conv);
+// directory of group in the hierarchy of controller ("cpu", "memory", ...; the unified hierarchy on v2),
+// returns -1 with errno set when the controller is not mounted
+int mrb_cgroup_controller_path(mrb_state *mrb, const char *controller, const char *group, char *path, size_t size);
+// name of the unified hierarchy controller serving a v1 controller, "" for freezer (no controller to enable),
+// NULL when unknown
+const char *mrb_cgroup_v2_controller(const char *controller);
+// writes the v1 value val of key (a v1 key) into group at once, converted on v2; returns -1 with errno set
+int mrb_cgroup_write_key(mrb_state *mrb, const char *group, const char *key, const char *val);
+// non-zero on the unified hierarchy
+int mrb_cgroup_unified(mrb_state *mrb);
+// non-zero when the root is a plain directory tree, see Cgroup.root
+int mrb_cgroup_fake(mrb_state *mrb);
+
+// directory helpers that do not touch the mrb_state, for background threads: mkdir (EEXIST is not an error,
+// a fake root gets the control files of the parent), rmdir (a fake root has its files unlinked first) and
+// enabling controllers ("+cpu +memory") in cgroup.subtree_control of dir
+int mrb_cgroup_mkdir_one(const char *path, int fake);
+// mkdir_one failing with EEXIST, for a directory that must be new
+int mrb_cgroup_mkdir_excl(const char *path, int fake);
+int mrb_cgroup_rmdir_one(const char *path, int fake);
+void mrb_cgroup_v2_enable(const char *dir, const char *ctrl);
+// mkdir -p of dir below its first top bytes (an existing root), ctrl non-NULL is enabled in the root, every
+// directory made and dir itself
+int mrb_cgroup_mkdir_tree(const char *dir, size_t top, const char *ctrl, int fake);
+// rewrites the v2 text read into buf as the v1 key of conv reads it, returns the new length
+ssize_t mrb_cgroup_v2_to_v1(const mrb_cgroup_v2_key *conv, char *buf, size_t size);
+// finds "name value" in a flat keyed file such as cpu.stat, returns -1 when name is missing
+int mrb_cgroup_kv_get(const char *buf, const char *name, int64_t *val);
+
+// a Cgroup::Event on fd (POLLIN for an eventfd, POLLPRI for kernfs files), closed with the object
+mrb_value mrb_cgroup_event_new(mrb_state *mrb, int fd, int cfd, short events, mrb_value block);
+
+// a mount table of the process: the host one, or the one of a Cgroup.root directory
+struct mrb_cgroup_mounts {
+    struct mrb_cgroup_mounts *next;
+    // NULL for the host
+    char *root;
+    // code of cgroup_init() on a v1 host, 0 otherwise
+    int init_code;
+    // cgroup2 only, libcgroup is not used at all
+    int unified;
+    // the root is a plain directory tree (tmpfs) mimicking cgroupfs, see mrb_cgroup_mkdir
+    int fake;
+    // per group_type_t, NULL when the controller is not mounted
+    char *points[MRB_CGROUP_hugetlb + 1];
+};
+
+// process wide and thread safe: the mount table of root (NULL: the host) built by fill once, again with
+// reload or after a failed cgroup_init(), fill runs under the lock that serializes cgroup_init(); a table is
+// never freed, one replaced by a reload stays valid for its holders; group directories held by reference with
+// their control file fds opened once (write for tasks and cgroup.procs), -1 with errno set, ENOSPC when the
+// entry has no free slot; an entry is evicted once its directory is removed, its holders see it stale and
+// acquire a new one
+const mrb_cgroup_mounts *mrb_cgroup_shared_init(const char *root, int reload, void (*fill)(mrb_cgroup_mounts *m));
+// bumped each time a table is built, a holder of an older one looks its root up again
+extern unsigned mrb_cgroup_mounts_gen;
+mrb_cgroup_entry *mrb_cgroup_entry_acquire(const char *dir);
+void mrb_cgroup_entry_release(mrb_cgroup_entry *e);
+int mrb_cgroup_entry_fd(mrb_cgroup_entry *e, const char *file, int write);
+void mrb_cgroup_entry_evict(mrb_cgroup_entry *e);
+int mrb_cgroup_entry_stale(mrb_cgroup_entry *e);
+void mrb_cgroup_registry_evict(const char *dir);
+// directories Cgroup::Reaper must not remove: held (with the subtree) until unhold, -1 with errno set; held
+// returns non-zero for those and for a directory with an entry, a group some context of the process holds
+int mrb_cgroup_registry_hold(const char *dir);
+void mrb_cgroup_registry_unhold(const char *dir);
+int mrb_cgroup_registry_held(const char *path);
+// non-zero when path is dir or below it
+int mrb_cgroup_path_under(const char *path, const char *dir);
+
+// operation types counted by Cgroup.metrics
+typedef enum {
+    MRB_CGROUP_OP_INIT,
+    MRB_CGROUP_OP_GET,
+    MRB_CGROUP_OP_SET,
+    MRB_CGROUP_OP_CREATE,
+    MRB_CGROUP_OP_DELETE,
+    MRB_CGROUP_OP_ATTACH,
+    MRB_CGROUP_OP_SIZE
+} mrb_cgroup_op_t;
+
+// calls body(mrb, self) timed as op; an exception is counted as an error of op and raised again
+mrb_value mrb_cgroup_metrics_run(mrb_state *mrb, mrb_cgroup_op_t op, mrb_func_t body, mrb_value self);
+// counts the innermost operation running on this thread as an error once it returns
+void mrb_cgroup_metrics_fail(void);
+// syscalls made by the gem on this thread, the calls inside libcgroup are not seen
+extern __thread unsigned mrb_cgroup_syscalls;
+#define MRB_CGROUP_SYSCALL(n) (mrb_cgroup_syscalls += (n))
+
+// defines the method fn timing fn##_body as op
+#define MRB_CGROUP_TIMED(op, fn)                                                                                       \
+    static mrb_value fn(mrb_state *mrb, mrb_value self)                                                                \
+    {                                                                                                                  \
+        return mrb_cgroup_metrics_run(mrb, op, fn##_body, self);                                                       \
+    }
 
 #endif
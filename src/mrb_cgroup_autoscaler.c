@@ -0,0 +1,444 @@
+/*
+** mrb_cgroup_autoscaler - CFS quota controller on a background thread for mruby-cgroup
+**
+** See Copyright Notice in mrb_cgroup.c
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mruby.h"
+#include "mruby/array.h"
+#include "mruby/class.h"
+#include "mruby/data.h"
+#include "mruby/hash.h"
+#include "mruby/string.h"
+#include "mruby/variable.h"
+
+#include "mrb_cgroup.h"
+
+#define DONE mrb_gc_arena_restore(mrb, 0);
+#define AUTOSCALER_BUF_SIZE 1024
+// quota grows by half of itself when the group is throttled over target, and shrinks by a tenth when it
+// stayed under half of its quota without throttling
+#define AUTOSCALER_GROW 1.5
+#define AUTOSCALER_SHRINK 0.9
+
+typedef struct {
+    char *group;
+    // cpu.stat, cpuacct.usage (cpu.stat on v2) and cpu.cfs_quota_us (cpu.max on v2)
+    int stat_fd, usage_fd, quota_fd;
+    const mrb_cgroup_v2_key *usage_conv;
+    int v2;
+    int64_t period, min, max;
+    double target;
+
+    // written by the thread, read under the lock
+    int64_t quota;
+    int64_t last_periods, last_throttled, last_usage, last_ts;
+    double throttle_ratio;
+    double usage;
+    int64_t adjustments;
+    int64_t changed_at;
+    int error;
+} mrb_cgroup_autoscaler_group;
+
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int running;
+    int stop;
+    int64_t interval_ns;
+    int ngroups, capa;
+    mrb_cgroup_autoscaler_group *groups;
+} mrb_cgroup_autoscaler;
+
+static int64_t autoscaler_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static ssize_t autoscaler_read(int fd, const mrb_cgroup_v2_key *conv, char *buf, size_t size)
+{
+    ssize_t len;
+
+    if (fd < 0 || (len = pread(fd, buf, size - 1, 0)) < 0) {
+        return -1;
+    }
+    while (len > 0 && (buf[len - 1] == '\n' || buf[len - 1] == ' ')) {
+        len--;
+    }
+    buf[len] = '\0';
+
+    return conv ? mrb_cgroup_v2_to_v1(conv, buf, size) : len;
+}
+
+static int autoscaler_write_quota(mrb_cgroup_autoscaler_group *g, int64_t quota)
+{
+    char buf[64];
+    int len;
+
+    if (g->v2) {
+        len = snprintf(buf, sizeof(buf), "%lld %lld", (long long)quota, (long long)g->period);
+    } else {
+        len = snprintf(buf, sizeof(buf), "%lld", (long long)quota);
+    }
+
+    return (pwrite(g->quota_fd, buf, len, 0) == len) ? 0 : -1;
+}
+
+// one control step of g, called with the lock held
+static void autoscaler_step(mrb_cgroup_autoscaler_group *g)
+{
+    char buf[AUTOSCALER_BUF_SIZE];
+    int64_t periods, throttled, usage = -1, now = autoscaler_now(), quota = g->quota;
+
+    if (autoscaler_read(g->stat_fd, NULL, buf, sizeof(buf)) < 0 ||
+        mrb_cgroup_kv_get(buf, "nr_periods", &periods) < 0 || mrb_cgroup_kv_get(buf, "nr_throttled", &throttled) < 0) {
+        g->error = errno ? errno : EINVAL;
+        return;
+    }
+    if (autoscaler_read(g->usage_fd, g->usage_conv, buf, sizeof(buf)) > 0) {
+        usage = strtoll(buf, NULL, 10);
+    }
+
+    if (g->last_ts && periods > g->last_periods) {
+        g->throttle_ratio = (double)(throttled - g->last_throttled) / (double)(periods - g->last_periods);
+        if (usage >= 0 && g->last_usage >= 0 && now > g->last_ts) {
+            // in cpus, comparable to quota / period
+            g->usage = (double)(usage - g->last_usage) / (double)(now - g->last_ts);
+        }
+        if (g->throttle_ratio > g->target) {
+            quota = (int64_t)(g->quota * AUTOSCALER_GROW);
+        } else if (g->throttle_ratio == 0 && g->usage * g->period < g->quota * 0.5) {
+            quota = (int64_t)(g->quota * AUTOSCALER_SHRINK);
+        }
+        quota = (quota < g->min) ? g->min : (quota > g->max) ? g->max : quota;
+    }
+    g->last_periods = periods;
+    g->last_throttled = throttled;
+    g->last_usage = usage;
+    g->last_ts = now;
+
+    if (quota != g->quota) {
+        if (autoscaler_write_quota(g, quota) < 0) {
+            g->error = errno;
+            return;
+        }
+        g->quota = quota;
+        g->adjustments++;
+        g->changed_at = now;
+    }
+    g->error = 0;
+}
+
+static void *autoscaler_main(void *arg)
+{
+    mrb_cgroup_autoscaler *as = arg;
+    struct timespec deadline;
+    int64_t next = autoscaler_now();
+    int i;
+
+    pthread_mutex_lock(&as->lock);
+    while (!as->stop) {
+        for (i = 0; i < as->ngroups; i++) {
+            autoscaler_step(&as->groups[i]);
+        }
+        next += as->interval_ns;
+        deadline.tv_sec = next / 1000000000;
+        deadline.tv_nsec = next % 1000000000;
+        while (!as->stop && pthread_cond_timedwait(&as->wake, &as->lock, &deadline) != ETIMEDOUT) {
+        }
+    }
+    pthread_mutex_unlock(&as->lock);
+
+    return NULL;
+}
+
+static void autoscaler_stop(mrb_cgroup_autoscaler *as)
+{
+    if (!as->running) {
+        return;
+    }
+    pthread_mutex_lock(&as->lock);
+    as->stop = 1;
+    pthread_cond_signal(&as->wake);
+    pthread_mutex_unlock(&as->lock);
+    pthread_join(as->thread, NULL);
+    as->running = 0;
+}
+
+static void autoscaler_group_close(mrb_cgroup_autoscaler_group *g)
+{
+    if (g->stat_fd >= 0) {
+        close(g->stat_fd);
+    }
+    if (g->usage_fd >= 0) {
+        close(g->usage_fd);
+    }
+    if (g->quota_fd >= 0) {
+        close(g->quota_fd);
+    }
+    free(g->group);
+}
+
+static void mrb_cgroup_autoscaler_free(mrb_state *mrb, void *p)
+{
+    mrb_cgroup_autoscaler *as = p;
+    int i;
+
+    autoscaler_stop(as);
+    for (i = 0; i < as->ngroups; i++) {
+        autoscaler_group_close(&as->groups[i]);
+    }
+    free(as->groups);
+    pthread_mutex_destroy(&as->lock);
+    pthread_cond_destroy(&as->wake);
+    mrb_free(mrb, as);
+}
+
+static const struct mrb_data_type mrb_cgroup_autoscaler_type = {
+    "mrb_cgroup_autoscaler", mrb_cgroup_autoscaler_free,
+};
+
+static mrb_cgroup_autoscaler *mrb_cgroup_get_autoscaler(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_autoscaler *as = (mrb_cgroup_autoscaler *)mrb_data_get_ptr(mrb, self, &mrb_cgroup_autoscaler_type);
+
+    if (!as)
+        mrb_raise(mrb, E_RUNTIME_ERROR, "get mrb_cgroup_autoscaler failed");
+
+    return as;
+}
+
+// Cgroup::Autoscaler.new(interval_ms = 100), one CFS period by default
+static mrb_value mrb_cgroup_autoscaler_initialize(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_autoscaler *as = (mrb_cgroup_autoscaler *)DATA_PTR(self);
+    pthread_condattr_t attr;
+    mrb_int interval = 100;
+    mrb_get_args(mrb, "|i", &interval);
+
+    if (interval < 1) {
+        mrb_raise(mrb, E_ARGUMENT_ERROR, "interval must be positive");
+    }
+    if (as) {
+        mrb_cgroup_autoscaler_free(mrb, as);
+    }
+    DATA_TYPE(self) = &mrb_cgroup_autoscaler_type;
+    DATA_PTR(self) = NULL;
+
+    as = (mrb_cgroup_autoscaler *)mrb_calloc(mrb, 1, sizeof(mrb_cgroup_autoscaler));
+    pthread_mutex_init(&as->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&as->wake, &attr);
+    pthread_condattr_destroy(&attr);
+    as->interval_ns = (int64_t)interval * 1000000;
+    DATA_PTR(self) = as;
+
+    return self;
+}
+
+static int autoscaler_open(mrb_state *mrb, const char *group, const char *key, int flags,
+                           const mrb_cgroup_v2_key **conv)
+{
+    char path[FILENAME_MAX];
+    const mrb_cgroup_v2_key *c;
+
+    if (mrb_cgroup_key_path(mrb, group, key, path, sizeof(path), conv ? conv : &c) < 0) {
+        return -1;
+    }
+    return open(path, flags | O_CLOEXEC);
+}
+
+// add(group, min_quota_us, max_quota_us, target_throttle_ratio = 0.05) => index into decisions
+static mrb_value mrb_cgroup_autoscaler_add(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_autoscaler *as = mrb_cgroup_get_autoscaler(mrb, self);
+    mrb_cgroup_autoscaler_group g, *groups;
+    const mrb_cgroup_v2_key *conv;
+    char buf[AUTOSCALER_BUF_SIZE];
+    char *group;
+    mrb_int min, max;
+    mrb_float target = 0.05;
+    int index, fd, err;
+    mrb_get_args(mrb, "zii|f", &group, &min, &max, &target);
+
+    if (min < 1000 || max < min || target < 0 || target >= 1) {
+        mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid quota range or target");
+    }
+
+    memset(&g, 0, sizeof(g));
+    g.v2 = mrb_cgroup_key_path(mrb, group, "cpu.cfs_quota_us", buf, sizeof(buf), &conv) == 0 && conv != NULL;
+    g.stat_fd = autoscaler_open(mrb, group, "cpu.stat", O_RDONLY, NULL);
+    g.usage_fd = autoscaler_open(mrb, group, "cpuacct.usage", O_RDONLY, &g.usage_conv);
+    g.quota_fd = autoscaler_open(mrb, group, "cpu.cfs_quota_us", O_RDWR, &conv);
+    g.period = 100000;
+    if (g.stat_fd < 0 || g.quota_fd < 0) {
+        err = errno;
+        autoscaler_group_close(&g);
+        errno = err;
+        mrb_sys_fail(mrb, group);
+    }
+
+    // the current quota is the starting point, unlimited starts at max
+    g.quota = max;
+    if (autoscaler_read(g.quota_fd, conv, buf, sizeof(buf)) > 0 && strtoll(buf, NULL, 10) > 0) {
+        g.quota = strtoll(buf, NULL, 10);
+    }
+    if (g.v2 && autoscaler_read(g.quota_fd, NULL, buf, sizeof(buf)) > 0 && strchr(buf, ' ')) {
+        g.period = strtoll(strchr(buf, ' ') + 1, NULL, 10);
+    } else if (!g.v2) {
+        fd = autoscaler_open(mrb, group, "cpu.cfs_period_us", O_RDONLY, NULL);
+        if (autoscaler_read(fd, NULL, buf, sizeof(buf)) > 0) {
+            g.period = strtoll(buf, NULL, 10);
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    g.quota = (g.quota < min) ? min : (g.quota > max) ? max : g.quota;
+    // the steps start from g.quota, so it has to be the quota the kernel enforces
+    if (autoscaler_write_quota(&g, g.quota) < 0) {
+        err = errno;
+        autoscaler_group_close(&g);
+        errno = err;
+        mrb_sys_fail(mrb, group);
+    }
+    g.min = min;
+    g.max = max;
+    g.target = target;
+    g.last_usage = -1;
+    g.group = strdup(group);
+
+    pthread_mutex_lock(&as->lock);
+    if (as->ngroups == as->capa) {
+        groups = (mrb_cgroup_autoscaler_group *)realloc(as->groups, (as->capa * 2 + 4) * sizeof(g));
+        if (groups == NULL) {
+            pthread_mutex_unlock(&as->lock);
+            autoscaler_group_close(&g);
+            mrb_sys_fail(mrb, "realloc");
+        }
+        as->groups = groups;
+        as->capa = as->capa * 2 + 4;
+    }
+    index = as->ngroups;
+    as->groups[as->ngroups++] = g;
+    pthread_mutex_unlock(&as->lock);
+
+    return mrb_fixnum_value(index);
+}
+
+static mrb_value mrb_cgroup_autoscaler_start(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_autoscaler *as = mrb_cgroup_get_autoscaler(mrb, self);
+
+    if (as->running) {
+        return self;
+    }
+    as->stop = 0;
+    if (pthread_create(&as->thread, NULL, autoscaler_main, as)) {
+        mrb_raise(mrb, E_RUNTIME_ERROR, "pthread_create failed");
+    }
+    as->running = 1;
+
+    return self;
+}
+
+static mrb_value mrb_cgroup_autoscaler_stop(mrb_state *mrb, mrb_value self)
+{
+    autoscaler_stop(mrb_cgroup_get_autoscaler(mrb, self));
+    return self;
+}
+
+static mrb_value mrb_cgroup_autoscaler_running_p(mrb_state *mrb, mrb_value self)
+{
+    return mrb_bool_value(mrb_cgroup_get_autoscaler(mrb, self)->running);
+}
+
+// one control step of every group on the calling thread, for use without start
+static mrb_value mrb_cgroup_autoscaler_step(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_autoscaler *as = mrb_cgroup_get_autoscaler(mrb, self);
+    int i;
+
+    pthread_mutex_lock(&as->lock);
+    for (i = 0; i < as->ngroups; i++) {
+        autoscaler_step(&as->groups[i]);
+    }
+    pthread_mutex_unlock(&as->lock);
+
+    return self;
+}
+
+#define AUTOSCALER_SET(name, val) mrb_hash_set(mrb, h, mrb_symbol_value(mrb_intern_lit(mrb, name)), val)
+
+// [{:group=>"/web", :quota=>50000, :period=>100000, :throttle_ratio=>0.0, :usage=>0.3, :adjustments=>3,
+//   :changed_at=>nsec, :error=>nil}, ...], a snapshot taken under the lock
+static mrb_value mrb_cgroup_autoscaler_decisions(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_autoscaler *as = mrb_cgroup_get_autoscaler(mrb, self);
+    mrb_cgroup_autoscaler_group *snap, *g;
+    mrb_value result, h;
+    int i, n, ai;
+
+    pthread_mutex_lock(&as->lock);
+    n = as->ngroups;
+    snap = (mrb_cgroup_autoscaler_group *)malloc((n ? n : 1) * sizeof(*snap));
+    if (snap) {
+        memcpy(snap, as->groups, n * sizeof(*snap));
+    }
+    pthread_mutex_unlock(&as->lock);
+    if (snap == NULL) {
+        mrb_sys_fail(mrb, "malloc");
+    }
+
+    result = mrb_ary_new_capa(mrb, n);
+    ai = mrb_gc_arena_save(mrb);
+    for (i = 0; i < n; i++) {
+        g = &snap[i];
+        h = mrb_hash_new(mrb);
+        // the group string is only freed with the autoscaler, which self keeps alive
+        AUTOSCALER_SET("group", mrb_str_new_cstr(mrb, g->group));
+        AUTOSCALER_SET("quota", mrb_fixnum_value(g->quota));
+        AUTOSCALER_SET("period", mrb_fixnum_value(g->period));
+        AUTOSCALER_SET("throttle_ratio", mrb_float_value(mrb, g->throttle_ratio));
+        AUTOSCALER_SET("usage", mrb_float_value(mrb, g->usage));
+        AUTOSCALER_SET("adjustments", mrb_fixnum_value(g->adjustments));
+        AUTOSCALER_SET("changed_at", mrb_fixnum_value(g->changed_at));
+        AUTOSCALER_SET("error", g->error ? mrb_str_new_cstr(mrb, strerror(g->error)) : mrb_nil_value());
+        mrb_ary_push(mrb, result, h);
+        mrb_gc_arena_restore(mrb, ai);
+    }
+    free(snap);
+
+    return result;
+}
+
+void mrb_cgroup_autoscaler_init(mrb_state *mrb, struct RClass *cgroup)
+{
+    struct RClass *autoscaler;
+
+    autoscaler = mrb_define_class_under(mrb, cgroup, "Autoscaler", mrb->object_class);
+    MRB_SET_INSTANCE_TT(autoscaler, MRB_TT_DATA);
+    mrb_define_method(mrb, autoscaler, "initialize", mrb_cgroup_autoscaler_initialize, MRB_ARGS_OPT(1));
+    mrb_define_method(mrb, autoscaler, "add", mrb_cgroup_autoscaler_add, MRB_ARGS_ARG(3, 1));
+    mrb_define_method(mrb, autoscaler, "start", mrb_cgroup_autoscaler_start, MRB_ARGS_NONE());
+    mrb_define_method(mrb, autoscaler, "stop", mrb_cgroup_autoscaler_stop, MRB_ARGS_NONE());
+    mrb_define_method(mrb, autoscaler, "running?", mrb_cgroup_autoscaler_running_p, MRB_ARGS_NONE());
+    mrb_define_method(mrb, autoscaler, "step", mrb_cgroup_autoscaler_step, MRB_ARGS_NONE());
+    mrb_define_method(mrb, autoscaler, "decisions", mrb_cgroup_autoscaler_decisions, MRB_ARGS_NONE());
+    DONE;
+}
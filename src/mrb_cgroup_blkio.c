@@ -0,0 +1,250 @@
+/*
+** mrb_cgroup_blkio - per device throttling and I/O statistics for mruby-cgroup
+**
+** See Copyright Notice in mrb_cgroup.c
+*/
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include "mruby.h"
+#include "mruby/array.h"
+#include "mruby/class.h"
+#include "mruby/data.h"
+#include "mruby/hash.h"
+#include "mruby/string.h"
+#include "mruby/variable.h"
+
+#include "mrb_cgroup.h"
+
+#define DONE mrb_gc_arena_restore(mrb, 0);
+#define BLKIO_DEVICE_SIZE 32
+
+// "major:minor" of dev, either given as is or resolved from a /dev path; resolutions are cached in
+// Cgroup::BLKIO so a path is stat'ed once per mrb_state
+static mrb_value mrb_cgroup_blkio_device(mrb_state *mrb, mrb_value dev)
+{
+    struct RClass *blkio = mrb_class_get_under(mrb, mrb_module_get(mrb, "Cgroup"), "BLKIO");
+    mrb_value cache = mrb_iv_get(mrb, mrb_obj_value(blkio), mrb_intern_lit(mrb, "device_cache"));
+    mrb_value found;
+    char buf[BLKIO_DEVICE_SIZE];
+    unsigned int major, minor;
+    struct stat st;
+    char c;
+
+    dev = mrb_str_to_str(mrb, dev);
+    if (sscanf(RSTRING_PTR(dev), "%u:%u%c", &major, &minor, &c) == 2) {
+        return dev;
+    }
+    if (mrb_nil_p(cache)) {
+        cache = mrb_hash_new(mrb);
+        mrb_iv_set(mrb, mrb_obj_value(blkio), mrb_intern_lit(mrb, "device_cache"), cache);
+    }
+    found = mrb_hash_get(mrb, cache, dev);
+    if (!mrb_nil_p(found)) {
+        return found;
+    }
+
+    if (stat(RSTRING_PTR(dev), &st) < 0) {
+        mrb_sys_fail(mrb, RSTRING_PTR(dev));
+    }
+    if (!S_ISBLK(st.st_mode)) {
+        mrb_raisef(mrb, E_ARGUMENT_ERROR, "not a block device: %S", dev);
+    }
+    snprintf(buf, sizeof(buf), "%u:%u", major(st.st_rdev), minor(st.st_rdev));
+    found = mrb_str_new_cstr(mrb, buf);
+    mrb_hash_set(mrb, cache, dev, found);
+
+    return found;
+}
+
+// stages "major:minor limit" lines for key, a Hash sets every device of it with one apply
+static mrb_value mrb_cgroup_blkio_set(mrb_state *mrb, mrb_value self, const char *key)
+{
+    mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self);
+    mrb_value val, keys, dev, limit, lines;
+    char buf[BLKIO_DEVICE_SIZE];
+    mrb_int i;
+    int code;
+    mrb_get_args(mrb, "o", &val);
+
+    if (mrb_hash_p(val)) {
+        keys = mrb_hash_keys(mrb, val);
+        lines = mrb_str_buf_new(mrb, RARRAY_LEN(keys) * BLKIO_DEVICE_SIZE);
+        for (i = 0; i < RARRAY_LEN(keys); i++) {
+            dev = mrb_cgroup_blkio_device(mrb, mrb_ary_ref(mrb, keys, i));
+            limit = mrb_hash_get(mrb, val, mrb_ary_ref(mrb, keys, i));
+            // nil or 0 removes the limit of the device
+            if (!mrb_nil_p(limit)) {
+                limit = mrb_to_int(mrb, limit);
+            }
+            snprintf(buf, sizeof(buf), " %lld\n", mrb_nil_p(limit) ? 0LL : (long long)mrb_fixnum(limit));
+            mrb_str_cat(mrb, lines, RSTRING_PTR(dev), RSTRING_LEN(dev));
+            mrb_str_cat_cstr(mrb, lines, buf);
+        }
+        val = lines;
+    }
+    if ((code = cgroup_set_value_string(mrb_cg_cxt->cgc, key, mrb_string_value_cstr(mrb, &val)))) {
+        mrb_raisef(mrb, E_RUNTIME_ERROR, "cgroup_set_value_string %S failed: %S(%S)", mrb_str_new_cstr(mrb, key),
+                   mrb_str_new_cstr(mrb, cgroup_strerror(code)), mrb_fixnum_value(code));
+    }
+    mrb_cgroup_mark_dirty(mrb, mrb_cg_cxt, key);
+
+    return self;
+}
+
+#define SET_BLKIO_THROTTLE(key)                                                                                        \
+    static mrb_value mrb_cgroup_set_blkio_throttle_##key##_body(mrb_state *mrb, mrb_value self)                        \
+    {                                                                                                                  \
+        return mrb_cgroup_blkio_set(mrb, self, "blkio.throttle." #key);                                                \
+    }                                                                                                                  \
+    MRB_CGROUP_TIMED(MRB_CGROUP_OP_SET, mrb_cgroup_set_blkio_throttle_##key)
+
+SET_BLKIO_THROTTLE(read_bps_device);
+SET_BLKIO_THROTTLE(write_bps_device);
+SET_BLKIO_THROTTLE(read_iops_device);
+SET_BLKIO_THROTTLE(write_iops_device);
+
+// the per device Hash of hash, created on first use and reused afterwards
+static mrb_value mrb_cgroup_blkio_entry(mrb_state *mrb, mrb_value hash, const char *dev, size_t len)
+{
+    mrb_value key = mrb_str_new(mrb, dev, len);
+    mrb_value entry = mrb_hash_get(mrb, hash, key);
+
+    if (!mrb_hash_p(entry)) {
+        entry = mrb_hash_new(mrb);
+        mrb_hash_set(mrb, hash, key, entry);
+    }
+
+    return entry;
+}
+
+// "8:0 Read 123" lines into {"8:0" => {:read => 123}}, the "Total 456" summary line is skipped
+static void mrb_cgroup_blkio_parse_ops(mrb_state *mrb, const char *buf, mrb_value hash)
+{
+    const char *p = buf, *dev, *op;
+    size_t dlen, olen, i;
+    char name[16];
+    int ai = mrb_gc_arena_save(mrb);
+
+    for (; *p; p += strcspn(p, "\n"), p += (*p == '\n')) {
+        dev = p;
+        dlen = strcspn(dev, " \n");
+        if (dev[dlen] != ' ' || !isdigit((unsigned char)dev[0])) {
+            continue;
+        }
+        op = dev + dlen + 1;
+        olen = strcspn(op, " \n");
+        if (op[olen] != ' ' || olen >= sizeof(name)) {
+            continue;
+        }
+        for (i = 0; i < olen; i++) {
+            name[i] = tolower((unsigned char)op[i]);
+        }
+        mrb_hash_set(mrb, mrb_cgroup_blkio_entry(mrb, hash, dev, dlen), mrb_symbol_value(mrb_intern(mrb, name, olen)),
+                     mrb_fixnum_value((int64_t)strtoll(op + olen + 1, NULL, 10)));
+        mrb_gc_arena_restore(mrb, ai);
+    }
+}
+
+// "8:0 123" lines into {"8:0" => {name => 123}}
+static void mrb_cgroup_blkio_parse_limits(mrb_state *mrb, const char *buf, mrb_sym name, mrb_value hash)
+{
+    const char *p = buf;
+    size_t dlen;
+    int ai = mrb_gc_arena_save(mrb);
+
+    for (; *p; p += strcspn(p, "\n"), p += (*p == '\n')) {
+        dlen = strcspn(p, " \n");
+        if (p[dlen] != ' ' || !isdigit((unsigned char)p[0])) {
+            continue;
+        }
+        mrb_hash_set(mrb, mrb_cgroup_blkio_entry(mrb, hash, p, dlen), mrb_symbol_value(name),
+                     mrb_fixnum_value((int64_t)strtoll(p + dlen + 1, NULL, 10)));
+        mrb_gc_arena_restore(mrb, ai);
+    }
+}
+
+#define GET_BLKIO_OPS_HASH(key)                                                                                        \
+    static mrb_value mrb_cgroup_get_blkio_##key##_hash_body(mrb_state *mrb, mrb_value self)                            \
+    {                                                                                                                  \
+        mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self);                                            \
+        mrb_value hash = mrb_nil_value();                                                                              \
+        char buf[LIVE_BUF_SIZE];                                                                                       \
+        mrb_get_args(mrb, "|H", &hash);                                                                                \
+                                                                                                                       \
+        if (mrb_cgroup_read_raw(mrb, mrb_cg_cxt, "blkio.throttle." #key, buf, sizeof(buf)) < 0) {                      \
+            return mrb_nil_value();                                                                                    \
+        }                                                                                                              \
+        if (mrb_nil_p(hash)) {                                                                                         \
+            hash = mrb_hash_new(mrb);                                                                                  \
+        }                                                                                                              \
+        mrb_cgroup_blkio_parse_ops(mrb, buf, hash);                                                                    \
+        return hash;                                                                                                   \
+    }                                                                                                                  \
+    MRB_CGROUP_TIMED(MRB_CGROUP_OP_GET, mrb_cgroup_get_blkio_##key##_hash)
+
+GET_BLKIO_OPS_HASH(io_service_bytes);
+GET_BLKIO_OPS_HASH(io_serviced);
+
+static const char *mrb_cgroup_blkio_limit_keys[] = {
+    "blkio.throttle.read_bps_device", "blkio.throttle.write_bps_device", "blkio.throttle.read_iops_device",
+    "blkio.throttle.write_iops_device",
+};
+
+// {"8:0" => {:read_bps_device => 1000, :write_iops_device => 100}}, devices without any limit are absent
+static mrb_value mrb_cgroup_get_blkio_throttle_hash_body(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self);
+    mrb_value hash = mrb_nil_value();
+    char buf[LIVE_BUF_SIZE];
+    const char *key;
+    size_t i;
+    mrb_get_args(mrb, "|H", &hash);
+
+    if (mrb_nil_p(hash)) {
+        hash = mrb_hash_new(mrb);
+    }
+    for (i = 0; i < sizeof(mrb_cgroup_blkio_limit_keys) / sizeof(mrb_cgroup_blkio_limit_keys[0]); i++) {
+        key = mrb_cgroup_blkio_limit_keys[i];
+        if (mrb_cgroup_read_raw(mrb, mrb_cg_cxt, key, buf, sizeof(buf)) >= 0) {
+            mrb_cgroup_blkio_parse_limits(mrb, buf, mrb_intern_cstr(mrb, key + strlen("blkio.throttle.")), hash);
+        }
+    }
+
+    return hash;
+}
+MRB_CGROUP_TIMED(MRB_CGROUP_OP_GET, mrb_cgroup_get_blkio_throttle_hash)
+
+// Cgroup::BLKIO.device("/dev/sda") => "8:0"
+static mrb_value mrb_cgroup_blkio_device_m(mrb_state *mrb, mrb_value self)
+{
+    mrb_value dev;
+    mrb_get_args(mrb, "S", &dev);
+
+    return mrb_cgroup_blkio_device(mrb, dev);
+}
+
+void mrb_cgroup_blkio_methods_init(mrb_state *mrb, struct RClass *blkio)
+{
+    mrb_define_class_method(mrb, blkio, "device", mrb_cgroup_blkio_device_m, MRB_ARGS_REQ(1));
+    mrb_define_method(mrb, blkio, "throttle_read_bps_device=", mrb_cgroup_set_blkio_throttle_read_bps_device,
+                      MRB_ARGS_REQ(1));
+    mrb_define_method(mrb, blkio, "throttle_write_bps_device=", mrb_cgroup_set_blkio_throttle_write_bps_device,
+                      MRB_ARGS_REQ(1));
+    mrb_define_method(mrb, blkio, "throttle_read_iops_device=", mrb_cgroup_set_blkio_throttle_read_iops_device,
+                      MRB_ARGS_REQ(1));
+    mrb_define_method(mrb, blkio, "throttle_write_iops_device=", mrb_cgroup_set_blkio_throttle_write_iops_device,
+                      MRB_ARGS_REQ(1));
+    mrb_define_method(mrb, blkio, "throttle_hash", mrb_cgroup_get_blkio_throttle_hash, MRB_ARGS_OPT(1));
+    mrb_define_method(mrb, blkio, "io_service_bytes_hash", mrb_cgroup_get_blkio_io_service_bytes_hash,
+                      MRB_ARGS_OPT(1));
+    mrb_define_method(mrb, blkio, "io_serviced_hash", mrb_cgroup_get_blkio_io_serviced_hash, MRB_ARGS_OPT(1));
+    DONE;
+}
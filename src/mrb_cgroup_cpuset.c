@@ -0,0 +1,790 @@
+/*
+** mrb_cgroup_cpuset - cpu/node bitmaps, topology discovery and cpuset placement for mruby-cgroup
+**
+** See Copyright Notice in mrb_cgroup.c
+*/
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mruby.h"
+#include "mruby/array.h"
+#include "mruby/class.h"
+#include "mruby/data.h"
+#include "mruby/string.h"
+#include "mruby/variable.h"
+
+#include "mrb_cgroup.h"
+
+#define DONE mrb_gc_arena_restore(mrb, 0);
+#define SYSFS_ROOT "/sys/devices/system"
+// NR_CPUS of the largest kernel configs
+#define BITMAP_BITS 8192
+#define BITMAP_WORDS (BITMAP_BITS / 64)
+#define LIST_BUF_SIZE (BITMAP_BITS * 3)
+
+typedef struct {
+    uint64_t w[BITMAP_WORDS];
+} mrb_cgroup_bitmap;
+
+//
+// bitmap
+//
+
+static int bitmap_test(const mrb_cgroup_bitmap *b, int i)
+{
+    return i >= 0 && i < BITMAP_BITS && (b->w[i / 64] >> (i % 64)) & 1;
+}
+
+static void bitmap_set(mrb_cgroup_bitmap *b, int i)
+{
+    b->w[i / 64] |= (uint64_t)1 << (i % 64);
+}
+
+static void bitmap_clear(mrb_cgroup_bitmap *b, int i)
+{
+    b->w[i / 64] &= ~((uint64_t)1 << (i % 64));
+}
+
+static int bitmap_count(const mrb_cgroup_bitmap *b)
+{
+    int i, n = 0;
+
+    for (i = 0; i < BITMAP_WORDS; i++) {
+        n += __builtin_popcountll(b->w[i]);
+    }
+
+    return n;
+}
+
+// first bit set at or after i, -1 when there is none
+static int bitmap_next(const mrb_cgroup_bitmap *b, int i)
+{
+    uint64_t w;
+
+    for (; i < BITMAP_BITS; i = (i / 64 + 1) * 64) {
+        if ((w = b->w[i / 64] >> (i % 64))) {
+            return i + __builtin_ctzll(w);
+        }
+    }
+
+    return -1;
+}
+
+#define BITMAP_EACH(b, i) for (i = bitmap_next(b, 0); i >= 0; i = bitmap_next(b, i + 1))
+
+static void bitmap_and(mrb_cgroup_bitmap *d, const mrb_cgroup_bitmap *a, const mrb_cgroup_bitmap *b)
+{
+    int i;
+
+    for (i = 0; i < BITMAP_WORDS; i++) {
+        d->w[i] = a->w[i] & b->w[i];
+    }
+}
+
+static void bitmap_or(mrb_cgroup_bitmap *d, const mrb_cgroup_bitmap *a, const mrb_cgroup_bitmap *b)
+{
+    int i;
+
+    for (i = 0; i < BITMAP_WORDS; i++) {
+        d->w[i] = a->w[i] | b->w[i];
+    }
+}
+
+static void bitmap_andnot(mrb_cgroup_bitmap *d, const mrb_cgroup_bitmap *a, const mrb_cgroup_bitmap *b)
+{
+    int i;
+
+    for (i = 0; i < BITMAP_WORDS; i++) {
+        d->w[i] = a->w[i] & ~b->w[i];
+    }
+}
+
+// kernel list syntax: "0-3,8,10-11", also "0-15:2/4" (2 of every 4), returns -1 on a malformed list
+static int bitmap_parse(mrb_cgroup_bitmap *b, const char *s)
+{
+    long first, last, used, group, i;
+    char *end;
+
+    memset(b, 0, sizeof(*b));
+    while (isspace((unsigned char)*s)) {
+        s++;
+    }
+    while (*s && *s != '\n') {
+        if (!isdigit((unsigned char)*s)) {
+            return -1;
+        }
+        first = last = strtol(s, &end, 10);
+        used = group = 1;
+        if (*end == '-') {
+            last = strtol(end + 1, &end, 10);
+            if (*end == ':') {
+                used = strtol(end + 1, &end, 10);
+                if (*end != '/') {
+                    return -1;
+                }
+                group = strtol(end + 1, &end, 10);
+            }
+        }
+        if (first > last || last >= BITMAP_BITS || used < 1 || group < used) {
+            return -1;
+        }
+        for (i = first; i <= last; i++) {
+            if ((i - first) % group < used) {
+                bitmap_set(b, (int)i);
+            }
+        }
+        if (*end == ',') {
+            end++;
+        } else if (*end && *end != '\n') {
+            return -1;
+        }
+        s = end;
+    }
+
+    return 0;
+}
+
+static size_t bitmap_format(const mrb_cgroup_bitmap *b, char *buf, size_t size)
+{
+    size_t len = 0;
+    int i, j;
+
+    buf[0] = '\0';
+    for (i = bitmap_next(b, 0); i >= 0 && len < size; i = bitmap_next(b, j + 1)) {
+        for (j = i; bitmap_test(b, j + 1); j++) {
+        }
+        if (i == j) {
+            len += snprintf(buf + len, size - len, "%s%d", len ? "," : "", i);
+        } else {
+            len += snprintf(buf + len, size - len, "%s%d-%d", len ? "," : "", i, j);
+        }
+    }
+
+    return (len < size) ? len : size - 1;
+}
+
+//
+// Cgroup::Bitmap
+//
+
+static void mrb_cgroup_bitmap_free(mrb_state *mrb, void *p)
+{
+    mrb_free(mrb, p);
+}
+
+static const struct mrb_data_type mrb_cgroup_bitmap_type = {
+    "mrb_cgroup_bitmap", mrb_cgroup_bitmap_free,
+};
+
+static mrb_cgroup_bitmap *mrb_cgroup_get_bitmap(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_bitmap *b = (mrb_cgroup_bitmap *)mrb_data_get_ptr(mrb, self, &mrb_cgroup_bitmap_type);
+
+    if (!b)
+        mrb_raise(mrb, E_RUNTIME_ERROR, "get mrb_cgroup_bitmap failed");
+
+    return b;
+}
+
+static mrb_value mrb_cgroup_bitmap_new(mrb_state *mrb, const mrb_cgroup_bitmap *src)
+{
+    struct RClass *cls = mrb_class_get_under(mrb, mrb_module_get(mrb, "Cgroup"), "Bitmap");
+    mrb_cgroup_bitmap *b = (mrb_cgroup_bitmap *)mrb_malloc(mrb, sizeof(mrb_cgroup_bitmap));
+
+    *b = *src;
+    return mrb_obj_value(Data_Wrap_Struct(mrb, cls, &mrb_cgroup_bitmap_type, b));
+}
+
+static void mrb_cgroup_bitmap_check(mrb_state *mrb, mrb_int i)
+{
+    if (i < 0 || i >= BITMAP_BITS) {
+        mrb_raisef(mrb, E_INDEX_ERROR, "bit %S out of range", mrb_fixnum_value(i));
+    }
+}
+
+// Cgroup::Bitmap.new("0-3,8") or Cgroup::Bitmap.new([0, 1, 2, 3, 8])
+static mrb_value mrb_cgroup_bitmap_init(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_bitmap *b = (mrb_cgroup_bitmap *)DATA_PTR(self);
+    mrb_value src = mrb_nil_value();
+    mrb_int i, bit;
+    mrb_get_args(mrb, "|o", &src);
+
+    if (b) {
+        mrb_cgroup_bitmap_free(mrb, b);
+    }
+    DATA_TYPE(self) = &mrb_cgroup_bitmap_type;
+    DATA_PTR(self) = NULL;
+    b = (mrb_cgroup_bitmap *)mrb_calloc(mrb, 1, sizeof(mrb_cgroup_bitmap));
+    DATA_PTR(self) = b;
+
+    if (mrb_array_p(src)) {
+        for (i = 0; i < RARRAY_LEN(src); i++) {
+            bit = mrb_fixnum(mrb_to_int(mrb, mrb_ary_ref(mrb, src, i)));
+            mrb_cgroup_bitmap_check(mrb, bit);
+            bitmap_set(b, (int)bit);
+        }
+    } else if (!mrb_nil_p(src) && bitmap_parse(b, mrb_string_value_cstr(mrb, &src)) < 0) {
+        mrb_raisef(mrb, E_ARGUMENT_ERROR, "invalid cpu list: %S", src);
+    }
+
+    return self;
+}
+
+static mrb_value mrb_cgroup_bitmap_to_s(mrb_state *mrb, mrb_value self)
+{
+    char buf[LIST_BUF_SIZE];
+    size_t len = bitmap_format(mrb_cgroup_get_bitmap(mrb, self), buf, sizeof(buf));
+
+    return mrb_str_new(mrb, buf, len);
+}
+
+static mrb_value mrb_cgroup_bitmap_to_a(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_bitmap *b = mrb_cgroup_get_bitmap(mrb, self);
+    mrb_value ary = mrb_ary_new_capa(mrb, bitmap_count(b));
+    int i;
+
+    BITMAP_EACH(b, i)
+    {
+        mrb_ary_push(mrb, ary, mrb_fixnum_value(i));
+    }
+
+    return ary;
+}
+
+static mrb_value mrb_cgroup_bitmap_include_p(mrb_state *mrb, mrb_value self)
+{
+    mrb_int i;
+    mrb_get_args(mrb, "i", &i);
+
+    return mrb_bool_value(bitmap_test(mrb_cgroup_get_bitmap(mrb, self), (int)i));
+}
+
+static mrb_value mrb_cgroup_bitmap_add(mrb_state *mrb, mrb_value self)
+{
+    mrb_int i;
+    mrb_get_args(mrb, "i", &i);
+
+    mrb_cgroup_bitmap_check(mrb, i);
+    bitmap_set(mrb_cgroup_get_bitmap(mrb, self), (int)i);
+    return self;
+}
+
+static mrb_value mrb_cgroup_bitmap_delete(mrb_state *mrb, mrb_value self)
+{
+    mrb_int i;
+    mrb_get_args(mrb, "i", &i);
+
+    mrb_cgroup_bitmap_check(mrb, i);
+    bitmap_clear(mrb_cgroup_get_bitmap(mrb, self), (int)i);
+    return self;
+}
+
+static mrb_value mrb_cgroup_bitmap_count(mrb_state *mrb, mrb_value self)
+{
+    return mrb_fixnum_value(bitmap_count(mrb_cgroup_get_bitmap(mrb, self)));
+}
+
+static mrb_value mrb_cgroup_bitmap_empty_p(mrb_state *mrb, mrb_value self)
+{
+    return mrb_bool_value(bitmap_next(mrb_cgroup_get_bitmap(mrb, self), 0) < 0);
+}
+
+#define BITMAP_OP(name, fn)                                                                                            \
+    static mrb_value mrb_cgroup_bitmap_##name(mrb_state *mrb, mrb_value self)                                          \
+    {                                                                                                                  \
+        mrb_cgroup_bitmap r;                                                                                           \
+        mrb_value other;                                                                                               \
+        mrb_get_args(mrb, "o", &other);                                                                                \
+                                                                                                                       \
+        fn(&r, mrb_cgroup_get_bitmap(mrb, self), mrb_cgroup_get_bitmap(mrb, other));                                   \
+        return mrb_cgroup_bitmap_new(mrb, &r);                                                                         \
+    }
+
+BITMAP_OP(or, bitmap_or);
+BITMAP_OP(and, bitmap_and);
+BITMAP_OP(minus, bitmap_andnot);
+
+static mrb_value mrb_cgroup_bitmap_eq(mrb_state *mrb, mrb_value self)
+{
+    mrb_value other;
+    mrb_get_args(mrb, "o", &other);
+
+    if (mrb_data_check_get_ptr(mrb, other, &mrb_cgroup_bitmap_type) == NULL) {
+        return mrb_false_value();
+    }
+    return mrb_bool_value(
+        !memcmp(mrb_cgroup_get_bitmap(mrb, self), mrb_cgroup_get_bitmap(mrb, other), sizeof(mrb_cgroup_bitmap)));
+}
+
+//
+// Cgroup::Topology
+//
+
+typedef struct {
+    mrb_cgroup_bitmap cpus;
+    mrb_cgroup_bitmap nodes;
+    // SMT sibling sets and last level cache domains, deduplicated, and the cpus of each node id
+    int ncores, nllcs, nnodes;
+    mrb_cgroup_bitmap *cores;
+    mrb_cgroup_bitmap *llcs;
+    mrb_cgroup_bitmap *node_cpus;
+    // per cpu: index into nodes, -1 for offline cpus
+    short *node_of;
+} mrb_cgroup_topology;
+
+static void mrb_cgroup_topology_free(mrb_state *mrb, void *p)
+{
+    mrb_cgroup_topology *t = p;
+
+    mrb_free(mrb, t->cores);
+    mrb_free(mrb, t->llcs);
+    mrb_free(mrb, t->node_cpus);
+    mrb_free(mrb, t->node_of);
+    mrb_free(mrb, t);
+}
+
+static const struct mrb_data_type mrb_cgroup_topology_type = {
+    "mrb_cgroup_topology", mrb_cgroup_topology_free,
+};
+
+static mrb_cgroup_topology *mrb_cgroup_get_topology(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_topology *t = (mrb_cgroup_topology *)mrb_data_get_ptr(mrb, self, &mrb_cgroup_topology_type);
+
+    if (!t)
+        mrb_raise(mrb, E_RUNTIME_ERROR, "get mrb_cgroup_topology failed");
+
+    return t;
+}
+
+// reads a sysfs file into buf, returns -1 when it can not be read
+static ssize_t topology_read(const char *path, char *buf, size_t size)
+{
+    ssize_t len;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+        return -1;
+    }
+    len = read(fd, buf, size - 1);
+    close(fd);
+    if (len < 0) {
+        return -1;
+    }
+    while (len > 0 && isspace((unsigned char)buf[len - 1])) {
+        len--;
+    }
+    buf[len] = '\0';
+
+    return len;
+}
+
+static int topology_read_list(const char *path, mrb_cgroup_bitmap *b)
+{
+    char buf[LIST_BUF_SIZE];
+
+    if (topology_read(path, buf, sizeof(buf)) < 0) {
+        return -1;
+    }
+    return bitmap_parse(b, buf);
+}
+
+// adds b to the set unless it is already there; the set has room for one entry per cpu
+static void topology_add_unique(mrb_cgroup_bitmap *set, int *n, const mrb_cgroup_bitmap *b)
+{
+    int i;
+
+    for (i = 0; i < *n; i++) {
+        if (!memcmp(&set[i], b, sizeof(*b))) {
+            return;
+        }
+    }
+    set[(*n)++] = *b;
+}
+
+// the highest level data/unified cache of cpu, falls back to the package and then to every cpu
+static void topology_llc(const char *sysfs, int cpu, const mrb_cgroup_bitmap *all, mrb_cgroup_bitmap *llc)
+{
+    char path[FILENAME_MAX], buf[32];
+    int index, level, best = -1;
+
+    for (index = 0;; index++) {
+        snprintf(path, sizeof(path), "%s/cpu/cpu%d/cache/index%d/level", sysfs, cpu, index);
+        if (topology_read(path, buf, sizeof(buf)) < 0) {
+            break;
+        }
+        level = atoi(buf);
+        snprintf(path, sizeof(path), "%s/cpu/cpu%d/cache/index%d/type", sysfs, cpu, index);
+        if (topology_read(path, buf, sizeof(buf)) < 0 || !strcmp(buf, "Instruction") || level <= best) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/cpu/cpu%d/cache/index%d/shared_cpu_list", sysfs, cpu, index);
+        if (topology_read_list(path, llc) == 0) {
+            best = level;
+        }
+    }
+    if (best >= 0) {
+        return;
+    }
+    snprintf(path, sizeof(path), "%s/cpu/cpu%d/topology/core_siblings_list", sysfs, cpu);
+    if (topology_read_list(path, llc) < 0) {
+        *llc = *all;
+    }
+}
+
+// Cgroup::Topology.new(sysfs = "/sys/devices/system")
+static mrb_value mrb_cgroup_topology_init(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_topology *t = (mrb_cgroup_topology *)DATA_PTR(self);
+    const char *sysfs = SYSFS_ROOT;
+    char path[FILENAME_MAX];
+    mrb_cgroup_bitmap b;
+    int cpu, node, ncpus;
+    mrb_get_args(mrb, "|z", &sysfs);
+
+    if (t) {
+        mrb_cgroup_topology_free(mrb, t);
+    }
+    DATA_TYPE(self) = &mrb_cgroup_topology_type;
+    DATA_PTR(self) = NULL;
+    t = (mrb_cgroup_topology *)mrb_calloc(mrb, 1, sizeof(mrb_cgroup_topology));
+    DATA_PTR(self) = t;
+
+    snprintf(path, sizeof(path), "%s/cpu/online", sysfs);
+    if (topology_read_list(path, &t->cpus) < 0) {
+        mrb_sys_fail(mrb, path);
+    }
+    ncpus = bitmap_count(&t->cpus);
+    t->cores = (mrb_cgroup_bitmap *)mrb_calloc(mrb, ncpus, sizeof(mrb_cgroup_bitmap));
+    t->llcs = (mrb_cgroup_bitmap *)mrb_calloc(mrb, ncpus, sizeof(mrb_cgroup_bitmap));
+    t->node_of = (short *)mrb_malloc(mrb, BITMAP_BITS * sizeof(short));
+    for (cpu = 0; cpu < BITMAP_BITS; cpu++) {
+        t->node_of[cpu] = -1;
+    }
+
+    BITMAP_EACH(&t->cpus, cpu)
+    {
+        snprintf(path, sizeof(path), "%s/cpu/cpu%d/topology/thread_siblings_list", sysfs, cpu);
+        if (topology_read_list(path, &b) < 0) {
+            memset(&b, 0, sizeof(b));
+            bitmap_set(&b, cpu);
+        }
+        // offline siblings are not placed
+        bitmap_and(&b, &b, &t->cpus);
+        topology_add_unique(t->cores, &t->ncores, &b);
+        topology_llc(sysfs, cpu, &t->cpus, &b);
+        bitmap_and(&b, &b, &t->cpus);
+        topology_add_unique(t->llcs, &t->nllcs, &b);
+    }
+
+    // a kernel without NUMA has no node directory, everything is node 0
+    snprintf(path, sizeof(path), "%s/node/online", sysfs);
+    if (topology_read_list(path, &t->nodes) < 0 || bitmap_next(&t->nodes, 0) < 0) {
+        memset(&t->nodes, 0, sizeof(t->nodes));
+        bitmap_set(&t->nodes, 0);
+    }
+    BITMAP_EACH(&t->nodes, node)
+    {
+        t->nnodes = node + 1;
+    }
+    t->node_cpus = (mrb_cgroup_bitmap *)mrb_calloc(mrb, t->nnodes, sizeof(mrb_cgroup_bitmap));
+    BITMAP_EACH(&t->nodes, node)
+    {
+        snprintf(path, sizeof(path), "%s/node/node%d/cpulist", sysfs, node);
+        if (topology_read_list(path, &t->node_cpus[node]) < 0) {
+            memset(&t->node_cpus[node], 0, sizeof(mrb_cgroup_bitmap));
+            if (bitmap_count(&t->nodes) == 1) {
+                t->node_cpus[node] = t->cpus;
+            }
+        }
+        bitmap_and(&t->node_cpus[node], &t->node_cpus[node], &t->cpus);
+        BITMAP_EACH(&t->node_cpus[node], cpu)
+        {
+            t->node_of[cpu] = node;
+        }
+    }
+
+    return self;
+}
+
+static mrb_value mrb_cgroup_topology_cpus(mrb_state *mrb, mrb_value self)
+{
+    return mrb_cgroup_bitmap_new(mrb, &mrb_cgroup_get_topology(mrb, self)->cpus);
+}
+
+static mrb_value mrb_cgroup_topology_nodes(mrb_state *mrb, mrb_value self)
+{
+    return mrb_cgroup_bitmap_new(mrb, &mrb_cgroup_get_topology(mrb, self)->nodes);
+}
+
+static mrb_value mrb_cgroup_topology_bitmaps(mrb_state *mrb, const mrb_cgroup_bitmap *set, int n)
+{
+    mrb_value ary = mrb_ary_new_capa(mrb, n);
+    int i, ai = mrb_gc_arena_save(mrb);
+
+    for (i = 0; i < n; i++) {
+        mrb_ary_push(mrb, ary, mrb_cgroup_bitmap_new(mrb, &set[i]));
+        mrb_gc_arena_restore(mrb, ai);
+    }
+
+    return ary;
+}
+
+static mrb_value mrb_cgroup_topology_cores(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_topology *t = mrb_cgroup_get_topology(mrb, self);
+    return mrb_cgroup_topology_bitmaps(mrb, t->cores, t->ncores);
+}
+
+static mrb_value mrb_cgroup_topology_llcs(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_topology *t = mrb_cgroup_get_topology(mrb, self);
+    return mrb_cgroup_topology_bitmaps(mrb, t->llcs, t->nllcs);
+}
+
+static mrb_value mrb_cgroup_topology_node_cpus(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_topology *t = mrb_cgroup_get_topology(mrb, self);
+    mrb_int node;
+    mrb_get_args(mrb, "i", &node);
+
+    if (!bitmap_test(&t->nodes, (int)node)) {
+        mrb_raisef(mrb, E_INDEX_ERROR, "no node %S", mrb_fixnum_value(node));
+    }
+    return mrb_cgroup_bitmap_new(mrb, &t->node_cpus[node]);
+}
+
+static mrb_value mrb_cgroup_topology_node_of(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_topology *t = mrb_cgroup_get_topology(mrb, self);
+    mrb_int cpu;
+    mrb_get_args(mrb, "i", &cpu);
+
+    if (!bitmap_test(&t->cpus, (int)cpu)) {
+        return mrb_nil_value();
+    }
+    return mrb_fixnum_value(t->node_of[cpu]);
+}
+
+// moves up to n cpus of scope into out: whole cores first, filling the domains (llcs) with the most free
+// cpus first, then single threads; returns the number of cpus taken
+static int topology_take(mrb_cgroup_topology *t, mrb_cgroup_bitmap *scope, int n, mrb_cgroup_bitmap *out)
+{
+    mrb_cgroup_bitmap f;
+    int i, j, best, cnt, taken = 0;
+    int *order, *nfree;
+
+    if ((order = (int *)malloc(t->nllcs * 2 * sizeof(int))) == NULL) {
+        return 0;
+    }
+    nfree = order + t->nllcs;
+    for (i = 0; i < t->nllcs; i++) {
+        bitmap_and(&f, scope, &t->llcs[i]);
+        nfree[i] = bitmap_count(&f);
+        order[i] = i;
+    }
+    for (i = 0; i < t->nllcs; i++) {
+        for (best = i, j = i + 1; j < t->nllcs; j++) {
+            if (nfree[order[j]] > nfree[order[best]]) {
+                best = j;
+            }
+        }
+        j = order[i];
+        order[i] = order[best];
+        order[best] = j;
+    }
+
+    for (i = 0; i < t->nllcs && taken < n; i++) {
+        for (j = 0; j < t->ncores && taken < n; j++) {
+            bitmap_and(&f, scope, &t->cores[j]);
+            bitmap_and(&f, &f, &t->llcs[order[i]]);
+            cnt = bitmap_count(&f);
+            if (cnt == 0 || cnt != bitmap_count(&t->cores[j]) || taken + cnt > n) {
+                continue;
+            }
+            bitmap_or(out, out, &f);
+            bitmap_andnot(scope, scope, &f);
+            taken += cnt;
+        }
+    }
+    for (i = 0; i < t->nllcs && taken < n; i++) {
+        bitmap_and(&f, scope, &t->llcs[order[i]]);
+        for (j = bitmap_next(&f, 0); j >= 0 && taken < n; j = bitmap_next(&f, j + 1)) {
+            bitmap_set(out, j);
+            bitmap_clear(scope, j);
+            taken++;
+        }
+    }
+    free(order);
+
+    return taken;
+}
+
+// the set among n with the fewest free cpus that still has need, -1 when none has
+static int topology_best_fit(const mrb_cgroup_bitmap *set, int n, const mrb_cgroup_bitmap *avail, int need)
+{
+    mrb_cgroup_bitmap f;
+    int i, cnt, best = -1, best_cnt = 0;
+
+    for (i = 0; i < n; i++) {
+        bitmap_and(&f, avail, &set[i]);
+        cnt = bitmap_count(&f);
+        if (cnt >= need && (best < 0 || cnt < best_cnt)) {
+            best = i;
+            best_cnt = cnt;
+        }
+    }
+
+    return best;
+}
+
+// place([4, 2, 2], exclude = nil) => [[cpus, mems], ...] with non-overlapping cpus; a request is kept within
+// one last level cache when it fits, else within one node, largest requests first
+static mrb_value mrb_cgroup_topology_place(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_topology *t = mrb_cgroup_get_topology(mrb, self);
+    mrb_value requests, exclude = mrb_nil_value(), result, pair[2];
+    mrb_cgroup_bitmap avail, scope, cpus, mems;
+    mrb_int i, j, n, *need;
+    int *order, d, cpu, ai;
+    mrb_get_args(mrb, "A|o", &requests, &exclude);
+
+    n = RARRAY_LEN(requests);
+    avail = t->cpus;
+    if (!mrb_nil_p(exclude)) {
+        bitmap_andnot(&avail, &avail, mrb_cgroup_get_bitmap(mrb, exclude));
+    }
+
+    // everything that can raise is checked before the buffers are allocated
+    for (i = 0; i < n; i++) {
+        j = mrb_fixnum(mrb_to_int(mrb, mrb_ary_ref(mrb, requests, i)));
+        if (j < 1 || j > bitmap_count(&avail)) {
+            mrb_raisef(mrb, E_ARGUMENT_ERROR, "invalid cpu count: %S", mrb_fixnum_value(j));
+        }
+    }
+    result = mrb_ary_new_capa(mrb, n);
+    for (i = 0; i < n; i++) {
+        mrb_ary_push(mrb, result, mrb_nil_value());
+    }
+
+    need = (mrb_int *)mrb_malloc(mrb, (n ? n : 1) * sizeof(mrb_int));
+    order = (int *)mrb_malloc(mrb, (n ? n : 1) * sizeof(int));
+    for (i = 0; i < n; i++) {
+        need[i] = mrb_fixnum(mrb_to_int(mrb, mrb_ary_ref(mrb, requests, i)));
+        order[i] = (int)i;
+        for (j = i; j > 0 && need[order[j]] > need[order[j - 1]]; j--) {
+            d = order[j];
+            order[j] = order[j - 1];
+            order[j - 1] = d;
+        }
+    }
+
+    ai = mrb_gc_arena_save(mrb);
+    for (i = 0; i < n; i++) {
+        j = order[i];
+        if (bitmap_count(&avail) < need[j]) {
+            cpu = (int)need[j];
+            mrb_free(mrb, need);
+            mrb_free(mrb, order);
+            mrb_raisef(mrb, E_ARGUMENT_ERROR, "not enough free cpus for %S", mrb_fixnum_value(cpu));
+        }
+        memset(&cpus, 0, sizeof(cpus));
+        if ((d = topology_best_fit(t->llcs, t->nllcs, &avail, (int)need[j])) >= 0) {
+            bitmap_and(&scope, &avail, &t->llcs[d]);
+        } else if ((d = topology_best_fit(t->node_cpus, t->nnodes, &avail, (int)need[j])) >= 0) {
+            bitmap_and(&scope, &avail, &t->node_cpus[d]);
+        } else {
+            scope = avail;
+        }
+        topology_take(t, &scope, (int)need[j], &cpus);
+        bitmap_andnot(&avail, &avail, &cpus);
+
+        memset(&mems, 0, sizeof(mems));
+        BITMAP_EACH(&cpus, cpu)
+        {
+            if (t->node_of[cpu] >= 0) {
+                bitmap_set(&mems, t->node_of[cpu]);
+            }
+        }
+        pair[0] = mrb_cgroup_bitmap_new(mrb, &cpus);
+        pair[1] = mrb_cgroup_bitmap_new(mrb, &mems);
+        mrb_ary_set(mrb, result, j, mrb_ary_new_from_values(mrb, 2, pair));
+        mrb_gc_arena_restore(mrb, ai);
+    }
+    mrb_free(mrb, need);
+    mrb_free(mrb, order);
+
+    return result;
+}
+
+//
+// Cgroup::CPUSET
+//
+
+#define GET_BITMAP_CPUSET(key)                                                                                         \
+    static mrb_value mrb_cgroup_get_cpuset_##key##_bitmap_body(mrb_state *mrb, mrb_value self)                         \
+    {                                                                                                                  \
+        mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self);                                            \
+        mrb_cgroup_bitmap b;                                                                                           \
+        char buf[LIST_BUF_SIZE];                                                                                       \
+                                                                                                                       \
+        if (mrb_cgroup_read_raw(mrb, mrb_cg_cxt, "cpuset." #key, buf, sizeof(buf)) < 0) {                              \
+            return mrb_nil_value();                                                                                    \
+        }                                                                                                              \
+        if (bitmap_parse(&b, buf) < 0) {                                                                               \
+            mrb_raisef(mrb, E_RUNTIME_ERROR, "invalid cpuset." #key ": %S", mrb_str_new_cstr(mrb, buf));               \
+        }                                                                                                              \
+        return mrb_cgroup_bitmap_new(mrb, &b);                                                                         \
+    }                                                                                                                  \
+    MRB_CGROUP_TIMED(MRB_CGROUP_OP_GET, mrb_cgroup_get_cpuset_##key##_bitmap)
+
+GET_BITMAP_CPUSET(cpus);
+GET_BITMAP_CPUSET(mems);
+
+void mrb_cgroup_cpuset_methods_init(mrb_state *mrb, struct RClass *cpuset)
+{
+    struct RClass *cgroup = mrb_module_get(mrb, "Cgroup");
+    struct RClass *bitmap, *topology;
+
+    mrb_define_method(mrb, cpuset, "cpus_bitmap", mrb_cgroup_get_cpuset_cpus_bitmap, MRB_ARGS_NONE());
+    mrb_define_method(mrb, cpuset, "mems_bitmap", mrb_cgroup_get_cpuset_mems_bitmap, MRB_ARGS_NONE());
+
+    bitmap = mrb_define_class_under(mrb, cgroup, "Bitmap", mrb->object_class);
+    MRB_SET_INSTANCE_TT(bitmap, MRB_TT_DATA);
+    mrb_define_method(mrb, bitmap, "initialize", mrb_cgroup_bitmap_init, MRB_ARGS_OPT(1));
+    mrb_define_method(mrb, bitmap, "to_s", mrb_cgroup_bitmap_to_s, MRB_ARGS_NONE());
+    mrb_define_method(mrb, bitmap, "inspect", mrb_cgroup_bitmap_to_s, MRB_ARGS_NONE());
+    mrb_define_method(mrb, bitmap, "to_a", mrb_cgroup_bitmap_to_a, MRB_ARGS_NONE());
+    mrb_define_method(mrb, bitmap, "include?", mrb_cgroup_bitmap_include_p, MRB_ARGS_REQ(1));
+    mrb_define_method(mrb, bitmap, "<<", mrb_cgroup_bitmap_add, MRB_ARGS_REQ(1));
+    mrb_define_method(mrb, bitmap, "delete", mrb_cgroup_bitmap_delete, MRB_ARGS_REQ(1));
+    mrb_define_method(mrb, bitmap, "count", mrb_cgroup_bitmap_count, MRB_ARGS_NONE());
+    mrb_define_method(mrb, bitmap, "size", mrb_cgroup_bitmap_count, MRB_ARGS_NONE());
+    mrb_define_method(mrb, bitmap, "empty?", mrb_cgroup_bitmap_empty_p, MRB_ARGS_NONE());
+    mrb_define_method(mrb, bitmap, "|", mrb_cgroup_bitmap_or, MRB_ARGS_REQ(1));
+    mrb_define_method(mrb, bitmap, "&", mrb_cgroup_bitmap_and, MRB_ARGS_REQ(1));
+    mrb_define_method(mrb, bitmap, "-", mrb_cgroup_bitmap_minus, MRB_ARGS_REQ(1));
+    mrb_define_method(mrb, bitmap, "==", mrb_cgroup_bitmap_eq, MRB_ARGS_REQ(1));
+    DONE;
+
+    topology = mrb_define_class_under(mrb, cgroup, "Topology", mrb->object_class);
+    MRB_SET_INSTANCE_TT(topology, MRB_TT_DATA);
+    mrb_define_method(mrb, topology, "initialize", mrb_cgroup_topology_init, MRB_ARGS_OPT(1));
+    mrb_define_method(mrb, topology, "cpus", mrb_cgroup_topology_cpus, MRB_ARGS_NONE());
+    mrb_define_method(mrb, topology, "nodes", mrb_cgroup_topology_nodes, MRB_ARGS_NONE());
+    mrb_define_method(mrb, topology, "cores", mrb_cgroup_topology_cores, MRB_ARGS_NONE());
+    mrb_define_method(mrb, topology, "llcs", mrb_cgroup_topology_llcs, MRB_ARGS_NONE());
+    mrb_define_method(mrb, topology, "node_cpus", mrb_cgroup_topology_node_cpus, MRB_ARGS_REQ(1));
+    mrb_define_method(mrb, topology, "node_of", mrb_cgroup_topology_node_of, MRB_ARGS_REQ(1));
+    mrb_define_method(mrb, topology, "place", mrb_cgroup_topology_place, MRB_ARGS_ARG(1, 1));
+    DONE;
+}
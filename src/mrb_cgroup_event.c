@@ -0,0 +1,386 @@
+/*
+** mrb_cgroup_event - memory event notifications for mruby-cgroup
+**
+** See Copyright Notice in mrb_cgroup.c
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "mruby.h"
+#include "mruby/array.h"
+#include "mruby/class.h"
+#include "mruby/data.h"
+#include "mruby/string.h"
+#include "mruby/variable.h"
+
+#include "mrb_cgroup.h"
+
+#define DONE mrb_gc_arena_restore(mrb, 0);
+
+typedef struct {
+    // fd to poll: an eventfd on v1, the memory.events/memory.pressure file on v2
+    int fd;
+    // control file the eventfd is registered for, it has to stay open (v1 only)
+    int cfd;
+    // POLLIN for an eventfd, POLLPRI for kernfs and PSI files
+    short events;
+    // v2 on_oom: memory.events changes on every low/high/max event too, a notification counts only when the
+    // oom or oom_kill counter went up since the last read
+    int oom;
+    int64_t oom_seen[2];
+} mrb_cgroup_event;
+
+static void mrb_cgroup_event_close(mrb_cgroup_event *ev)
+{
+    if (ev->fd >= 0) {
+        close(ev->fd);
+    }
+    if (ev->cfd >= 0) {
+        close(ev->cfd);
+    }
+    ev->fd = ev->cfd = -1;
+}
+
+static void mrb_cgroup_event_free(mrb_state *mrb, void *p)
+{
+    mrb_cgroup_event *ev = p;
+
+    mrb_cgroup_event_close(ev);
+    mrb_free(mrb, ev);
+}
+
+static const struct mrb_data_type mrb_cgroup_event_type = {
+    "mrb_cgroup_event", mrb_cgroup_event_free,
+};
+
+static mrb_cgroup_event *mrb_cgroup_get_event(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_event *ev = (mrb_cgroup_event *)mrb_data_get_ptr(mrb, self, &mrb_cgroup_event_type);
+
+    if (!ev)
+        mrb_raise(mrb, E_RUNTIME_ERROR, "get mrb_cgroup_event failed");
+
+    return ev;
+}
+
+mrb_value mrb_cgroup_event_new(mrb_state *mrb, int fd, int cfd, short events, mrb_value block)
+{
+    struct RClass *cls = mrb_class_get_under(mrb, mrb_module_get(mrb, "Cgroup"), "Event");
+    mrb_cgroup_event *ev = (mrb_cgroup_event *)mrb_malloc(mrb, sizeof(mrb_cgroup_event));
+    mrb_value self;
+
+    ev->fd = fd;
+    ev->cfd = cfd;
+    ev->events = events;
+    ev->oom = 0;
+    ev->oom_seen[0] = ev->oom_seen[1] = 0;
+    self = mrb_obj_value(Data_Wrap_Struct(mrb, cls, &mrb_cgroup_event_type, (void *)ev));
+    mrb_iv_set(mrb, self, mrb_intern_lit(mrb, "mrb_cgroup_event_callback"), block);
+
+    return self;
+}
+
+// v1: registers an eventfd for file through cgroup.event_control
+static mrb_value mrb_cgroup_event_register(mrb_state *mrb, mrb_cgroup_context *ctx, const char *file,
+                                           const char *args, mrb_value block)
+{
+    char path[FILENAME_MAX], buf[128];
+    int efd, cfd, ecfd, len, err;
+
+    if ((efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        mrb_sys_fail(mrb, "eventfd");
+    }
+    if (mrb_cgroup_path(mrb, ctx, file, path, sizeof(path)) < 0 || (cfd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+        err = errno;
+        close(efd);
+        errno = err;
+        mrb_sys_fail(mrb, file);
+    }
+    len = snprintf(buf, sizeof(buf), "%d %d%s%s", efd, cfd, args ? " " : "", args ? args : "");
+    if (mrb_cgroup_path(mrb, ctx, "cgroup.event_control", path, sizeof(path)) < 0 ||
+        (ecfd = open(path, O_WRONLY | O_CLOEXEC)) < 0) {
+        err = errno;
+        close(efd);
+        close(cfd);
+        errno = err;
+        mrb_sys_fail(mrb, "cgroup.event_control");
+    }
+    if (write(ecfd, buf, len) != len) {
+        err = errno;
+        close(ecfd);
+        close(efd);
+        close(cfd);
+        errno = err;
+        mrb_sys_fail(mrb, "cgroup.event_control");
+    }
+    close(ecfd);
+
+    return mrb_cgroup_event_new(mrb, efd, cfd, POLLIN, block);
+}
+
+// v2: opens file for POLLPRI, writing trigger into it first for PSI
+static mrb_value mrb_cgroup_event_watch(mrb_state *mrb, mrb_cgroup_context *ctx, const char *file,
+                                        const char *trigger, mrb_value block)
+{
+    char path[FILENAME_MAX], buf[64];
+    int fd, err;
+
+    if (mrb_cgroup_path(mrb, ctx, file, path, sizeof(path)) < 0 ||
+        (fd = open(path, (trigger ? O_RDWR : O_RDONLY) | O_NONBLOCK | O_CLOEXEC)) < 0) {
+        mrb_sys_fail(mrb, file);
+    }
+    // PSI takes the trigger including the terminating NUL
+    if (trigger && write(fd, trigger, strlen(trigger) + 1) < 0) {
+        err = errno;
+        close(fd);
+        errno = err;
+        mrb_sys_fail(mrb, trigger);
+    }
+    // kernfs reports POLLPRI for changes after the last read
+    if (!trigger && pread(fd, buf, sizeof(buf), 0) < 0) {
+    }
+
+    return mrb_cgroup_event_new(mrb, fd, -1, POLLPRI, block);
+}
+
+static const char *mrb_cgroup_event_oom_keys[] = {"oom", "oom_kill"};
+
+// reads memory.events (re-arming kernfs notification) and returns by how much oom or oom_kill went up
+static mrb_int mrb_cgroup_event_oom_read(mrb_cgroup_event *ev)
+{
+    char buf[LIVE_BUF_SIZE];
+    mrb_int count = 0;
+    ssize_t len;
+    int64_t val;
+    int i;
+
+    if ((len = pread(ev->fd, buf, sizeof(buf) - 1, 0)) < 0) {
+        return 0;
+    }
+    buf[len] = '\0';
+    for (i = 0; i < 2; i++) {
+        if (mrb_cgroup_kv_get(buf, mrb_cgroup_event_oom_keys[i], &val) < 0) {
+            continue;
+        }
+        if (val > ev->oom_seen[i] && val - ev->oom_seen[i] > count) {
+            count = (mrb_int)(val - ev->oom_seen[i]);
+        }
+        ev->oom_seen[i] = val;
+    }
+
+    return count;
+}
+
+//
+// Cgroup::MEMORY
+//
+
+static mrb_value mrb_cgroup_memory_on_oom_body(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self);
+    mrb_value block = mrb_nil_value(), event;
+    mrb_cgroup_event *ev;
+    mrb_get_args(mrb, "&", &block);
+
+    if (mrb_cg_cxt->v2) {
+        event = mrb_cgroup_event_watch(mrb, mrb_cg_cxt, "memory.events", NULL, block);
+        ev = mrb_cgroup_get_event(mrb, event);
+        ev->oom = 1;
+        // the counters so far are the baseline
+        mrb_cgroup_event_oom_read(ev);
+        return event;
+    }
+    return mrb_cgroup_event_register(mrb, mrb_cg_cxt, "memory.oom_control", NULL, block);
+}
+MRB_CGROUP_TIMED(MRB_CGROUP_OP_SET, mrb_cgroup_memory_on_oom)
+
+static mrb_value mrb_cgroup_memory_on_threshold_body(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self);
+    mrb_value block = mrb_nil_value();
+    mrb_int bytes;
+    char args[32];
+    mrb_get_args(mrb, "i&", &bytes, &block);
+
+    if (mrb_cg_cxt->v2) {
+        mrb_raise(mrb, E_NOTIMP_ERROR, "usage thresholds are not available on cgroup v2, use on_pressure");
+    }
+    snprintf(args, sizeof(args), "%lld", (long long)bytes);
+    return mrb_cgroup_event_register(mrb, mrb_cg_cxt, "memory.usage_in_bytes", args, block);
+}
+MRB_CGROUP_TIMED(MRB_CGROUP_OP_SET, mrb_cgroup_memory_on_threshold)
+
+// level is "low", "medium" or "critical"; on v2 a PSI trigger such as "some 150000 1000000" is accepted too
+static mrb_value mrb_cgroup_memory_on_pressure_body(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self);
+    mrb_value block = mrb_nil_value();
+    const char *trigger;
+    char *level;
+    mrb_get_args(mrb, "z&", &level, &block);
+
+    if (!mrb_cg_cxt->v2) {
+        return mrb_cgroup_event_register(mrb, mrb_cg_cxt, "memory.pressure_level", level, block);
+    }
+    if (!strcmp(level, "low")) {
+        trigger = "some 150000 1000000";
+    } else if (!strcmp(level, "medium")) {
+        trigger = "some 350000 1000000";
+    } else if (!strcmp(level, "critical")) {
+        trigger = "full 100000 1000000";
+    } else {
+        trigger = level;
+    }
+    return mrb_cgroup_event_watch(mrb, mrb_cg_cxt, "memory.pressure", trigger, block);
+}
+MRB_CGROUP_TIMED(MRB_CGROUP_OP_SET, mrb_cgroup_memory_on_pressure)
+
+//
+// Cgroup::Event
+//
+
+// consumes a pending notification, returns the number of events (0 when nothing was pending)
+static mrb_int mrb_cgroup_event_consume(mrb_cgroup_event *ev)
+{
+    uint64_t count;
+    char buf[256];
+
+    if (ev->fd < 0) {
+        return 0;
+    }
+    if (ev->events == POLLIN) {
+        return (read(ev->fd, &count, sizeof(count)) == sizeof(count)) ? (mrb_int)count : 0;
+    }
+    if (ev->oom) {
+        return mrb_cgroup_event_oom_read(ev);
+    }
+    // re-arms kernfs notification, PSI triggers do not need it
+    if (pread(ev->fd, buf, sizeof(buf), 0) < 0) {
+    }
+    return 1;
+}
+
+static mrb_value mrb_cgroup_event_dispatch(mrb_state *mrb, mrb_value self, mrb_int count)
+{
+    mrb_value block = mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "mrb_cgroup_event_callback"));
+    mrb_value argv[2];
+
+    if (count > 0 && !mrb_nil_p(block)) {
+        argv[0] = self;
+        argv[1] = mrb_fixnum_value(count);
+        mrb_yield_argv(mrb, block, 2, argv);
+    }
+
+    return mrb_fixnum_value(count);
+}
+
+static mrb_value mrb_cgroup_event_fd(mrb_state *mrb, mrb_value self)
+{
+    return mrb_fixnum_value(mrb_cgroup_get_event(mrb, self)->fd);
+}
+
+// the poll(2) events to wait for on fd, for callers driving their own epoll loop
+static mrb_value mrb_cgroup_event_events(mrb_state *mrb, mrb_value self)
+{
+    return mrb_fixnum_value(mrb_cgroup_get_event(mrb, self)->events);
+}
+
+static mrb_value mrb_cgroup_event_read(mrb_state *mrb, mrb_value self)
+{
+    return mrb_fixnum_value(mrb_cgroup_event_consume(mrb_cgroup_get_event(mrb, self)));
+}
+
+// consumes the pending notification and runs the callback with (event, count)
+static mrb_value mrb_cgroup_event_call(mrb_state *mrb, mrb_value self)
+{
+    return mrb_cgroup_event_dispatch(mrb, self, mrb_cgroup_event_consume(mrb_cgroup_get_event(mrb, self)));
+}
+
+static mrb_value mrb_cgroup_event_close_m(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_event_close(mrb_cgroup_get_event(mrb, self));
+    return mrb_nil_value();
+}
+
+// Cgroup::Event.wait([events], timeout_ms = -1) waits for any of events, runs their callbacks and returns those
+// with a notification; a wakeup that counts nothing (an on_oom event seeing memory.high) is left out, [] at once
+// when no event is open
+static mrb_value mrb_cgroup_event_wait(mrb_state *mrb, mrb_value self)
+{
+    mrb_value list, fired, notified, ev_value;
+    mrb_int timeout = -1, i, n, count;
+    struct pollfd *fds;
+    int ret, nopen = 0;
+    mrb_get_args(mrb, "A|i", &list, &timeout);
+
+    n = RARRAY_LEN(list);
+    fds = (struct pollfd *)mrb_malloc(mrb, sizeof(struct pollfd) * (n ? n : 1));
+    for (i = 0; i < n; i++) {
+        mrb_cgroup_event *ev = (mrb_cgroup_event *)mrb_data_check_get_ptr(mrb, mrb_ary_ref(mrb, list, i),
+                                                                          &mrb_cgroup_event_type);
+        fds[i].fd = ev ? ev->fd : -1;
+        fds[i].events = ev ? ev->events : 0;
+        fds[i].revents = 0;
+        nopen += (fds[i].fd >= 0);
+    }
+    // poll would sleep the whole timeout (forever with -1) on nothing but closed events
+    if (nopen == 0) {
+        mrb_free(mrb, fds);
+        return mrb_ary_new(mrb);
+    }
+    do {
+        ret = poll(fds, n, (int)timeout);
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0) {
+        mrb_free(mrb, fds);
+        mrb_sys_fail(mrb, "poll");
+    }
+
+    // collect first, callbacks may raise
+    fired = mrb_ary_new(mrb);
+    for (i = 0; i < n && ret > 0; i++) {
+        if (fds[i].revents & (fds[i].events | POLLERR)) {
+            mrb_ary_push(mrb, fired, mrb_ary_ref(mrb, list, i));
+        }
+    }
+    mrb_free(mrb, fds);
+
+    notified = mrb_ary_new(mrb);
+    for (i = 0; i < RARRAY_LEN(fired); i++) {
+        ev_value = mrb_ary_ref(mrb, fired, i);
+        if ((count = mrb_cgroup_event_consume(mrb_cgroup_get_event(mrb, ev_value))) > 0) {
+            mrb_ary_push(mrb, notified, ev_value);
+            mrb_cgroup_event_dispatch(mrb, ev_value, count);
+        }
+    }
+
+    return notified;
+}
+
+void mrb_cgroup_event_init(mrb_state *mrb, struct RClass *cgroup)
+{
+    struct RClass *event;
+    struct RClass *memory = mrb_class_get_under(mrb, cgroup, "MEMORY");
+
+    mrb_define_method(mrb, memory, "on_oom", mrb_cgroup_memory_on_oom, MRB_ARGS_BLOCK());
+    mrb_define_method(mrb, memory, "on_threshold", mrb_cgroup_memory_on_threshold, MRB_ARGS_REQ(1));
+    mrb_define_method(mrb, memory, "on_pressure", mrb_cgroup_memory_on_pressure, MRB_ARGS_REQ(1));
+    DONE;
+
+    event = mrb_define_class_under(mrb, cgroup, "Event", mrb->object_class);
+    MRB_SET_INSTANCE_TT(event, MRB_TT_DATA);
+    mrb_define_class_method(mrb, event, "wait", mrb_cgroup_event_wait, MRB_ARGS_ARG(1, 1));
+    mrb_define_method(mrb, event, "fd", mrb_cgroup_event_fd, MRB_ARGS_NONE());
+    mrb_define_method(mrb, event, "events", mrb_cgroup_event_events, MRB_ARGS_NONE());
+    mrb_define_method(mrb, event, "read", mrb_cgroup_event_read, MRB_ARGS_NONE());
+    mrb_define_method(mrb, event, "call", mrb_cgroup_event_call, MRB_ARGS_NONE());
+    mrb_define_method(mrb, event, "close", mrb_cgroup_event_close_m, MRB_ARGS_NONE());
+    DONE;
+}
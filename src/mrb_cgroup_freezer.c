@@ -0,0 +1,244 @@
+/*
+** mrb_cgroup_freezer - freezing groups with completion events for mruby-cgroup
+**
+** See Copyright Notice in mrb_cgroup.c
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mruby.h"
+#include "mruby/class.h"
+#include "mruby/data.h"
+#include "mruby/string.h"
+
+#include "mrb_cgroup.h"
+
+#define DONE mrb_gc_arena_restore(mrb, 0);
+// v1 freezer.state does not notify, it is polled from 1ms up to this
+#define FREEZER_POLL_MAX_MS 100
+
+typedef enum { FREEZER_THAWED, FREEZER_FREEZING, FREEZER_FROZEN, FREEZER_GONE } mrb_cgroup_freeze_t;
+
+static const char *mrb_cgroup_freezer_names[] = {"THAWED", "FREEZING", "FROZEN"};
+
+// a waiter for one freeze, owned by its detached thread
+typedef struct {
+    char dir[FILENAME_MAX];
+    int v2;
+    // a dup of the eventfd of the Cgroup::Event, valid even after the event is closed
+    int efd;
+} mrb_cgroup_freezer_waiter;
+
+static ssize_t freezer_read(const char *dir, const char *file, char *buf, size_t size)
+{
+    char path[FILENAME_MAX];
+    ssize_t len;
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+        return -1;
+    }
+    len = read(fd, buf, size - 1);
+    close(fd);
+    if (len < 0) {
+        return -1;
+    }
+    buf[len] = '\0';
+
+    return len;
+}
+
+// v2: "frozen 1" of cgroup.events once every task stopped, cgroup.freeze holds what was asked
+static mrb_cgroup_freeze_t freezer_state(const char *dir, int v2)
+{
+    char buf[256];
+    int64_t frozen;
+
+    if (!v2) {
+        if (freezer_read(dir, "freezer.state", buf, sizeof(buf)) < 0) {
+            return FREEZER_GONE;
+        }
+        return !strncmp(buf, "FROZEN", 6) ? FREEZER_FROZEN : !strncmp(buf, "FREEZING", 8) ? FREEZER_FREEZING
+                                                                                           : FREEZER_THAWED;
+    }
+    if (freezer_read(dir, "cgroup.events", buf, sizeof(buf)) < 0) {
+        return FREEZER_GONE;
+    }
+    if (mrb_cgroup_kv_get(buf, "frozen", &frozen) == 0 && frozen) {
+        return FREEZER_FROZEN;
+    }
+    if (freezer_read(dir, "cgroup.freeze", buf, sizeof(buf)) < 0) {
+        return FREEZER_GONE;
+    }
+
+    return (buf[0] == '1') ? FREEZER_FREEZING : FREEZER_THAWED;
+}
+
+// waits until the group is frozen and signals the eventfd; a thaw or a removal in the meantime ends it silently
+static void *freezer_wait_main(void *arg)
+{
+    mrb_cgroup_freezer_waiter *w = arg;
+    mrb_cgroup_freeze_t state;
+    struct pollfd pfd;
+    char path[FILENAME_MAX], buf[256];
+    struct timespec ts;
+    uint64_t one = 1;
+    int ms = 1;
+
+    pfd.fd = -1;
+    if (w->v2) {
+        snprintf(path, sizeof(path), "%s/cgroup.events", w->dir);
+        pfd.fd = open(path, O_RDONLY | O_CLOEXEC);
+        pfd.events = POLLPRI;
+    }
+    for (;;) {
+        // arms kernfs notification before the state is looked at
+        if (pfd.fd >= 0 && pread(pfd.fd, buf, sizeof(buf), 0) < 0) {
+            break;
+        }
+        if ((state = freezer_state(w->dir, w->v2)) == FREEZER_FROZEN) {
+            if (write(w->efd, &one, sizeof(one)) < 0) {
+            }
+            break;
+        }
+        if (state != FREEZER_FREEZING) {
+            break;
+        }
+        if (pfd.fd >= 0) {
+            // a thaw does not change cgroup.events, cgroup.freeze is checked again every second
+            poll(&pfd, 1, 1000);
+            continue;
+        }
+        ts.tv_sec = 0;
+        ts.tv_nsec = ms * 1000000L;
+        nanosleep(&ts, NULL);
+        ms = (ms * 2 > FREEZER_POLL_MAX_MS) ? FREEZER_POLL_MAX_MS : ms * 2;
+    }
+    if (pfd.fd >= 0) {
+        close(pfd.fd);
+    }
+    close(w->efd);
+    free(w);
+
+    return NULL;
+}
+
+static void mrb_cgroup_freezer_write(mrb_state *mrb, mrb_cgroup_context *ctx, int frozen)
+{
+    const char *file = ctx->v2 ? "cgroup.freeze" : "freezer.state";
+    const char *val = ctx->v2 ? (frozen ? "1" : "0") : (frozen ? "FROZEN" : "THAWED");
+
+    if (mrb_cgroup_write_file(mrb, ctx, file, val) < 0) {
+        mrb_sys_fail(mrb, file);
+    }
+}
+
+// freeze { |event, count| ... } => Cgroup::Event, readable once every task of the group is frozen
+static mrb_value mrb_cgroup_freezer_freeze_body(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self);
+    mrb_cgroup_freezer_waiter *w;
+    mrb_value block = mrb_nil_value();
+    char dir[FILENAME_MAX];
+    uint64_t one = 1;
+    pthread_attr_t attr;
+    pthread_t thread;
+    int efd, err;
+    mrb_get_args(mrb, "&", &block);
+
+    if (mrb_cgroup_path(mrb, mrb_cg_cxt, NULL, dir, sizeof(dir)) < 0) {
+        mrb_sys_fail(mrb, RSTRING_PTR(mrb_cg_cxt->group_name));
+    }
+    mrb_cgroup_freezer_write(mrb, mrb_cg_cxt, 1);
+    if ((efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        mrb_sys_fail(mrb, "eventfd");
+    }
+    // a group without running tasks is frozen at once
+    if (freezer_state(dir, mrb_cg_cxt->v2) == FREEZER_FROZEN) {
+        if (write(efd, &one, sizeof(one)) < 0) {
+        }
+        return mrb_cgroup_event_new(mrb, efd, -1, POLLIN, block);
+    }
+
+    w = (mrb_cgroup_freezer_waiter *)malloc(sizeof(mrb_cgroup_freezer_waiter));
+    if (w == NULL || (w->efd = fcntl(efd, F_DUPFD_CLOEXEC, 0)) < 0) {
+        err = w ? errno : ENOMEM;
+        free(w);
+        close(efd);
+        errno = err;
+        mrb_sys_fail(mrb, "freeze");
+    }
+    snprintf(w->dir, sizeof(w->dir), "%s", dir);
+    w->v2 = mrb_cg_cxt->v2;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    err = pthread_create(&thread, &attr, freezer_wait_main, w);
+    pthread_attr_destroy(&attr);
+    if (err) {
+        close(w->efd);
+        free(w);
+        close(efd);
+        mrb_raise(mrb, E_RUNTIME_ERROR, "pthread_create failed");
+    }
+
+    return mrb_cgroup_event_new(mrb, efd, -1, POLLIN, block);
+}
+MRB_CGROUP_TIMED(MRB_CGROUP_OP_SET, mrb_cgroup_freezer_freeze)
+
+static mrb_value mrb_cgroup_freezer_thaw_body(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_freezer_write(mrb, mrb_cgroup_get_context(mrb, self), 0);
+    return self;
+}
+MRB_CGROUP_TIMED(MRB_CGROUP_OP_SET, mrb_cgroup_freezer_thaw)
+
+static mrb_cgroup_freeze_t mrb_cgroup_freezer_current(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self);
+    char dir[FILENAME_MAX];
+
+    if (mrb_cgroup_path(mrb, mrb_cg_cxt, NULL, dir, sizeof(dir)) < 0) {
+        return FREEZER_GONE;
+    }
+
+    return freezer_state(dir, mrb_cg_cxt->v2);
+}
+
+// state => "THAWED", "FREEZING" or "FROZEN" as on v1, nil when the group does not exist
+static mrb_value mrb_cgroup_freezer_state_body(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_freeze_t state = mrb_cgroup_freezer_current(mrb, self);
+
+    if (state == FREEZER_GONE) {
+        return mrb_nil_value();
+    }
+
+    return mrb_str_new_cstr(mrb, mrb_cgroup_freezer_names[state]);
+}
+MRB_CGROUP_TIMED(MRB_CGROUP_OP_GET, mrb_cgroup_freezer_state)
+
+static mrb_value mrb_cgroup_freezer_frozen_p_body(mrb_state *mrb, mrb_value self)
+{
+    return mrb_bool_value(mrb_cgroup_freezer_current(mrb, self) == FREEZER_FROZEN);
+}
+MRB_CGROUP_TIMED(MRB_CGROUP_OP_GET, mrb_cgroup_freezer_frozen_p)
+
+void mrb_cgroup_freezer_methods_init(mrb_state *mrb, struct RClass *freezer)
+{
+    mrb_define_method(mrb, freezer, "freeze", mrb_cgroup_freezer_freeze, MRB_ARGS_BLOCK());
+    mrb_define_method(mrb, freezer, "thaw", mrb_cgroup_freezer_thaw, MRB_ARGS_NONE());
+    mrb_define_method(mrb, freezer, "state", mrb_cgroup_freezer_state, MRB_ARGS_NONE());
+    mrb_define_method(mrb, freezer, "frozen?", mrb_cgroup_freezer_frozen_p, MRB_ARGS_NONE());
+    DONE;
+}
@@ -0,0 +1,379 @@
+/*
+** mrb_cgroup_history - per group sample ring buffer for mruby-cgroup
+**
+** See Copyright Notice in mrb_cgroup.c
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mruby.h"
+#include "mruby/class.h"
+#include "mruby/data.h"
+#include "mruby/hash.h"
+#include "mruby/string.h"
+#include "mruby/variable.h"
+
+#include "mrb_cgroup.h"
+
+#define DONE mrb_gc_arena_restore(mrb, 0);
+#define HISTORY_CAPACITY_MAX (1024 * 1024)
+
+// counters of one sample, -1 when the file could not be read
+typedef struct {
+    int64_t timestamp;
+    int64_t usage;
+    int64_t nr_periods;
+    int64_t nr_throttled;
+    int64_t throttled_time;
+    int64_t memory;
+} mrb_cgroup_history_sample;
+
+enum { HISTORY_USAGE, HISTORY_CPU_STAT, HISTORY_MEMORY, HISTORY_NFILES };
+
+static const char *mrb_cgroup_history_keys[HISTORY_NFILES] = {"cpuacct.usage", "cpu.stat", "memory.usage_in_bytes"};
+
+typedef struct {
+    int fds[HISTORY_NFILES];
+    const mrb_cgroup_v2_key *convs[HISTORY_NFILES];
+    size_t capacity;
+    // samples[head] is the next one to be written
+    size_t head;
+    size_t count;
+    mrb_cgroup_history_sample *samples;
+} mrb_cgroup_history;
+
+static void mrb_cgroup_history_close(mrb_cgroup_history *h)
+{
+    int i;
+
+    for (i = 0; i < HISTORY_NFILES; i++) {
+        if (h->fds[i] >= 0) {
+            close(h->fds[i]);
+            h->fds[i] = -1;
+        }
+    }
+}
+
+static void mrb_cgroup_history_free(mrb_state *mrb, void *p)
+{
+    mrb_cgroup_history *h = p;
+
+    mrb_cgroup_history_close(h);
+    mrb_free(mrb, h->samples);
+    mrb_free(mrb, h);
+}
+
+static const struct mrb_data_type mrb_cgroup_history_type = {
+    "mrb_cgroup_history", mrb_cgroup_history_free,
+};
+
+static mrb_cgroup_history *mrb_cgroup_get_history(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_history *h = (mrb_cgroup_history *)mrb_data_get_ptr(mrb, self, &mrb_cgroup_history_type);
+
+    if (!h)
+        mrb_raise(mrb, E_RUNTIME_ERROR, "get mrb_cgroup_history failed");
+
+    return h;
+}
+
+// files missing at construction (controller not enabled yet) are retried on every sample
+static void mrb_cgroup_history_open(mrb_state *mrb, mrb_value self, mrb_cgroup_history *h)
+{
+    mrb_value group = mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "group"));
+    char path[FILENAME_MAX];
+    int i;
+
+    for (i = 0; i < HISTORY_NFILES; i++) {
+        if (h->fds[i] >= 0) {
+            continue;
+        }
+        if (mrb_cgroup_key_path(mrb, RSTRING_PTR(group), mrb_cgroup_history_keys[i], path, sizeof(path),
+                                &h->convs[i]) == 0) {
+            h->fds[i] = open(path, O_RDONLY | O_CLOEXEC);
+        }
+    }
+}
+
+static ssize_t mrb_cgroup_history_read(mrb_cgroup_history *h, int i, char *buf, size_t size)
+{
+    ssize_t len;
+
+    if (h->fds[i] < 0 || (len = pread(h->fds[i], buf, size - 1, 0)) <= 0) {
+        return -1;
+    }
+    while (len > 0 && (buf[len - 1] == '\n' || buf[len - 1] == ' ')) {
+        len--;
+    }
+    buf[len] = '\0';
+    if (h->convs[i] && (len = mrb_cgroup_v2_to_v1(h->convs[i], buf, size)) <= 0) {
+        return -1;
+    }
+
+    return len;
+}
+
+// Cgroup::History.new(group, capacity = 120)
+static mrb_value mrb_cgroup_history_initialize(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_history *h = (mrb_cgroup_history *)DATA_PTR(self);
+    mrb_value group;
+    mrb_int capacity = 120;
+    int i;
+    mrb_get_args(mrb, "S|i", &group, &capacity);
+
+    if (capacity < 2 || capacity > HISTORY_CAPACITY_MAX) {
+        mrb_raise(mrb, E_ARGUMENT_ERROR, "capacity out of range");
+    }
+
+    if (h) {
+        mrb_cgroup_history_free(mrb, h);
+    }
+    DATA_TYPE(self) = &mrb_cgroup_history_type;
+    DATA_PTR(self) = NULL;
+
+    h = (mrb_cgroup_history *)mrb_calloc(mrb, 1, sizeof(mrb_cgroup_history));
+    for (i = 0; i < HISTORY_NFILES; i++) {
+        h->fds[i] = -1;
+    }
+    DATA_PTR(self) = h;
+    h->capacity = capacity;
+    h->samples = (mrb_cgroup_history_sample *)mrb_calloc(mrb, capacity, sizeof(mrb_cgroup_history_sample));
+
+    mrb_iv_set(mrb, self, mrb_intern_lit(mrb, "group"), group);
+    mrb_cgroup_history_open(mrb, self, h);
+
+    return self;
+}
+
+// reads the counters into the next slot and returns its timestamp (CLOCK_MONOTONIC nsec)
+static mrb_value mrb_cgroup_history_sample_m(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_history *h = mrb_cgroup_get_history(mrb, self);
+    mrb_cgroup_history_sample *s = &h->samples[h->head];
+    char buf[LIVE_BUF_SIZE];
+    struct timespec ts;
+    int64_t usec;
+
+    mrb_cgroup_history_open(mrb, self, h);
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    s->timestamp = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    s->usage = s->nr_periods = s->nr_throttled = s->throttled_time = s->memory = -1;
+
+    if (mrb_cgroup_history_read(h, HISTORY_USAGE, buf, sizeof(buf)) > 0) {
+        s->usage = strtoll(buf, NULL, 10);
+    }
+    if (mrb_cgroup_history_read(h, HISTORY_CPU_STAT, buf, sizeof(buf)) > 0) {
+        mrb_cgroup_kv_get(buf, "nr_periods", &s->nr_periods);
+        mrb_cgroup_kv_get(buf, "nr_throttled", &s->nr_throttled);
+        // throttled_time is in nsec on v1, v2 has throttled_usec
+        if (mrb_cgroup_kv_get(buf, "throttled_time", &s->throttled_time) < 0 &&
+            mrb_cgroup_kv_get(buf, "throttled_usec", &usec) == 0) {
+            s->throttled_time = usec * 1000;
+        }
+    }
+    if (mrb_cgroup_history_read(h, HISTORY_MEMORY, buf, sizeof(buf)) > 0) {
+        s->memory = strtoll(buf, NULL, 10);
+    }
+
+    h->head = (h->head + 1) % h->capacity;
+    if (h->count < h->capacity) {
+        h->count++;
+    }
+
+    return mrb_fixnum_value(s->timestamp);
+}
+
+// n-th oldest of the last window samples
+static mrb_cgroup_history_sample *mrb_cgroup_history_at(mrb_cgroup_history *h, size_t window, size_t n)
+{
+    return &h->samples[(h->head + h->capacity - window + n) % h->capacity];
+}
+
+// nil or 0 means every sample in the buffer
+static size_t mrb_cgroup_history_window(mrb_state *mrb, mrb_cgroup_history *h, mrb_value window)
+{
+    mrb_int n;
+
+    if (mrb_nil_p(window)) {
+        return h->count;
+    }
+    n = mrb_fixnum(mrb_to_int(mrb, window));
+    if (n < 0) {
+        mrb_raise(mrb, E_ARGUMENT_ERROR, "negative window");
+    }
+
+    return (n == 0 || (size_t)n > h->count) ? h->count : (size_t)n;
+}
+
+typedef struct {
+    double utilization;
+    double utilization_min;
+    double utilization_max;
+    double throttle_ratio;
+    int64_t throttled_time;
+    int64_t memory_min;
+    int64_t memory_max;
+    double memory_avg;
+    int64_t duration;
+} mrb_cgroup_history_summary;
+
+// utilization is cpu time over wall time (1.0 is one cpu busy), counters going backwards
+// (cpuacct.usage reset) or missing leave the interval out
+static void mrb_cgroup_history_summarize(mrb_cgroup_history *h, size_t window, mrb_cgroup_history_summary *sum)
+{
+    mrb_cgroup_history_sample *prev, *cur;
+    int64_t usage = 0, wall = 0, periods = 0, throttled = 0, memory_total = 0;
+    size_t i, nmemory = 0, nintervals = 0;
+    double u;
+
+    memset(sum, 0, sizeof(*sum));
+    sum->memory_min = sum->memory_max = -1;
+
+    for (i = 0, prev = NULL; i < window; i++, prev = cur) {
+        cur = mrb_cgroup_history_at(h, window, i);
+        if (cur->memory >= 0) {
+            if (nmemory == 0 || cur->memory < sum->memory_min) {
+                sum->memory_min = cur->memory;
+            }
+            if (nmemory == 0 || cur->memory > sum->memory_max) {
+                sum->memory_max = cur->memory;
+            }
+            memory_total += cur->memory;
+            nmemory++;
+        }
+        if (prev == NULL) {
+            continue;
+        }
+        sum->duration += cur->timestamp - prev->timestamp;
+        if (cur->usage >= prev->usage && prev->usage >= 0 && cur->timestamp > prev->timestamp) {
+            usage += cur->usage - prev->usage;
+            wall += cur->timestamp - prev->timestamp;
+            u = (double)(cur->usage - prev->usage) / (double)(cur->timestamp - prev->timestamp);
+            if (nintervals == 0 || u < sum->utilization_min) {
+                sum->utilization_min = u;
+            }
+            if (nintervals == 0 || u > sum->utilization_max) {
+                sum->utilization_max = u;
+            }
+            nintervals++;
+        }
+        if (cur->nr_periods >= prev->nr_periods && prev->nr_periods >= 0 && cur->nr_throttled >= prev->nr_throttled &&
+            prev->nr_throttled >= 0) {
+            periods += cur->nr_periods - prev->nr_periods;
+            throttled += cur->nr_throttled - prev->nr_throttled;
+        }
+        if (cur->throttled_time >= prev->throttled_time && prev->throttled_time >= 0) {
+            sum->throttled_time += cur->throttled_time - prev->throttled_time;
+        }
+    }
+
+    sum->utilization = wall ? (double)usage / (double)wall : 0.0;
+    sum->throttle_ratio = periods ? (double)throttled / (double)periods : 0.0;
+    sum->memory_avg = nmemory ? (double)memory_total / (double)nmemory : 0.0;
+}
+
+static mrb_value mrb_cgroup_history_utilization(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_history *h = mrb_cgroup_get_history(mrb, self);
+    mrb_cgroup_history_summary sum;
+    mrb_value window = mrb_nil_value();
+    mrb_get_args(mrb, "|o", &window);
+
+    mrb_cgroup_history_summarize(h, mrb_cgroup_history_window(mrb, h, window), &sum);
+
+    return mrb_float_value(mrb, sum.utilization);
+}
+
+static mrb_value mrb_cgroup_history_throttle_ratio(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_history *h = mrb_cgroup_get_history(mrb, self);
+    mrb_cgroup_history_summary sum;
+    mrb_value window = mrb_nil_value();
+    mrb_get_args(mrb, "|o", &window);
+
+    mrb_cgroup_history_summarize(h, mrb_cgroup_history_window(mrb, h, window), &sum);
+
+    return mrb_float_value(mrb, sum.throttle_ratio);
+}
+
+#define HISTORY_SET(name, val) mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern_lit(mrb, name)), val)
+
+// summary(window = nil, h = nil), fills h in place like stat_hash
+static mrb_value mrb_cgroup_history_summary_m(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_history *h = mrb_cgroup_get_history(mrb, self);
+    mrb_cgroup_history_summary sum;
+    mrb_value window = mrb_nil_value(), hash = mrb_nil_value();
+    int ai;
+    mrb_get_args(mrb, "|oH", &window, &hash);
+
+    mrb_cgroup_history_summarize(h, mrb_cgroup_history_window(mrb, h, window), &sum);
+
+    if (mrb_nil_p(hash)) {
+        hash = mrb_hash_new(mrb);
+    }
+    ai = mrb_gc_arena_save(mrb);
+    HISTORY_SET("utilization", mrb_float_value(mrb, sum.utilization));
+    HISTORY_SET("utilization_min", mrb_float_value(mrb, sum.utilization_min));
+    HISTORY_SET("utilization_max", mrb_float_value(mrb, sum.utilization_max));
+    HISTORY_SET("throttle_ratio", mrb_float_value(mrb, sum.throttle_ratio));
+    HISTORY_SET("throttled_time", mrb_fixnum_value(sum.throttled_time));
+    HISTORY_SET("memory_min", mrb_fixnum_value(sum.memory_min));
+    HISTORY_SET("memory_avg", mrb_float_value(mrb, sum.memory_avg));
+    HISTORY_SET("memory_max", mrb_fixnum_value(sum.memory_max));
+    HISTORY_SET("duration", mrb_fixnum_value(sum.duration));
+    mrb_gc_arena_restore(mrb, ai);
+
+    return hash;
+}
+
+static mrb_value mrb_cgroup_history_size(mrb_state *mrb, mrb_value self)
+{
+    return mrb_fixnum_value(mrb_cgroup_get_history(mrb, self)->count);
+}
+
+static mrb_value mrb_cgroup_history_capacity(mrb_state *mrb, mrb_value self)
+{
+    return mrb_fixnum_value(mrb_cgroup_get_history(mrb, self)->capacity);
+}
+
+static mrb_value mrb_cgroup_history_clear(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_history *h = mrb_cgroup_get_history(mrb, self);
+
+    h->head = h->count = 0;
+    return self;
+}
+
+static mrb_value mrb_cgroup_history_close_m(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_history_close(mrb_cgroup_get_history(mrb, self));
+    return mrb_nil_value();
+}
+
+void mrb_cgroup_history_init(mrb_state *mrb, struct RClass *cgroup)
+{
+    struct RClass *history;
+
+    history = mrb_define_class_under(mrb, cgroup, "History", mrb->object_class);
+    MRB_SET_INSTANCE_TT(history, MRB_TT_DATA);
+    mrb_define_method(mrb, history, "initialize", mrb_cgroup_history_initialize, MRB_ARGS_ARG(1, 1));
+    mrb_define_method(mrb, history, "sample", mrb_cgroup_history_sample_m, MRB_ARGS_NONE());
+    mrb_define_method(mrb, history, "utilization", mrb_cgroup_history_utilization, MRB_ARGS_OPT(1));
+    mrb_define_method(mrb, history, "throttle_ratio", mrb_cgroup_history_throttle_ratio, MRB_ARGS_OPT(1));
+    mrb_define_method(mrb, history, "summary", mrb_cgroup_history_summary_m, MRB_ARGS_OPT(2));
+    mrb_define_method(mrb, history, "size", mrb_cgroup_history_size, MRB_ARGS_NONE());
+    mrb_define_method(mrb, history, "capacity", mrb_cgroup_history_capacity, MRB_ARGS_NONE());
+    mrb_define_method(mrb, history, "clear", mrb_cgroup_history_clear, MRB_ARGS_NONE());
+    mrb_define_method(mrb, history, "close", mrb_cgroup_history_close_m, MRB_ARGS_NONE());
+    DONE;
+}
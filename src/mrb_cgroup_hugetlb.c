@@ -0,0 +1,189 @@
+/*
+** mrb_cgroup_hugetlb - per page size huge page limits and usage for mruby-cgroup
+**
+** See Copyright Notice in mrb_cgroup.c
+*/
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mruby.h"
+#include "mruby/array.h"
+#include "mruby/class.h"
+#include "mruby/data.h"
+#include "mruby/hash.h"
+#include "mruby/string.h"
+#include "mruby/variable.h"
+
+#include "mrb_cgroup.h"
+
+#define DONE mrb_gc_arena_restore(mrb, 0);
+#define HUGETLB_KEY_SIZE 64
+
+static const char *mrb_cgroup_hugetlb_keys[] = {"limit_in_bytes", "usage_in_bytes", "max_usage_in_bytes", "failcnt"};
+
+// "2MB", "1GB" as the kernel names the hugetlb.<size>.* files, from /sys/kernel/mm/hugepages/hugepages-<kB>kB;
+// read once per mrb_state and kept in Cgroup::HUGETLB
+static mrb_value mrb_cgroup_hugetlb_sizes(mrb_state *mrb)
+{
+    struct RClass *hugetlb = mrb_class_get_under(mrb, mrb_module_get(mrb, "Cgroup"), "HUGETLB");
+    mrb_value sizes = mrb_iv_get(mrb, mrb_obj_value(hugetlb), mrb_intern_lit(mrb, "page_sizes"));
+    unsigned long kb;
+    struct dirent *ent;
+    char buf[32];
+    DIR *dp;
+
+    if (!mrb_nil_p(sizes)) {
+        return sizes;
+    }
+    sizes = mrb_ary_new(mrb);
+    if ((dp = opendir("/sys/kernel/mm/hugepages"))) {
+        while ((ent = readdir(dp))) {
+            if (sscanf(ent->d_name, "hugepages-%lukB", &kb) != 1 || kb == 0) {
+                continue;
+            }
+            if (kb >= 1024 * 1024) {
+                snprintf(buf, sizeof(buf), "%luGB", kb / (1024 * 1024));
+            } else if (kb >= 1024) {
+                snprintf(buf, sizeof(buf), "%luMB", kb / 1024);
+            } else {
+                snprintf(buf, sizeof(buf), "%luKB", kb);
+            }
+            mrb_ary_push(mrb, sizes, mrb_str_new_cstr(mrb, buf));
+        }
+        closedir(dp);
+    }
+    mrb_iv_set(mrb, mrb_obj_value(hugetlb), mrb_intern_lit(mrb, "page_sizes"), sizes);
+
+    return sizes;
+}
+
+static void mrb_cgroup_hugetlb_key(mrb_state *mrb, mrb_value size, const char *name, char *key)
+{
+    size = mrb_str_to_str(mrb, size);
+    if (RSTRING_LEN(size) == 0 || memchr(RSTRING_PTR(size), '.', RSTRING_LEN(size)) ||
+        memchr(RSTRING_PTR(size), '/', RSTRING_LEN(size))) {
+        mrb_raisef(mrb, E_ARGUMENT_ERROR, "invalid page size %S", size);
+    }
+    snprintf(key, HUGETLB_KEY_SIZE, "hugetlb.%.*s.%s", (int)RSTRING_LEN(size), RSTRING_PTR(size), name);
+}
+
+static mrb_value mrb_cgroup_hugetlb_get(mrb_state *mrb, mrb_cgroup_context *ctx, const char *key)
+{
+    char buf[64];
+
+    if (mrb_cgroup_read_raw(mrb, ctx, key, buf, sizeof(buf)) <= 0) {
+        return mrb_nil_value();
+    }
+    return mrb_fixnum_value((int64_t)strtoll(buf, NULL, 10));
+}
+
+// limit_in_bytes = {"2MB" => 1 << 30, "1GB" => nil}, staged for apply; nil or -1 removes the limit
+static mrb_value mrb_cgroup_set_hugetlb_limit_in_bytes_body(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self);
+    mrb_value limits, sizes, limit;
+    char key[HUGETLB_KEY_SIZE];
+    const char *name;
+    mrb_int i;
+    int code;
+    mrb_get_args(mrb, "H", &limits);
+
+    sizes = mrb_hash_keys(mrb, limits);
+    for (i = 0; i < RARRAY_LEN(sizes); i++) {
+        mrb_cgroup_hugetlb_key(mrb, mrb_ary_ref(mrb, sizes, i), "limit_in_bytes", key);
+        limit = mrb_hash_get(mrb, limits, mrb_ary_ref(mrb, sizes, i));
+        limit = mrb_nil_p(limit) ? mrb_fixnum_value(-1) : mrb_to_int(mrb, limit);
+        // dirty keys are kept by pointer, a symbol name lives as long as the mrb_state
+        name = mrb_sym2name(mrb, mrb_intern_cstr(mrb, key));
+        if ((code = cgroup_set_value_int64(mrb_cg_cxt->cgc, name, mrb_fixnum(limit)))) {
+            mrb_raisef(mrb, E_RUNTIME_ERROR, "cgroup_set_value_int64 %S failed: %S", mrb_str_new_cstr(mrb, name),
+                       mrb_str_new_cstr(mrb, cgroup_strerror(code)));
+        }
+        mrb_cgroup_mark_dirty(mrb, mrb_cg_cxt, name);
+    }
+
+    return self;
+}
+MRB_CGROUP_TIMED(MRB_CGROUP_OP_SET, mrb_cgroup_set_hugetlb_limit_in_bytes)
+
+// v2 has no max_usage_in_bytes (nil), failcnt is the "max" count of hugetlb.<size>.events
+#define GET_HUGETLB_INT64(name)                                                                                        \
+    static mrb_value mrb_cgroup_get_hugetlb_##name##_body(mrb_state *mrb, mrb_value self)                              \
+    {                                                                                                                  \
+        mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self);                                            \
+        char key[HUGETLB_KEY_SIZE];                                                                                    \
+        mrb_value size;                                                                                                \
+        mrb_get_args(mrb, "o", &size);                                                                                 \
+                                                                                                                       \
+        mrb_cgroup_hugetlb_key(mrb, size, #name, key);                                                                 \
+        return mrb_cgroup_hugetlb_get(mrb, mrb_cg_cxt, key);                                                           \
+    }                                                                                                                  \
+    MRB_CGROUP_TIMED(MRB_CGROUP_OP_GET, mrb_cgroup_get_hugetlb_##name)
+
+GET_HUGETLB_INT64(limit_in_bytes);
+GET_HUGETLB_INT64(usage_in_bytes);
+GET_HUGETLB_INT64(max_usage_in_bytes);
+GET_HUGETLB_INT64(failcnt);
+
+// {"2MB" => {:limit_in_bytes => -1, :usage_in_bytes => 0, :max_usage_in_bytes => 0, :failcnt => 0}} for every
+// page size of the host
+static mrb_value mrb_cgroup_get_hugetlb_stats_hash_body(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self);
+    mrb_value hash = mrb_nil_value(), sizes, size, entry;
+    char key[HUGETLB_KEY_SIZE];
+    mrb_int i;
+    size_t j;
+    int ai;
+    mrb_get_args(mrb, "|H", &hash);
+
+    if (mrb_nil_p(hash)) {
+        hash = mrb_hash_new(mrb);
+    }
+    sizes = mrb_cgroup_hugetlb_sizes(mrb);
+    ai = mrb_gc_arena_save(mrb);
+    for (i = 0; i < RARRAY_LEN(sizes); i++) {
+        size = mrb_ary_ref(mrb, sizes, i);
+        entry = mrb_hash_get(mrb, hash, size);
+        if (!mrb_hash_p(entry)) {
+            entry = mrb_hash_new(mrb);
+            mrb_hash_set(mrb, hash, size, entry);
+        }
+        for (j = 0; j < sizeof(mrb_cgroup_hugetlb_keys) / sizeof(mrb_cgroup_hugetlb_keys[0]); j++) {
+            mrb_cgroup_hugetlb_key(mrb, size, mrb_cgroup_hugetlb_keys[j], key);
+            mrb_hash_set(mrb, entry, mrb_symbol_value(mrb_intern_cstr(mrb, mrb_cgroup_hugetlb_keys[j])),
+                         mrb_cgroup_hugetlb_get(mrb, mrb_cg_cxt, key));
+        }
+        mrb_gc_arena_restore(mrb, ai);
+    }
+
+    return hash;
+}
+MRB_CGROUP_TIMED(MRB_CGROUP_OP_GET, mrb_cgroup_get_hugetlb_stats_hash)
+
+// Cgroup::HUGETLB.page_sizes => ["2MB", "1GB"]
+static mrb_value mrb_cgroup_hugetlb_page_sizes(mrb_state *mrb, mrb_value self)
+{
+    mrb_value sizes = mrb_cgroup_hugetlb_sizes(mrb);
+
+    // a copy, the cached list is not handed out
+    return mrb_ary_new_from_values(mrb, RARRAY_LEN(sizes), RARRAY_PTR(sizes));
+}
+
+void mrb_cgroup_hugetlb_methods_init(mrb_state *mrb, struct RClass *hugetlb)
+{
+    mrb_define_class_method(mrb, hugetlb, "page_sizes", mrb_cgroup_hugetlb_page_sizes, MRB_ARGS_NONE());
+    mrb_define_method(mrb, hugetlb, "limit_in_bytes=", mrb_cgroup_set_hugetlb_limit_in_bytes, MRB_ARGS_REQ(1));
+    mrb_define_method(mrb, hugetlb, "limit_in_bytes", mrb_cgroup_get_hugetlb_limit_in_bytes, MRB_ARGS_REQ(1));
+    mrb_define_method(mrb, hugetlb, "usage_in_bytes", mrb_cgroup_get_hugetlb_usage_in_bytes, MRB_ARGS_REQ(1));
+    mrb_define_method(mrb, hugetlb, "max_usage_in_bytes", mrb_cgroup_get_hugetlb_max_usage_in_bytes,
+                      MRB_ARGS_REQ(1));
+    mrb_define_method(mrb, hugetlb, "failcnt", mrb_cgroup_get_hugetlb_failcnt, MRB_ARGS_REQ(1));
+    mrb_define_method(mrb, hugetlb, "stats_hash", mrb_cgroup_get_hugetlb_stats_hash, MRB_ARGS_OPT(1));
+    DONE;
+}
@@ -0,0 +1,419 @@
+/*
+** mrb_cgroup_keys - get/set of any control file through one key table for mruby-cgroup
+**
+** See Copyright Notice in mrb_cgroup.c
+*/
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mruby.h"
+#include "mruby/array.h"
+#include "mruby/hash.h"
+#include "mruby/string.h"
+
+#include "mrb_cgroup.h"
+
+#define DONE mrb_gc_arena_restore(mrb, 0);
+#define KEY_NAME_SIZE 64
+// a power of two; with ~110 keys about one seed in 5 leaves no collision, see mrb_cgroup_keys_build
+#define KEY_SLOTS 4096
+
+typedef enum {
+    KEY_INT,    // one integer, "max" reads as -1
+    KEY_STRING, // text as is, nil when empty
+    KEY_KV,     // "name value" lines as {:name => value}
+    KEY_LIST    // space separated integers as an Array
+} mrb_cgroup_key_type;
+
+typedef struct {
+    const char *name;
+    mrb_cgroup_key_type type;
+    int read_only;
+    // v1 hierarchy the file is in, NULL for the cgroup.* core files found in every group
+    const char *controller;
+} mrb_cgroup_key;
+
+// known keys of both versions; a key missing here still works, typed from what it reads and writable
+static const mrb_cgroup_key mrb_cgroup_keys[] = {
+    {"cpu.cfs_quota_us", KEY_INT, 0, "cpu"},
+    {"cpu.cfs_period_us", KEY_INT, 0, "cpu"},
+    {"cpu.cfs_burst_us", KEY_INT, 0, "cpu"},
+    {"cpu.rt_period_us", KEY_INT, 0, "cpu"},
+    {"cpu.rt_runtime_us", KEY_INT, 0, "cpu"},
+    {"cpu.shares", KEY_INT, 0, "cpu"},
+    {"cpu.idle", KEY_INT, 0, "cpu"},
+    {"cpu.stat", KEY_KV, 1, "cpu"},
+    {"cpu.uclamp.min", KEY_STRING, 0, "cpu"},
+    {"cpu.uclamp.max", KEY_STRING, 0, "cpu"},
+    {"cpu.max", KEY_STRING, 0, "cpu"},
+    {"cpu.max.burst", KEY_INT, 0, "cpu"},
+    {"cpu.weight", KEY_INT, 0, "cpu"},
+    {"cpu.weight.nice", KEY_INT, 0, "cpu"},
+    {"cpu.pressure", KEY_STRING, 1, "cpu"},
+    {"cpuacct.usage", KEY_INT, 0, "cpuacct"},
+    {"cpuacct.usage_user", KEY_INT, 1, "cpuacct"},
+    {"cpuacct.usage_sys", KEY_INT, 1, "cpuacct"},
+    {"cpuacct.usage_percpu", KEY_LIST, 1, "cpuacct"},
+    {"cpuacct.usage_percpu_user", KEY_LIST, 1, "cpuacct"},
+    {"cpuacct.usage_percpu_sys", KEY_LIST, 1, "cpuacct"},
+    {"cpuacct.usage_all", KEY_STRING, 1, "cpuacct"},
+    {"cpuacct.stat", KEY_KV, 1, "cpuacct"},
+    {"cpuset.cpus", KEY_STRING, 0, "cpuset"},
+    {"cpuset.mems", KEY_STRING, 0, "cpuset"},
+    {"cpuset.effective_cpus", KEY_STRING, 1, "cpuset"},
+    {"cpuset.effective_mems", KEY_STRING, 1, "cpuset"},
+    {"cpuset.cpus.effective", KEY_STRING, 1, "cpuset"},
+    {"cpuset.mems.effective", KEY_STRING, 1, "cpuset"},
+    {"cpuset.cpus.partition", KEY_STRING, 0, "cpuset"},
+    {"cpuset.cpu_exclusive", KEY_INT, 0, "cpuset"},
+    {"cpuset.mem_exclusive", KEY_INT, 0, "cpuset"},
+    {"cpuset.mem_hardwall", KEY_INT, 0, "cpuset"},
+    {"cpuset.memory_migrate", KEY_INT, 0, "cpuset"},
+    {"cpuset.memory_pressure", KEY_INT, 1, "cpuset"},
+    {"cpuset.memory_spread_page", KEY_INT, 0, "cpuset"},
+    {"cpuset.memory_spread_slab", KEY_INT, 0, "cpuset"},
+    {"cpuset.sched_load_balance", KEY_INT, 0, "cpuset"},
+    {"cpuset.sched_relax_domain_level", KEY_INT, 0, "cpuset"},
+    {"memory.limit_in_bytes", KEY_INT, 0, "memory"},
+    {"memory.soft_limit_in_bytes", KEY_INT, 0, "memory"},
+    {"memory.usage_in_bytes", KEY_INT, 1, "memory"},
+    {"memory.max_usage_in_bytes", KEY_INT, 0, "memory"},
+    {"memory.failcnt", KEY_INT, 0, "memory"},
+    {"memory.memsw.limit_in_bytes", KEY_INT, 0, "memory"},
+    {"memory.memsw.usage_in_bytes", KEY_INT, 1, "memory"},
+    {"memory.memsw.max_usage_in_bytes", KEY_INT, 0, "memory"},
+    {"memory.memsw.failcnt", KEY_INT, 0, "memory"},
+    {"memory.kmem.limit_in_bytes", KEY_INT, 0, "memory"},
+    {"memory.kmem.usage_in_bytes", KEY_INT, 1, "memory"},
+    {"memory.kmem.max_usage_in_bytes", KEY_INT, 0, "memory"},
+    {"memory.kmem.tcp.limit_in_bytes", KEY_INT, 0, "memory"},
+    {"memory.kmem.tcp.usage_in_bytes", KEY_INT, 1, "memory"},
+    {"memory.swappiness", KEY_INT, 0, "memory"},
+    {"memory.move_charge_at_immigrate", KEY_INT, 0, "memory"},
+    {"memory.use_hierarchy", KEY_INT, 0, "memory"},
+    {"memory.oom_control", KEY_KV, 0, "memory"},
+    {"memory.stat", KEY_KV, 1, "memory"},
+    {"memory.numa_stat", KEY_STRING, 1, "memory"},
+    {"memory.current", KEY_INT, 1, "memory"},
+    {"memory.peak", KEY_INT, 1, "memory"},
+    {"memory.min", KEY_INT, 0, "memory"},
+    {"memory.low", KEY_INT, 0, "memory"},
+    {"memory.high", KEY_INT, 0, "memory"},
+    {"memory.max", KEY_INT, 0, "memory"},
+    {"memory.oom.group", KEY_INT, 0, "memory"},
+    {"memory.events", KEY_KV, 1, "memory"},
+    {"memory.events.local", KEY_KV, 1, "memory"},
+    {"memory.swap.current", KEY_INT, 1, "memory"},
+    {"memory.swap.peak", KEY_INT, 1, "memory"},
+    {"memory.swap.high", KEY_INT, 0, "memory"},
+    {"memory.swap.max", KEY_INT, 0, "memory"},
+    {"memory.swap.events", KEY_KV, 1, "memory"},
+    {"memory.zswap.current", KEY_INT, 1, "memory"},
+    {"memory.zswap.max", KEY_INT, 0, "memory"},
+    {"memory.pressure", KEY_STRING, 1, "memory"},
+    {"blkio.weight", KEY_INT, 0, "blkio"},
+    {"blkio.weight_device", KEY_STRING, 0, "blkio"},
+    {"blkio.throttle.read_bps_device", KEY_STRING, 0, "blkio"},
+    {"blkio.throttle.write_bps_device", KEY_STRING, 0, "blkio"},
+    {"blkio.throttle.read_iops_device", KEY_STRING, 0, "blkio"},
+    {"blkio.throttle.write_iops_device", KEY_STRING, 0, "blkio"},
+    {"blkio.throttle.io_service_bytes", KEY_STRING, 1, "blkio"},
+    {"blkio.throttle.io_serviced", KEY_STRING, 1, "blkio"},
+    {"io.max", KEY_STRING, 0, "blkio"},
+    {"io.weight", KEY_STRING, 0, "blkio"},
+    {"io.latency", KEY_STRING, 0, "blkio"},
+    {"io.stat", KEY_STRING, 1, "blkio"},
+    {"io.pressure", KEY_STRING, 1, "blkio"},
+    {"pids.max", KEY_INT, 0, "pids"},
+    {"pids.current", KEY_INT, 1, "pids"},
+    {"pids.peak", KEY_INT, 1, "pids"},
+    {"pids.events", KEY_KV, 1, "pids"},
+    {"freezer.state", KEY_STRING, 0, "freezer"},
+    {"freezer.self_freezing", KEY_INT, 1, "freezer"},
+    {"freezer.parent_freezing", KEY_INT, 1, "freezer"},
+    {"cgroup.freeze", KEY_INT, 0, NULL},
+    {"cgroup.events", KEY_KV, 1, NULL},
+    {"cgroup.stat", KEY_KV, 1, NULL},
+    {"cgroup.type", KEY_STRING, 0, NULL},
+    {"cgroup.controllers", KEY_STRING, 1, NULL},
+    {"cgroup.subtree_control", KEY_STRING, 0, NULL},
+    {"cgroup.max.depth", KEY_INT, 0, NULL},
+    {"cgroup.max.descendants", KEY_INT, 0, NULL},
+    {"cgroup.pressure", KEY_INT, 0, NULL},
+    {"cgroup.clone_children", KEY_INT, 0, NULL},
+    {"notify_on_release", KEY_INT, 0, NULL},
+};
+
+#define KEY_COUNT (sizeof(mrb_cgroup_keys) / sizeof(mrb_cgroup_keys[0]))
+
+// perfect hash of the names: one probe into slots, built once per process with the first seed leaving no collision
+static short mrb_cgroup_keys_slots[KEY_SLOTS];
+static uint32_t mrb_cgroup_keys_seed;
+static pthread_once_t mrb_cgroup_keys_once = PTHREAD_ONCE_INIT;
+
+// FNV-1a, the seed folded into the offset basis
+static uint32_t mrb_cgroup_keys_hash(uint32_t seed, const char *s, size_t len)
+{
+    uint32_t h = 2166136261u ^ (seed * 2654435761u);
+
+    while (len--) {
+        h = (h ^ (unsigned char)*s++) * 16777619u;
+    }
+
+    return h & (KEY_SLOTS - 1);
+}
+
+static void mrb_cgroup_keys_build(void)
+{
+    uint32_t seed, h;
+    size_t i;
+
+    for (seed = 0;; seed++) {
+        memset(mrb_cgroup_keys_slots, 0xff, sizeof(mrb_cgroup_keys_slots));
+        for (i = 0; i < KEY_COUNT; i++) {
+            h = mrb_cgroup_keys_hash(seed, mrb_cgroup_keys[i].name, strlen(mrb_cgroup_keys[i].name));
+            if (mrb_cgroup_keys_slots[h] >= 0) {
+                break;
+            }
+            mrb_cgroup_keys_slots[h] = (short)i;
+        }
+        if (i == KEY_COUNT) {
+            mrb_cgroup_keys_seed = seed;
+            return;
+        }
+    }
+}
+
+static const mrb_cgroup_key *mrb_cgroup_keys_lookup(const char *name, size_t len)
+{
+    short i = mrb_cgroup_keys_slots[mrb_cgroup_keys_hash(mrb_cgroup_keys_seed, name, len)];
+
+    if (i < 0 || strncmp(mrb_cgroup_keys[i].name, name, len) || mrb_cgroup_keys[i].name[len] != '\0') {
+        return NULL;
+    }
+
+    return &mrb_cgroup_keys[i];
+}
+
+// key as a Symbol or a String into name, a plain file name of the group directory
+static const mrb_cgroup_key *mrb_cgroup_keys_name(mrb_state *mrb, mrb_value key, char *name)
+{
+    const char *p;
+    mrb_int len;
+
+    if (mrb_symbol_p(key)) {
+        p = mrb_sym2name_len(mrb, mrb_symbol(key), &len);
+    } else {
+        key = mrb_str_to_str(mrb, key);
+        p = RSTRING_PTR(key);
+        len = RSTRING_LEN(key);
+    }
+    if (len == 0 || len >= KEY_NAME_SIZE || p[0] == '.' || memchr(p, '/', len) || memchr(p, '\0', len)) {
+        mrb_raisef(mrb, E_ARGUMENT_ERROR, "invalid key %S", key);
+    }
+    memcpy(name, p, len);
+    name[len] = '\0';
+
+    return mrb_cgroup_keys_lookup(name, len);
+}
+
+// path of key in the group of ctx, *conv is set when a v1 key is served by a v2 file
+static int mrb_cgroup_keys_path(mrb_state *mrb, mrb_cgroup_context *ctx, const mrb_cgroup_key *k, const char *name,
+                                char *path, size_t size, const mrb_cgroup_v2_key **conv)
+{
+    const char *group = RSTRING_PTR(ctx->group_name);
+    char dir[FILENAME_MAX];
+
+    *conv = NULL;
+    if (ctx->v2) {
+        return mrb_cgroup_key_path(mrb, group, name, path, size, conv);
+    }
+    // core files are in every v1 hierarchy, the one of the object is used
+    if ((k && k->controller == NULL) || !strncmp(name, "cgroup.", 7)) {
+        return mrb_cgroup_path(mrb, ctx, name, path, size);
+    }
+    if (k == NULL) {
+        return mrb_cgroup_key_path(mrb, group, name, path, size, conv);
+    }
+    if (mrb_cgroup_controller_path(mrb, k->controller, group, dir, sizeof(dir)) < 0) {
+        return -1;
+    }
+    snprintf(path, size, "%s/%s", dir, name);
+
+    return 0;
+}
+
+static mrb_value mrb_cgroup_keys_value(mrb_state *mrb, const mrb_cgroup_key *k, char *buf, ssize_t len)
+{
+    mrb_cgroup_key_type type = k ? k->type : KEY_STRING;
+    char *end;
+    int64_t val;
+
+    // an unknown key reading as one integer (or "max") is taken as one
+    if (k == NULL && len > 0) {
+        strtoll(buf, &end, 10);
+        if ((end != buf && *end == '\0') || !strcmp(buf, "max")) {
+            type = KEY_INT;
+        }
+    }
+    switch (type) {
+    case KEY_INT:
+        if (len == 0) {
+            return mrb_nil_value();
+        }
+        val = !strcmp(buf, "max") ? -1 : strtoll(buf, NULL, 10);
+        return mrb_fixnum_value(val);
+    case KEY_KV:
+        return mrb_cgroup_parse_kv(mrb, buf, mrb_hash_new(mrb));
+    case KEY_LIST:
+        return mrb_cgroup_parse_list(mrb, buf, mrb_ary_new(mrb));
+    default:
+        return (len == 0) ? mrb_nil_value() : mrb_str_new(mrb, buf, len);
+    }
+}
+
+// the value of key read from the control file, nil when the group or the file does not exist
+static mrb_value mrb_cgroup_keys_get_one(mrb_state *mrb, mrb_cgroup_context *ctx, mrb_value key)
+{
+    const mrb_cgroup_v2_key *conv;
+    const mrb_cgroup_key *k;
+    char name[KEY_NAME_SIZE], path[FILENAME_MAX], buf[LIVE_BUF_SIZE];
+    ssize_t len;
+    int fd, err;
+
+    k = mrb_cgroup_keys_name(mrb, key, name);
+    if (mrb_cgroup_keys_path(mrb, ctx, k, name, path, sizeof(path), &conv) < 0) {
+        return mrb_nil_value();
+    }
+    MRB_CGROUP_SYSCALL(3);
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+        if (errno == ENOENT) {
+            return mrb_nil_value();
+        }
+        mrb_sys_fail(mrb, name);
+    }
+    len = read(fd, buf, sizeof(buf) - 1);
+    err = errno;
+    close(fd);
+    if (len < 0) {
+        errno = err;
+        mrb_sys_fail(mrb, name);
+    }
+    while (len > 0 && isspace((unsigned char)buf[len - 1])) {
+        len--;
+    }
+    buf[len] = '\0';
+    if (conv) {
+        len = mrb_cgroup_v2_to_v1(conv, buf, sizeof(buf));
+    }
+
+    return mrb_cgroup_keys_value(mrb, k, buf, len);
+}
+
+// get(key) => Integer, String, Hash or Array by the type of key
+static mrb_value mrb_cgroup_keys_get_body(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self);
+    mrb_value key;
+    mrb_get_args(mrb, "o", &key);
+
+    return mrb_cgroup_keys_get_one(mrb, mrb_cg_cxt, key);
+}
+MRB_CGROUP_TIMED(MRB_CGROUP_OP_GET, mrb_cgroup_keys_get)
+
+// get_many([keys]) => {key => value}, keys as given
+static mrb_value mrb_cgroup_keys_get_many_body(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self);
+    mrb_value keys, result;
+    mrb_int i;
+    int ai;
+    mrb_get_args(mrb, "A", &keys);
+
+    result = mrb_hash_new_capa(mrb, RARRAY_LEN(keys));
+    ai = mrb_gc_arena_save(mrb);
+    for (i = 0; i < RARRAY_LEN(keys); i++) {
+        mrb_hash_set(mrb, result, mrb_ary_ref(mrb, keys, i),
+                     mrb_cgroup_keys_get_one(mrb, mrb_cg_cxt, mrb_ary_ref(mrb, keys, i)));
+        mrb_gc_arena_restore(mrb, ai);
+    }
+
+    return result;
+}
+MRB_CGROUP_TIMED(MRB_CGROUP_OP_GET, mrb_cgroup_keys_get_many)
+
+// set(key, value) writes the control file at once, not on apply; nil writes no limit ("-1", "max" on v2)
+static mrb_value mrb_cgroup_keys_set_body(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_context *mrb_cg_cxt = mrb_cgroup_get_context(mrb, self);
+    const mrb_cgroup_v2_key *conv;
+    const mrb_cgroup_key *k;
+    char name[KEY_NAME_SIZE], path[FILENAME_MAX], num[32];
+    const char *val;
+    mrb_value key, value;
+    size_t len;
+    int fd, err = 0;
+    mrb_get_args(mrb, "oo", &key, &value);
+
+    k = mrb_cgroup_keys_name(mrb, key, name);
+    if (k && k->read_only) {
+        mrb_raisef(mrb, E_ARGUMENT_ERROR, "%S is read only", mrb_str_new_cstr(mrb, name));
+    }
+    if (mrb_cgroup_keys_path(mrb, mrb_cg_cxt, k, name, path, sizeof(path), &conv) < 0) {
+        mrb_sys_fail(mrb, name);
+    }
+    if (mrb_nil_p(value)) {
+        val = (mrb_cg_cxt->v2 && conv == NULL) ? "max" : "-1";
+    } else if (mrb_fixnum_p(value) || mrb_float_p(value)) {
+        snprintf(num, sizeof(num), "%lld", (long long)mrb_fixnum(mrb_to_int(mrb, value)));
+        val = num;
+    } else if (mrb_type(value) == MRB_TT_TRUE || mrb_type(value) == MRB_TT_FALSE) {
+        val = mrb_test(value) ? "1" : "0";
+    } else {
+        // anything with a to_s in the syntax of the file, such as Cgroup::Bitmap
+        value = mrb_obj_as_string(mrb, value);
+        val = mrb_string_value_cstr(mrb, &value);
+    }
+
+    // v1 keys served by another v2 file are converted on the way
+    if (conv) {
+        if (mrb_cgroup_write_key(mrb, RSTRING_PTR(mrb_cg_cxt->group_name), name, val) < 0) {
+            mrb_sys_fail(mrb, name);
+        }
+        return self;
+    }
+    MRB_CGROUP_SYSCALL(3);
+    // O_TRUNC as mrb_cgroup_write_file, a fake root keeps no tail of a longer old value
+    if ((fd = open(path, O_WRONLY | O_TRUNC | O_CLOEXEC)) < 0) {
+        mrb_sys_fail(mrb, name);
+    }
+    len = strlen(val);
+    if (write(fd, val, len) != (ssize_t)len) {
+        err = errno ? errno : EIO;
+    }
+    close(fd);
+    if (err) {
+        errno = err;
+        mrb_sys_fail(mrb, name);
+    }
+
+    return self;
+}
+MRB_CGROUP_TIMED(MRB_CGROUP_OP_SET, mrb_cgroup_keys_set)
+
+void mrb_cgroup_keys_init(mrb_state *mrb, struct RClass *cgroup)
+{
+    pthread_once(&mrb_cgroup_keys_once, mrb_cgroup_keys_build);
+    mrb_define_method(mrb, cgroup, "get", mrb_cgroup_keys_get, MRB_ARGS_REQ(1));
+    mrb_define_method(mrb, cgroup, "set", mrb_cgroup_keys_set, MRB_ARGS_REQ(2));
+    mrb_define_method(mrb, cgroup, "get_many", mrb_cgroup_keys_get_many, MRB_ARGS_REQ(1));
+    DONE;
+}
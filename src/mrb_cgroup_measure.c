@@ -0,0 +1,538 @@
+/*
+** mrb_cgroup_measure - block-scoped resource accounting for mruby-cgroup
+**
+** See Copyright Notice in mrb_cgroup.c
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mruby.h"
+#include "mruby/class.h"
+#include "mruby/data.h"
+#include "mruby/hash.h"
+#include "mruby/string.h"
+#include "mruby/variable.h"
+
+#include "mrb_cgroup.h"
+
+#define DONE mrb_gc_arena_restore(mrb, 0);
+#define MEASURE_HIERS_SIZE 3
+#define MEASURE_GROUP "/mruby-measure"
+
+// the counters come from these, co-mounted v1 controllers and v2 share a hierarchy
+static const char *mrb_cgroup_measure_controllers[MEASURE_HIERS_SIZE] = {"cpuacct", "memory", "blkio"};
+
+typedef struct {
+    const char *controller;
+    // hierarchy root, the scratch group of the thread in it and its tasks (cgroup.procs on v2) file
+    char *root;
+    char *dir;
+    int attach_fd;
+    // where the thread was found at the last start, reopened only when that changes
+    char *orig;
+    int orig_fd;
+} mrb_cgroup_measure_hier;
+
+// per mrb_state and thread, rebuilt when the scratch group, the thread or the hierarchy roots change; the
+// counters are group wide, every thread measures in a group of its own, <group>/<pid>-<tid>
+typedef struct {
+    char *group;
+    // the process that made the groups, a forked child leaves them to it
+    pid_t pid;
+    int fake;
+    int nhiers;
+    mrb_cgroup_measure_hier hiers[MEASURE_HIERS_SIZE];
+    int usage_fd, peak_fd, io_fd;
+    const mrb_cgroup_v2_key *usage_conv, *peak_conv, *io_conv;
+    // /proc/thread-self/cgroup of tid
+    int self_fd;
+    pid_t tid;
+} mrb_cgroup_measure_state;
+
+typedef struct {
+    // snapshot of start
+    int64_t start, cpu0, read0, write0;
+    // set by finish, -1 until then or when the counter is not available
+    int64_t wall, cpu, peak, read, write;
+    // bit i set when hierarchy i was attached by start and is restored by finish
+    unsigned moved;
+    int finished;
+} mrb_cgroup_measurement;
+
+static void mrb_cgroup_measure_close(int *fd)
+{
+    if (*fd >= 0) {
+        close(*fd);
+    }
+    *fd = -1;
+}
+
+static void mrb_cgroup_measure_state_free(mrb_state *mrb, void *p)
+{
+    mrb_cgroup_measure_state *st = p;
+    int i;
+
+    mrb_cgroup_measure_close(&st->usage_fd);
+    mrb_cgroup_measure_close(&st->peak_fd);
+    mrb_cgroup_measure_close(&st->io_fd);
+    mrb_cgroup_measure_close(&st->self_fd);
+    for (i = 0; i < st->nhiers; i++) {
+        mrb_cgroup_measure_close(&st->hiers[i].attach_fd);
+        mrb_cgroup_measure_close(&st->hiers[i].orig_fd);
+        // the group of a thread is of no use to any other, it fails with EBUSY while something is left in it
+        if (st->hiers[i].dir && st->pid == getpid() && mrb_cgroup_rmdir_one(st->hiers[i].dir, st->fake) < 0) {
+        }
+        free(st->hiers[i].root);
+        free(st->hiers[i].dir);
+        free(st->hiers[i].orig);
+    }
+    free(st->group);
+    mrb_free(mrb, st);
+}
+
+static const struct mrb_data_type mrb_cgroup_measure_state_type = {
+    "mrb_cgroup_measure_state", mrb_cgroup_measure_state_free,
+};
+
+static const struct mrb_data_type mrb_cgroup_measurement_type = {
+    "mrb_cgroup_measurement", mrb_free,
+};
+
+static int64_t mrb_cgroup_measure_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int mrb_cgroup_measure_open(mrb_state *mrb, const char *group, const char *key, int flags,
+                                   const mrb_cgroup_v2_key **conv)
+{
+    char path[FILENAME_MAX];
+
+    if (mrb_cgroup_key_path(mrb, group, key, path, sizeof(path), conv) < 0) {
+        return -1;
+    }
+
+    return open(path, flags | O_CLOEXEC);
+}
+
+// first line of fd as a number, -1 when it can not be read
+static int64_t mrb_cgroup_measure_read(int fd, const mrb_cgroup_v2_key *conv)
+{
+    char buf[LIVE_BUF_SIZE];
+    ssize_t len;
+
+    if (fd < 0 || (len = pread(fd, buf, sizeof(buf) - 1, 0)) < 0) {
+        return -1;
+    }
+    buf[len] = '\0';
+    if (conv && mrb_cgroup_v2_to_v1(conv, buf, sizeof(buf)) <= 0) {
+        return -1;
+    }
+
+    return strtoll(buf, NULL, 10);
+}
+
+// sums the "major:minor Read|Write bytes" lines of blkio.throttle.io_service_bytes (or io.stat converted)
+static int mrb_cgroup_measure_read_io(int fd, const mrb_cgroup_v2_key *conv, int64_t *rd, int64_t *wr)
+{
+    char buf[LIVE_BUF_SIZE], op[8], *line, *save = NULL;
+    long long val;
+    ssize_t len;
+
+    *rd = *wr = 0;
+    if (fd < 0 || (len = pread(fd, buf, sizeof(buf) - 1, 0)) < 0) {
+        *rd = *wr = -1;
+        return -1;
+    }
+    buf[len] = '\0';
+    if (conv && mrb_cgroup_v2_to_v1(conv, buf, sizeof(buf)) < 0) {
+        *rd = *wr = -1;
+        return -1;
+    }
+    for (line = strtok_r(buf, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+        // the closing "Total n" of v1 has no device
+        if (sscanf(line, "%*s %7s %lld", op, &val) != 2) {
+            continue;
+        }
+        if (!strcmp(op, "Read")) {
+            *rd += val;
+        } else if (!strcmp(op, "Write")) {
+            *wr += val;
+        }
+    }
+
+    return 0;
+}
+
+// the group path of controller in /proc/thread-self/cgroup ("0::/path" on v2), NULL when not found
+static const char *mrb_cgroup_measure_find(char *buf, const char *controller, int v2)
+{
+    char *line, *save = NULL, *ctrls, *path, *c, *csave;
+
+    for (line = strtok_r(buf, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+        if ((ctrls = strchr(line, ':')) == NULL || (path = strchr(++ctrls, ':')) == NULL) {
+            continue;
+        }
+        *path++ = '\0';
+        if (v2) {
+            if (*ctrls == '\0') {
+                return path;
+            }
+            continue;
+        }
+        for (c = strtok_r(ctrls, ",", &csave); c; c = strtok_r(NULL, ",", &csave)) {
+            if (!strcmp(c, controller)) {
+                return path;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+// the state object of the calling thread, kept in Cgroup and in every measurement it started
+static mrb_value mrb_cgroup_measure_setup(mrb_state *mrb, const char *group)
+{
+    mrb_value cgroup = mrb_obj_value(mrb_module_get(mrb, "Cgroup"));
+    mrb_sym sym = mrb_intern_lit(mrb, "mrb_cgroup_measure");
+    mrb_value obj = mrb_iv_get(mrb, cgroup, sym);
+    mrb_cgroup_measure_state *st = NULL;
+    mrb_cgroup_measure_hier *h;
+    char name[FILENAME_MAX], root[FILENAME_MAX], dir[FILENAME_MAX];
+    const mrb_cgroup_v2_key *conv;
+    int v2 = mrb_cgroup_unified(mrb), fake = mrb_cgroup_fake(mrb), i, j;
+    size_t len, parent;
+
+    // "/name" without trailing slashes, as /proc/thread-self/cgroup shows it
+    snprintf(name, sizeof(name), "/%s", group + strspn(group, "/"));
+    for (len = strlen(name); len > 1 && name[len - 1] == '/'; len--) {
+        name[len - 1] = '\0';
+    }
+    if (len == 1) {
+        mrb_raise(mrb, E_ARGUMENT_ERROR, "the root can not be the scratch group");
+    }
+    parent = len;
+    snprintf(name + len, sizeof(name) - len, "/%d-%d", (int)getpid(), (int)syscall(SYS_gettid));
+    if (mrb_cgroup_controller_path(mrb, mrb_cgroup_measure_controllers[0], "/", root, sizeof(root)) < 0) {
+        mrb_sys_fail(mrb, mrb_cgroup_measure_controllers[0]);
+    }
+    for (len = strlen(root); len > 1 && root[len - 1] == '/'; len--) {
+        root[len - 1] = '\0';
+    }
+    if (!mrb_nil_p(obj)) {
+        st = (mrb_cgroup_measure_state *)mrb_data_get_ptr(mrb, obj, &mrb_cgroup_measure_state_type);
+    }
+    if (st && st->group && !strcmp(st->group, name) && !strcmp(st->hiers[0].root, root)) {
+        return obj;
+    }
+
+    st = (mrb_cgroup_measure_state *)mrb_calloc(mrb, 1, sizeof(mrb_cgroup_measure_state));
+    st->usage_fd = st->peak_fd = st->io_fd = st->self_fd = -1;
+    st->pid = getpid();
+    st->fake = fake;
+    // the old state goes with its object, once no measurement holds it
+    obj = mrb_obj_value(Data_Wrap_Struct(mrb, mrb->object_class, &mrb_cgroup_measure_state_type, (void *)st));
+    mrb_iv_set(mrb, cgroup, sym, obj);
+
+    for (i = 0; i < MEASURE_HIERS_SIZE; i++) {
+        if (mrb_cgroup_controller_path(mrb, mrb_cgroup_measure_controllers[i], "/", root, sizeof(root)) < 0) {
+            continue;
+        }
+        for (len = strlen(root); len > 1 && root[len - 1] == '/'; len--) {
+            root[len - 1] = '\0';
+        }
+        for (j = 0; j < st->nhiers && strcmp(st->hiers[j].root, root); j++) {
+        }
+        if (j < st->nhiers) {
+            continue;
+        }
+        // the controllers are enabled down to the scratch group, the group of the thread takes processes
+        snprintf(dir, sizeof(dir), "%s%.*s", (len > 1) ? root : "", (int)parent, name);
+        if (mrb_cgroup_mkdir_tree(dir, len, v2 ? "+cpu +memory +io" : NULL, fake) < 0) {
+            mrb_sys_fail(mrb, dir);
+        }
+        snprintf(dir, sizeof(dir), "%s%s", (len > 1) ? root : "", name);
+        if (mrb_cgroup_mkdir_one(dir, fake) < 0) {
+            mrb_sys_fail(mrb, dir);
+        }
+        h = &st->hiers[st->nhiers++];
+        h->controller = mrb_cgroup_measure_controllers[i];
+        h->root = strdup(root);
+        h->dir = strdup(dir);
+        h->orig_fd = -1;
+        snprintf(dir + strlen(dir), sizeof(dir) - strlen(dir), "/%s", v2 ? "cgroup.procs" : "tasks");
+        if ((h->attach_fd = open(dir, O_WRONLY | O_CLOEXEC)) < 0) {
+            mrb_sys_fail(mrb, dir);
+        }
+    }
+
+    st->usage_fd = mrb_cgroup_measure_open(mrb, name, "cpuacct.usage", O_RDONLY, &st->usage_conv);
+    // the peak is reset by a write, memory.peak before 6.12 is read only and keeps the lifetime peak
+    st->peak_fd = mrb_cgroup_measure_open(mrb, name, "memory.max_usage_in_bytes", O_RDWR, &conv);
+    if (st->peak_fd < 0) {
+        st->peak_fd = mrb_cgroup_measure_open(mrb, name, "memory.max_usage_in_bytes", O_RDONLY, &conv);
+    }
+    st->peak_conv = conv;
+    st->io_fd = mrb_cgroup_measure_open(mrb, name, "blkio.throttle.io_service_bytes", O_RDONLY, &st->io_conv);
+    // a state that failed half way is never reused
+    st->group = strdup(name);
+
+    return obj;
+}
+
+// number of threads of the process, -1 when unknown
+static int mrb_cgroup_measure_threads(void)
+{
+    char buf[LIVE_BUF_SIZE], *p;
+    ssize_t len;
+    int fd, n = -1;
+
+    if ((fd = open("/proc/self/status", O_RDONLY | O_CLOEXEC)) < 0) {
+        return -1;
+    }
+    len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len < 0) {
+        return -1;
+    }
+    buf[len] = '\0';
+    if ((p = strstr(buf, "\nThreads:")) == NULL || sscanf(p + 9, "%d", &n) != 1) {
+        return -1;
+    }
+
+    return n;
+}
+
+// looks up where the calling thread is in every hierarchy, sets the bits of those not in the scratch group
+static unsigned mrb_cgroup_measure_locate(mrb_cgroup_measure_state *st, int v2)
+{
+    char buf[LIVE_BUF_SIZE], copy[LIVE_BUF_SIZE], path[FILENAME_MAX];
+    mrb_cgroup_measure_hier *h;
+    const char *orig;
+    pid_t tid = (pid_t)syscall(SYS_gettid);
+    unsigned moved = 0;
+    ssize_t len;
+    int i;
+
+    // thread-self is resolved at open, the fd follows the thread that opened it
+    if (st->self_fd < 0 || st->tid != tid) {
+        mrb_cgroup_measure_close(&st->self_fd);
+        if ((st->self_fd = open("/proc/thread-self/cgroup", O_RDONLY | O_CLOEXEC)) < 0) {
+            st->self_fd = open("/proc/self/cgroup", O_RDONLY | O_CLOEXEC);
+        }
+        st->tid = tid;
+    }
+    if (st->self_fd < 0 || (len = pread(st->self_fd, buf, sizeof(buf) - 1, 0)) < 0) {
+        len = 0;
+    }
+    buf[len] = '\0';
+
+    for (i = 0; i < st->nhiers; i++) {
+        h = &st->hiers[i];
+        memcpy(copy, buf, len + 1);
+        if ((orig = mrb_cgroup_measure_find(copy, h->controller, v2)) == NULL) {
+            // not a real hierarchy (a fake root), attached and left there
+            moved |= 1u << i;
+            mrb_cgroup_measure_close(&h->orig_fd);
+            continue;
+        }
+        if (!strcmp(orig, st->group)) {
+            continue;
+        }
+        moved |= 1u << i;
+        if (h->orig && !strcmp(h->orig, orig)) {
+            continue;
+        }
+        mrb_cgroup_measure_close(&h->orig_fd);
+        free(h->orig);
+        h->orig = strdup(orig);
+        snprintf(path, sizeof(path), "%s%s/%s", (strlen(h->root) > 1) ? h->root : "",
+                 (strlen(orig) > 1) ? orig : "", v2 ? "cgroup.procs" : "tasks");
+        h->orig_fd = open(path, O_WRONLY | O_CLOEXEC);
+    }
+
+    return moved;
+}
+
+// writes "0", the calling thread (the process on v2, see mrb_cgroup_measurement_start), into every fd of moved
+static int mrb_cgroup_measure_move(mrb_cgroup_measure_state *st, unsigned moved, int attach)
+{
+    int i, fd, ret = 0;
+
+    for (i = 0; i < st->nhiers; i++) {
+        fd = attach ? st->hiers[i].attach_fd : st->hiers[i].orig_fd;
+        if ((moved & (1u << i)) && fd >= 0 && pwrite(fd, "0", 1, 0) < 0) {
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+// Cgroup::Measurement.start(group = "/mruby-measure") => measurement
+//   moves the calling thread into its scratch group under group and takes the first snapshot, a thread already
+//   there (a nested measure) is left as is and the peak is not reset; cgroup.procs of v2 moves the whole process,
+//   which is refused while the process has other threads
+static mrb_value mrb_cgroup_measurement_start(mrb_state *mrb, mrb_value self)
+{
+    char *group = MEASURE_GROUP;
+    mrb_cgroup_measure_state *st;
+    mrb_cgroup_measurement *m;
+    mrb_value obj, state;
+    int v2 = mrb_cgroup_unified(mrb), i, err, n;
+    mrb_get_args(mrb, "|z", &group);
+
+    state = mrb_cgroup_measure_setup(mrb, group);
+    st = (mrb_cgroup_measure_state *)DATA_PTR(state);
+    m = (mrb_cgroup_measurement *)mrb_calloc(mrb, 1, sizeof(mrb_cgroup_measurement));
+    obj = mrb_obj_value(Data_Wrap_Struct(mrb, mrb_class_ptr(self), &mrb_cgroup_measurement_type, (void *)m));
+    m->wall = m->cpu = m->peak = m->read = m->write = -1;
+    m->finished = 1;
+    mrb_iv_set(mrb, obj, mrb_intern_lit(mrb, "state"), state);
+
+    m->start = mrb_cgroup_measure_now();
+    m->moved = mrb_cgroup_measure_locate(st, v2);
+    if (v2 && !st->fake && m->moved && (n = mrb_cgroup_measure_threads()) > 1) {
+        mrb_raisef(mrb, E_RUNTIME_ERROR, "Cgroup.measure moves the whole process on cgroup v2, %S threads running",
+                   mrb_fixnum_value(n));
+    }
+    m->finished = 0;
+    for (i = 0; i < st->nhiers; i++) {
+        if ((m->moved & (1u << i)) && pwrite(st->hiers[i].attach_fd, "0", 1, 0) < 0) {
+            err = errno;
+            mrb_cgroup_measure_move(st, m->moved & ((1u << i) - 1), 0);
+            m->finished = 1;
+            errno = err;
+            mrb_sys_fail(mrb, st->group);
+        }
+    }
+    if (m->moved && st->peak_fd >= 0 && pwrite(st->peak_fd, "0", 1, 0) < 0) {
+    }
+    m->cpu0 = mrb_cgroup_measure_read(st->usage_fd, st->usage_conv);
+    mrb_cgroup_measure_read_io(st->io_fd, st->io_conv, &m->read0, &m->write0);
+
+    return obj;
+}
+
+static mrb_cgroup_measurement *mrb_cgroup_get_measurement(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_measurement *m = (mrb_cgroup_measurement *)mrb_data_get_ptr(mrb, self, &mrb_cgroup_measurement_type);
+
+    if (m == NULL) {
+        mrb_raise(mrb, E_RUNTIME_ERROR, "get measurement failed");
+    }
+
+    return m;
+}
+
+// Cgroup::Measurement#finish => self
+//   takes the second snapshot and moves the thread back, a second call does nothing
+static mrb_value mrb_cgroup_measurement_finish(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_measurement *m = mrb_cgroup_get_measurement(mrb, self);
+    mrb_value obj = mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "state"));
+    mrb_cgroup_measure_state *st;
+    int64_t cpu, rd, wr;
+
+    if (m->finished) {
+        return self;
+    }
+    m->finished = 1;
+    st = (mrb_cgroup_measure_state *)mrb_data_get_ptr(mrb, obj, &mrb_cgroup_measure_state_type);
+    if (st == NULL) {
+        mrb_raise(mrb, E_RUNTIME_ERROR, "get measure state failed");
+    }
+
+    cpu = mrb_cgroup_measure_read(st->usage_fd, st->usage_conv);
+    m->peak = mrb_cgroup_measure_read(st->peak_fd, st->peak_conv);
+    mrb_cgroup_measure_read_io(st->io_fd, st->io_conv, &rd, &wr);
+    if (mrb_cgroup_measure_move(st, m->moved, 0) < 0) {
+        mrb_sys_fail(mrb, "restore");
+    }
+    m->wall = mrb_cgroup_measure_now() - m->start;
+    m->cpu = (cpu < 0 || m->cpu0 < 0) ? -1 : cpu - m->cpu0;
+    m->read = (rd < 0 || m->read0 < 0) ? -1 : rd - m->read0;
+    m->write = (wr < 0 || m->write0 < 0) ? -1 : wr - m->write0;
+
+    return self;
+}
+
+static mrb_value mrb_cgroup_measurement_value(int64_t val)
+{
+    return (val < 0) ? mrb_nil_value() : mrb_fixnum_value(val);
+}
+
+static mrb_value mrb_cgroup_measurement_wall_usec(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_measurement *m = mrb_cgroup_get_measurement(mrb, self);
+
+    return mrb_cgroup_measurement_value((m->wall < 0) ? -1 : m->wall / 1000);
+}
+
+static mrb_value mrb_cgroup_measurement_cpu_usec(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_measurement *m = mrb_cgroup_get_measurement(mrb, self);
+
+    return mrb_cgroup_measurement_value((m->cpu < 0) ? -1 : m->cpu / 1000);
+}
+
+static mrb_value mrb_cgroup_measurement_memory_peak(mrb_state *mrb, mrb_value self)
+{
+    return mrb_cgroup_measurement_value(mrb_cgroup_get_measurement(mrb, self)->peak);
+}
+
+static mrb_value mrb_cgroup_measurement_read_bytes(mrb_state *mrb, mrb_value self)
+{
+    return mrb_cgroup_measurement_value(mrb_cgroup_get_measurement(mrb, self)->read);
+}
+
+static mrb_value mrb_cgroup_measurement_write_bytes(mrb_state *mrb, mrb_value self)
+{
+    return mrb_cgroup_measurement_value(mrb_cgroup_get_measurement(mrb, self)->write);
+}
+
+static mrb_value mrb_cgroup_measurement_to_h(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_measurement *m = mrb_cgroup_get_measurement(mrb, self);
+    mrb_value hash = mrb_hash_new(mrb);
+
+    mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern_lit(mrb, "wall_usec")),
+                 mrb_cgroup_measurement_value((m->wall < 0) ? -1 : m->wall / 1000));
+    mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern_lit(mrb, "cpu_usec")),
+                 mrb_cgroup_measurement_value((m->cpu < 0) ? -1 : m->cpu / 1000));
+    mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern_lit(mrb, "memory_peak")),
+                 mrb_cgroup_measurement_value(m->peak));
+    mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern_lit(mrb, "read_bytes")), mrb_cgroup_measurement_value(m->read));
+    mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern_lit(mrb, "write_bytes")),
+                 mrb_cgroup_measurement_value(m->write));
+
+    return hash;
+}
+
+void mrb_cgroup_measure_init(mrb_state *mrb, struct RClass *cgroup)
+{
+    struct RClass *measurement;
+
+    measurement = mrb_define_class_under(mrb, cgroup, "Measurement", mrb->object_class);
+    MRB_SET_INSTANCE_TT(measurement, MRB_TT_DATA);
+    mrb_define_class_method(mrb, measurement, "start", mrb_cgroup_measurement_start, MRB_ARGS_OPT(1));
+    mrb_define_method(mrb, measurement, "finish", mrb_cgroup_measurement_finish, MRB_ARGS_NONE());
+    mrb_define_method(mrb, measurement, "wall_usec", mrb_cgroup_measurement_wall_usec, MRB_ARGS_NONE());
+    mrb_define_method(mrb, measurement, "cpu_usec", mrb_cgroup_measurement_cpu_usec, MRB_ARGS_NONE());
+    mrb_define_method(mrb, measurement, "memory_peak", mrb_cgroup_measurement_memory_peak, MRB_ARGS_NONE());
+    mrb_define_method(mrb, measurement, "read_bytes", mrb_cgroup_measurement_read_bytes, MRB_ARGS_NONE());
+    mrb_define_method(mrb, measurement, "write_bytes", mrb_cgroup_measurement_write_bytes, MRB_ARGS_NONE());
+    mrb_define_method(mrb, measurement, "to_h", mrb_cgroup_measurement_to_h, MRB_ARGS_NONE());
+    DONE;
+}
@@ -0,0 +1,172 @@
+/*
+** mrb_cgroup_metrics - operation counters and latency histograms for mruby-cgroup
+**
+** See Copyright Notice in mrb_cgroup.c
+*/
+
+#include <stdint.h>
+#include <time.h>
+
+#include "mruby.h"
+#include "mruby/array.h"
+#include "mruby/error.h"
+#include "mruby/hash.h"
+
+#include "mrb_cgroup.h"
+
+#define DONE mrb_gc_arena_restore(mrb, 0);
+// bucket 0 counts calls under 1 usec, bucket i (i > 0) calls of 2**(i-1) up to 2**i usec, the last one the rest
+#define METRICS_BUCKETS 24
+// operations of a thread running inside each other (a block or to_s calling another method), deeper ones
+// are not timed
+#define METRICS_DEPTH 8
+
+static const char *mrb_cgroup_op_names[MRB_CGROUP_OP_SIZE] = {"init", "get", "set", "create", "delete", "attach"};
+
+// process wide, shared by every mrb_state and updated with relaxed atomics
+typedef struct {
+    uint64_t calls;
+    uint64_t errors;
+    uint64_t syscalls;
+    uint64_t nsec;
+    uint64_t buckets[METRICS_BUCKETS];
+} mrb_cgroup_metric;
+
+static mrb_cgroup_metric mrb_cgroup_metrics[MRB_CGROUP_OP_SIZE];
+
+__thread unsigned mrb_cgroup_syscalls;
+
+// the operations of this thread between begin and end, innermost last
+static __thread struct {
+    int op;
+    int error;
+    int64_t start;
+    unsigned syscalls;
+} mrb_cgroup_metrics_cur[METRICS_DEPTH];
+static __thread int mrb_cgroup_metrics_depth;
+
+#define METRICS_ADD(field, n) __atomic_fetch_add(&(field), (n), __ATOMIC_RELAXED)
+
+static int64_t mrb_cgroup_metrics_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void mrb_cgroup_metrics_begin(mrb_cgroup_op_t op)
+{
+    int d = mrb_cgroup_metrics_depth++;
+
+    if (d < METRICS_DEPTH) {
+        mrb_cgroup_metrics_cur[d].op = op;
+        mrb_cgroup_metrics_cur[d].error = 0;
+        mrb_cgroup_metrics_cur[d].syscalls = mrb_cgroup_syscalls;
+        mrb_cgroup_metrics_cur[d].start = mrb_cgroup_metrics_now();
+    }
+}
+
+// the latency and syscalls of an operation include those of the operations inside it
+static void mrb_cgroup_metrics_end(int error)
+{
+    mrb_cgroup_metric *m;
+    uint64_t nsec, usec;
+    int bucket, d = --mrb_cgroup_metrics_depth;
+
+    if (d >= METRICS_DEPTH) {
+        return;
+    }
+    nsec = mrb_cgroup_metrics_now() - mrb_cgroup_metrics_cur[d].start;
+    m = &mrb_cgroup_metrics[mrb_cgroup_metrics_cur[d].op];
+
+    usec = nsec / 1000;
+    bucket = usec ? 64 - __builtin_clzll(usec) : 0;
+    METRICS_ADD(m->calls, 1);
+    if (error || mrb_cgroup_metrics_cur[d].error) {
+        METRICS_ADD(m->errors, 1);
+    }
+    METRICS_ADD(m->syscalls, mrb_cgroup_syscalls - mrb_cgroup_metrics_cur[d].syscalls);
+    METRICS_ADD(m->nsec, nsec);
+    METRICS_ADD(m->buckets[(bucket < METRICS_BUCKETS) ? bucket : METRICS_BUCKETS - 1], 1);
+}
+
+mrb_value mrb_cgroup_metrics_run(mrb_state *mrb, mrb_cgroup_op_t op, mrb_func_t body, mrb_value self)
+{
+    mrb_value ret;
+    mrb_bool raised;
+
+    mrb_cgroup_metrics_begin(op);
+    ret = mrb_protect(mrb, body, self, &raised);
+    mrb_cgroup_metrics_end(raised);
+    if (raised) {
+        mrb_exc_raise(mrb, ret);
+    }
+
+    return ret;
+}
+
+void mrb_cgroup_metrics_fail(void)
+{
+    int d = mrb_cgroup_metrics_depth - 1;
+
+    if (d >= 0 && d < METRICS_DEPTH) {
+        mrb_cgroup_metrics_cur[d].error = 1;
+    }
+}
+
+// Cgroup.metrics => {:get=>{:calls=>, :errors=>, :syscalls=>, :total_usec=>, :histogram=>[...]}, ...}
+static mrb_value mrb_cgroup_metrics_get(mrb_state *mrb, mrb_value self)
+{
+    mrb_value result = mrb_hash_new(mrb), op, histogram;
+    mrb_cgroup_metric *m;
+    int i, j, ai;
+
+    ai = mrb_gc_arena_save(mrb);
+    for (i = 0; i < MRB_CGROUP_OP_SIZE; i++) {
+        m = &mrb_cgroup_metrics[i];
+        op = mrb_hash_new(mrb);
+        mrb_hash_set(mrb, op, mrb_symbol_value(mrb_intern_lit(mrb, "calls")),
+                     mrb_fixnum_value(__atomic_load_n(&m->calls, __ATOMIC_RELAXED)));
+        mrb_hash_set(mrb, op, mrb_symbol_value(mrb_intern_lit(mrb, "errors")),
+                     mrb_fixnum_value(__atomic_load_n(&m->errors, __ATOMIC_RELAXED)));
+        mrb_hash_set(mrb, op, mrb_symbol_value(mrb_intern_lit(mrb, "syscalls")),
+                     mrb_fixnum_value(__atomic_load_n(&m->syscalls, __ATOMIC_RELAXED)));
+        mrb_hash_set(mrb, op, mrb_symbol_value(mrb_intern_lit(mrb, "total_usec")),
+                     mrb_fixnum_value(__atomic_load_n(&m->nsec, __ATOMIC_RELAXED) / 1000));
+        histogram = mrb_ary_new_capa(mrb, METRICS_BUCKETS);
+        for (j = 0; j < METRICS_BUCKETS; j++) {
+            mrb_ary_push(mrb, histogram, mrb_fixnum_value(__atomic_load_n(&m->buckets[j], __ATOMIC_RELAXED)));
+        }
+        mrb_hash_set(mrb, op, mrb_symbol_value(mrb_intern_lit(mrb, "histogram")), histogram);
+        mrb_hash_set(mrb, result, mrb_symbol_value(mrb_intern_cstr(mrb, mrb_cgroup_op_names[i])), op);
+        mrb_gc_arena_restore(mrb, ai);
+    }
+
+    return result;
+}
+
+// Cgroup.reset_metrics, counts of other threads running at the same time may be partly kept
+static mrb_value mrb_cgroup_metrics_reset(mrb_state *mrb, mrb_value self)
+{
+    int i, j;
+
+    for (i = 0; i < MRB_CGROUP_OP_SIZE; i++) {
+        __atomic_store_n(&mrb_cgroup_metrics[i].calls, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&mrb_cgroup_metrics[i].errors, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&mrb_cgroup_metrics[i].syscalls, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&mrb_cgroup_metrics[i].nsec, 0, __ATOMIC_RELAXED);
+        for (j = 0; j < METRICS_BUCKETS; j++) {
+            __atomic_store_n(&mrb_cgroup_metrics[i].buckets[j], 0, __ATOMIC_RELAXED);
+        }
+    }
+
+    return mrb_nil_value();
+}
+
+void mrb_cgroup_metrics_init(mrb_state *mrb, struct RClass *cgroup)
+{
+    mrb_define_class_method(mrb, cgroup, "metrics", mrb_cgroup_metrics_get, MRB_ARGS_NONE());
+    mrb_define_class_method(mrb, cgroup, "reset_metrics", mrb_cgroup_metrics_reset, MRB_ARGS_NONE());
+    DONE;
+}
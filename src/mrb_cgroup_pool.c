@@ -0,0 +1,654 @@
+/*
+** mrb_cgroup_pool - pre-created groups leased per request for mruby-cgroup
+**
+** See Copyright Notice in mrb_cgroup.c
+*/
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mruby.h"
+#include "mruby/array.h"
+#include "mruby/class.h"
+#include "mruby/data.h"
+#include "mruby/hash.h"
+#include "mruby/string.h"
+#include "mruby/variable.h"
+
+#include "mrb_cgroup.h"
+
+#define DONE mrb_gc_arena_restore(mrb, 0);
+#define POOL_DIRS_SIZE 8
+// the background thread also wakes up on its own, in case a lease ran it dry without signaling
+#define POOL_INTERVAL_SEC 1
+// ids skipped in a row because their group exists, before making one gives up
+#define POOL_MKDIR_TRIES 1024
+
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int running;
+    int stop;
+    // set by close, lease and release raise
+    int closed;
+
+    // fixed at new: the directory of the prefix in every hierarchy (one on v2) and the hierarchy roots
+    // tasks are moved back to
+    int fake, v2;
+    int ndirs;
+    char *dirs[POOL_DIRS_SIZE];
+    char *roots[POOL_DIRS_SIZE];
+    // dirs held from Cgroup::Reaper, see mrb_cgroup_registry_hold
+    int nheld;
+    int min_idle, max_idle;
+
+    // under the lock: numbers of the groups ready to lease, "<prefix>/<n>"
+    unsigned *idle;
+    int nidle, capa;
+    unsigned next;
+    int nleased;
+    int64_t created, removed;
+    int error;
+} mrb_cgroup_pool;
+
+static int mrb_cgroup_pool_rmdir(mrb_cgroup_pool *p, unsigned id, int ndirs)
+{
+    char path[FILENAME_MAX];
+    int i, ret = 0;
+
+    for (i = 0; i < ndirs; i++) {
+        snprintf(path, sizeof(path), "%s/%u", p->dirs[i], id);
+        if (mrb_cgroup_rmdir_one(path, p->fake) < 0 && errno != ENOENT) {
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+// called without the lock, touches only the fixed fields
+static int mrb_cgroup_pool_mkdir(mrb_cgroup_pool *p, unsigned id)
+{
+    char path[FILENAME_MAX];
+    int i, err;
+
+    for (i = 0; i < p->ndirs; i++) {
+        snprintf(path, sizeof(path), "%s/%u", p->dirs[i], id);
+        // an existing group belongs to another pool on the prefix, or has tasks of a previous process
+        if (mrb_cgroup_mkdir_excl(path, p->fake) < 0) {
+            err = errno;
+            mrb_cgroup_pool_rmdir(p, id, i);
+            errno = err;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// takes the next free id and makes its group, called without the lock
+static int mrb_cgroup_pool_make(mrb_cgroup_pool *p, unsigned *id)
+{
+    int tries, ret = -1;
+
+    for (tries = 0; tries < POOL_MKDIR_TRIES; tries++) {
+        pthread_mutex_lock(&p->lock);
+        *id = p->next++;
+        pthread_mutex_unlock(&p->lock);
+        if ((ret = mrb_cgroup_pool_mkdir(p, *id)) == 0 || errno != EEXIST) {
+            break;
+        }
+    }
+
+    return ret;
+}
+
+// with the lock held
+static int mrb_cgroup_pool_push(mrb_cgroup_pool *p, unsigned id)
+{
+    unsigned *idle;
+
+    if (p->nidle == p->capa) {
+        if ((idle = (unsigned *)realloc(p->idle, (p->capa * 2 + 16) * sizeof(unsigned))) == NULL) {
+            return -1;
+        }
+        p->idle = idle;
+        p->capa = p->capa * 2 + 16;
+    }
+    p->idle[p->nidle++] = id;
+
+    return 0;
+}
+
+// keeps min_idle..max_idle groups ready, the directories are made and removed with the lock released
+static void *mrb_cgroup_pool_main(void *arg)
+{
+    mrb_cgroup_pool *p = arg;
+    struct timespec deadline;
+    unsigned id;
+    int ret;
+
+    pthread_mutex_lock(&p->lock);
+    while (!p->stop) {
+        while (!p->stop && p->nidle < p->min_idle) {
+            pthread_mutex_unlock(&p->lock);
+            ret = mrb_cgroup_pool_make(p, &id);
+            pthread_mutex_lock(&p->lock);
+            p->error = (ret < 0) ? errno : 0;
+            if (ret < 0) {
+                break;
+            }
+            if (mrb_cgroup_pool_push(p, id) < 0) {
+                pthread_mutex_unlock(&p->lock);
+                mrb_cgroup_pool_rmdir(p, id, p->ndirs);
+                pthread_mutex_lock(&p->lock);
+                break;
+            }
+            p->created++;
+        }
+        while (!p->stop && p->nidle > p->max_idle) {
+            id = p->idle[--p->nidle];
+            pthread_mutex_unlock(&p->lock);
+            ret = mrb_cgroup_pool_rmdir(p, id, p->ndirs);
+            pthread_mutex_lock(&p->lock);
+            p->error = (ret < 0) ? errno : 0;
+            p->removed++;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += POOL_INTERVAL_SEC;
+        if (!p->stop) {
+            pthread_cond_timedwait(&p->wake, &p->lock, &deadline);
+        }
+    }
+    pthread_mutex_unlock(&p->lock);
+
+    return NULL;
+}
+
+static void mrb_cgroup_pool_stop(mrb_cgroup_pool *p)
+{
+    if (!p->running) {
+        return;
+    }
+    pthread_mutex_lock(&p->lock);
+    p->stop = 1;
+    pthread_cond_signal(&p->wake);
+    pthread_mutex_unlock(&p->lock);
+    pthread_join(p->thread, NULL);
+    p->running = 0;
+}
+
+// with the thread stopped
+static void mrb_cgroup_pool_drop_idle(mrb_cgroup_pool *p)
+{
+    while (p->nidle > 0) {
+        mrb_cgroup_pool_rmdir(p, p->idle[--p->nidle], p->ndirs);
+        p->removed++;
+    }
+}
+
+// a pool collected without close removes its idle groups as well
+static void mrb_cgroup_pool_free(mrb_state *mrb, void *ptr)
+{
+    mrb_cgroup_pool *p = ptr;
+    int i;
+
+    mrb_cgroup_pool_stop(p);
+    mrb_cgroup_pool_drop_idle(p);
+    for (i = 0; i < p->nheld; i++) {
+        mrb_cgroup_registry_unhold(p->dirs[i]);
+    }
+    for (i = 0; i < p->ndirs; i++) {
+        free(p->dirs[i]);
+        free(p->roots[i]);
+    }
+    free(p->idle);
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->wake);
+    mrb_free(mrb, p);
+}
+
+static const struct mrb_data_type mrb_cgroup_pool_type = {
+    "mrb_cgroup_pool", mrb_cgroup_pool_free,
+};
+
+static mrb_cgroup_pool *mrb_cgroup_get_pool(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_pool *p = (mrb_cgroup_pool *)mrb_data_get_ptr(mrb, self, &mrb_cgroup_pool_type);
+
+    if (!p)
+        mrb_raise(mrb, E_RUNTIME_ERROR, "get mrb_cgroup_pool failed");
+
+    return p;
+}
+
+static mrb_cgroup_pool *mrb_cgroup_get_open_pool(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_pool *p = mrb_cgroup_get_pool(mrb, self);
+
+    if (p->closed)
+        mrb_raise(mrb, E_RUNTIME_ERROR, "Cgroup::Pool is closed");
+
+    return p;
+}
+
+static mrb_value mrb_cgroup_pool_opt(mrb_state *mrb, mrb_value opts, const char *name, mrb_value def)
+{
+    mrb_value val;
+
+    if (mrb_nil_p(opts)) {
+        return def;
+    }
+    val = mrb_hash_get(mrb, opts, mrb_symbol_value(mrb_intern_cstr(mrb, name)));
+
+    return mrb_nil_p(val) ? def : val;
+}
+
+// Cgroup::Pool.new(prefix, controllers, min_idle: 4, max_idle: 16, limits: {})
+static mrb_value mrb_cgroup_pool_initialize(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_pool *p = (mrb_cgroup_pool *)DATA_PTR(self);
+    mrb_value args, controllers, opts = mrb_nil_value(), limits;
+    char path[FILENAME_MAX], ctrl[128];
+    const char *prefix, *name;
+    size_t clen = 0, len, top;
+    mrb_int i;
+    int j;
+    mrb_get_args(mrb, "zA|H", &prefix, &args, &opts);
+
+    if (RARRAY_LEN(args) == 0 || RARRAY_LEN(args) > POOL_DIRS_SIZE) {
+        mrb_raise(mrb, E_ARGUMENT_ERROR, "controllers out of range");
+    }
+    // the strings of the controllers, the caller's array is left as it is
+    controllers = mrb_ary_new_capa(mrb, RARRAY_LEN(args));
+    for (i = 0; i < RARRAY_LEN(args); i++) {
+        mrb_ary_push(mrb, controllers, mrb_str_to_str(mrb, mrb_ary_ref(mrb, args, i)));
+        if (mrb_cgroup_v2_controller(RSTRING_PTR(mrb_ary_ref(mrb, controllers, i))) == NULL) {
+            mrb_raisef(mrb, E_ARGUMENT_ERROR, "unknown controller %S", mrb_ary_ref(mrb, controllers, i));
+        }
+    }
+    limits = mrb_cgroup_pool_opt(mrb, opts, "limits", mrb_hash_new(mrb));
+    if (!mrb_hash_p(limits)) {
+        mrb_raise(mrb, E_TYPE_ERROR, "limits must be a Hash");
+    }
+
+    if (p) {
+        mrb_cgroup_pool_free(mrb, p);
+    }
+    DATA_TYPE(self) = &mrb_cgroup_pool_type;
+    DATA_PTR(self) = NULL;
+
+    p = (mrb_cgroup_pool *)mrb_calloc(mrb, 1, sizeof(mrb_cgroup_pool));
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->wake, NULL);
+    DATA_PTR(self) = p;
+    p->min_idle = mrb_fixnum(mrb_to_int(mrb, mrb_cgroup_pool_opt(mrb, opts, "min_idle", mrb_fixnum_value(4))));
+    p->max_idle = mrb_fixnum(mrb_to_int(mrb, mrb_cgroup_pool_opt(mrb, opts, "max_idle", mrb_fixnum_value(16))));
+    if (p->min_idle < 0 || p->max_idle < p->min_idle) {
+        mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid min_idle/max_idle");
+    }
+    p->fake = mrb_cgroup_fake(mrb);
+    p->v2 = mrb_cgroup_unified(mrb);
+
+    ctrl[0] = '\0';
+    for (i = 0; i < RARRAY_LEN(controllers); i++) {
+        name = RSTRING_PTR(mrb_ary_ref(mrb, controllers, i));
+        // freezer files are in every v2 group, there is no controller to enable
+        if (*mrb_cgroup_v2_controller(name)) {
+            clen +=
+                snprintf(ctrl + clen, sizeof(ctrl) - clen, "%s+%s", clen ? " " : "", mrb_cgroup_v2_controller(name));
+        }
+        if (mrb_cgroup_controller_path(mrb, name, "/", path, sizeof(path)) < 0) {
+            mrb_sys_fail(mrb, name);
+        }
+        for (top = strlen(path); top > 1 && path[top - 1] == '/'; top--) {
+            path[top - 1] = '\0';
+        }
+        // one directory on v2, and co-mounted v1 controllers share theirs
+        for (j = 0; j < p->ndirs && strcmp(p->roots[j], path); j++) {
+        }
+        if (j < p->ndirs) {
+            continue;
+        }
+        p->roots[p->ndirs] = strdup(path);
+        snprintf(path + top, sizeof(path) - top, "/%s", prefix + strspn(prefix, "/"));
+        for (len = strlen(path); len > top && path[len - 1] == '/'; len--) {
+            path[len - 1] = '\0';
+        }
+        p->dirs[p->ndirs++] = strdup(path);
+    }
+    for (j = 0; j < p->ndirs; j++) {
+        if (mrb_cgroup_mkdir_tree(p->dirs[j], strlen(p->roots[j]), (p->v2 && clen) ? ctrl : NULL, p->fake) < 0) {
+            mrb_sys_fail(mrb, p->dirs[j]);
+        }
+        if (mrb_cgroup_registry_hold(p->dirs[j]) < 0) {
+            mrb_sys_fail(mrb, p->dirs[j]);
+        }
+        p->nheld++;
+    }
+
+    mrb_iv_set(mrb, self, mrb_intern_lit(mrb, "prefix"), mrb_str_new_cstr(mrb, prefix));
+    mrb_iv_set(mrb, self, mrb_intern_lit(mrb, "limits"), limits);
+    // limits written by lease, per group, reset by release
+    mrb_iv_set(mrb, self, mrb_intern_lit(mrb, "leases"), mrb_hash_new(mrb));
+
+    if (pthread_create(&p->thread, NULL, mrb_cgroup_pool_main, p)) {
+        mrb_raise(mrb, E_RUNTIME_ERROR, "pthread_create failed");
+    }
+    p->running = 1;
+
+    return self;
+}
+
+static void mrb_cgroup_pool_name(mrb_state *mrb, mrb_value self, unsigned id, char *name, size_t size)
+{
+    mrb_value prefix = mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "prefix"));
+    const char *s = RSTRING_PTR(prefix);
+    int len = RSTRING_LEN(prefix);
+
+    while (len > 0 && s[len - 1] == '/') {
+        len--;
+    }
+    snprintf(name, size, "%.*s/%u", len, s, id);
+}
+
+// appends every key of limits to writes as key, value strings, numbers as is and anything else through to_s
+static void mrb_cgroup_pool_writes(mrb_state *mrb, mrb_value writes, mrb_value limits)
+{
+    mrb_value keys = mrb_hash_keys(mrb, limits);
+    mrb_int i;
+
+    for (i = 0; i < RARRAY_LEN(keys); i++) {
+        mrb_ary_push(mrb, writes, mrb_str_to_str(mrb, mrb_ary_ref(mrb, keys, i)));
+        mrb_ary_push(mrb, writes, mrb_obj_as_string(mrb, mrb_hash_get(mrb, limits, mrb_ary_ref(mrb, keys, i))));
+    }
+}
+
+// the v1 text of key in group as mrb_cgroup_write_key takes it back, nil when it can not be read or is empty
+static mrb_value mrb_cgroup_pool_read_key(mrb_state *mrb, const char *group, const char *key)
+{
+    const mrb_cgroup_v2_key *conv;
+    char path[FILENAME_MAX], buf[LIVE_BUF_SIZE];
+    ssize_t len;
+    int fd;
+
+    if (mrb_cgroup_key_path(mrb, group, key, path, sizeof(path), &conv) < 0 ||
+        (fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+        return mrb_nil_value();
+    }
+    len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len < 0) {
+        return mrb_nil_value();
+    }
+    buf[len] = '\0';
+    if (conv && (len = mrb_cgroup_v2_to_v1(conv, buf, sizeof(buf))) < 0) {
+        return mrb_nil_value();
+    }
+    while (len > 0 && isspace((unsigned char)buf[len - 1])) {
+        len--;
+    }
+
+    return (len == 0) ? mrb_nil_value() : mrb_str_new(mrb, buf, len);
+}
+
+// lease(limits = {}) => "<prefix>/<n>", with the pool limits and then limits written; a group a write failed
+// on is removed, not leased
+static mrb_value mrb_cgroup_pool_lease(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_pool *p = mrb_cgroup_get_open_pool(mrb, self);
+    mrb_value limits = mrb_nil_value(), group, writes = mrb_ary_new(mrb), saved = mrb_hash_new(mrb), key;
+    char name[FILENAME_MAX];
+    unsigned id = 0;
+    mrb_int i, npool;
+    int empty, err;
+    mrb_get_args(mrb, "|H", &limits);
+
+    // the values are converted before a group is taken, a raising to_s does not lose one
+    mrb_cgroup_pool_writes(mrb, writes, mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "limits")));
+    npool = RARRAY_LEN(writes);
+    if (!mrb_nil_p(limits)) {
+        mrb_cgroup_pool_writes(mrb, writes, limits);
+    }
+
+    pthread_mutex_lock(&p->lock);
+    empty = (p->nidle == 0);
+    if (!empty) {
+        id = p->idle[--p->nidle];
+    }
+    p->nleased++;
+    pthread_cond_signal(&p->wake);
+    pthread_mutex_unlock(&p->lock);
+
+    // ran dry, the thread catches up in the background
+    if (empty && mrb_cgroup_pool_make(p, &id) < 0) {
+        pthread_mutex_lock(&p->lock);
+        p->nleased--;
+        pthread_mutex_unlock(&p->lock);
+        mrb_sys_fail(mrb, "Cgroup::Pool#lease");
+    }
+    if (empty) {
+        pthread_mutex_lock(&p->lock);
+        p->created++;
+        pthread_mutex_unlock(&p->lock);
+    }
+
+    mrb_cgroup_pool_name(mrb, self, id, name, sizeof(name));
+    for (i = 0; i < RARRAY_LEN(writes); i += 2) {
+        // the value a key of this lease had under the pool limits, written back by release
+        if (i >= npool) {
+            key = mrb_ary_ref(mrb, writes, i);
+            if (mrb_nil_p(mrb_hash_get(mrb, saved, key))) {
+                mrb_hash_set(mrb, saved, key, mrb_cgroup_pool_read_key(mrb, name, RSTRING_PTR(key)));
+            }
+        }
+        if (mrb_cgroup_write_key(mrb, name, RSTRING_PTR(mrb_ary_ref(mrb, writes, i)),
+                                 RSTRING_PTR(mrb_ary_ref(mrb, writes, i + 1))) < 0) {
+            err = errno;
+            mrb_cgroup_pool_rmdir(p, id, p->ndirs);
+            pthread_mutex_lock(&p->lock);
+            p->nleased--;
+            p->removed++;
+            pthread_mutex_unlock(&p->lock);
+            errno = err;
+            mrb_sys_fail(mrb, RSTRING_PTR(mrb_ary_ref(mrb, writes, i)));
+        }
+    }
+    group = mrb_str_new_cstr(mrb, name);
+    mrb_hash_set(mrb, mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "leases")), group, saved);
+
+    return group;
+}
+
+// the n of "<prefix>/<n>", raises for a group that is not leased from this pool
+static unsigned mrb_cgroup_pool_id(mrb_state *mrb, mrb_value self, mrb_value group)
+{
+    mrb_value leases = mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "leases"));
+    const char *s;
+
+    if (mrb_nil_p(mrb_hash_get(mrb, leases, group)) || (s = strrchr(RSTRING_PTR(group), '/')) == NULL) {
+        mrb_raisef(mrb, E_ARGUMENT_ERROR, "%S is not leased from this pool", group);
+    }
+
+    return (unsigned)strtoul(s + 1, NULL, 10);
+}
+
+// attach(group, pid = self): one write per hierarchy, a single one on v2
+static mrb_value mrb_cgroup_pool_attach(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_pool *p = mrb_cgroup_get_pool(mrb, self);
+    char path[FILENAME_MAX], buf[32];
+    mrb_value group;
+    mrb_int pid = 0;
+    unsigned id;
+    int i, fd, len;
+    mrb_get_args(mrb, "S|i", &group, &pid);
+
+    id = mrb_cgroup_pool_id(mrb, self, group);
+    len = snprintf(buf, sizeof(buf), "%lld", (long long)(pid ? pid : getpid()));
+    for (i = 0; i < p->ndirs; i++) {
+        snprintf(path, sizeof(path), "%s/%u/cgroup.procs", p->dirs[i], id);
+        if ((fd = open(path, O_WRONLY | O_CLOEXEC)) < 0) {
+            mrb_sys_fail(mrb, path);
+        }
+        if (write(fd, buf, len) != len) {
+            close(fd);
+            mrb_sys_fail(mrb, path);
+        }
+        close(fd);
+    }
+
+    return self;
+}
+
+// moves the processes left in the group to the root of each hierarchy
+static void mrb_cgroup_pool_drain(mrb_cgroup_pool *p, unsigned id)
+{
+    char path[FILENAME_MAX], pid[32];
+    FILE *fp;
+    int i, fd;
+
+    for (i = 0; i < p->ndirs; i++) {
+        snprintf(path, sizeof(path), "%s/%u/cgroup.procs", p->dirs[i], id);
+        if ((fp = fopen(path, "r")) == NULL) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/cgroup.procs", p->roots[i]);
+        if ((fd = open(path, O_WRONLY | O_CLOEXEC)) >= 0) {
+            while (fscanf(fp, "%31s", pid) == 1) {
+                // an exiting process can not be moved and does not have to
+                if (write(fd, pid, strlen(pid)) < 0) {
+                }
+            }
+            close(fd);
+        }
+        fclose(fp);
+    }
+}
+
+// v1 counter files of the hierarchies the group was made in, the others are not the pool's to reset
+static void mrb_cgroup_pool_reset(mrb_state *mrb, mrb_cgroup_pool *p, const char *group, const char *key)
+{
+    const mrb_cgroup_v2_key *conv;
+    char path[FILENAME_MAX];
+    int i;
+
+    if (mrb_cgroup_key_path(mrb, group, key, path, sizeof(path), &conv) < 0) {
+        return;
+    }
+    for (i = 0; i < p->ndirs && !mrb_cgroup_path_under(path, p->dirs[i]); i++) {
+    }
+    if (i < p->ndirs) {
+        mrb_cgroup_write_key(mrb, group, key, "0");
+    }
+}
+
+// release(group): processes go back to the root, counters are cleared, the limits written by lease are
+// set back to the values read before and the group is ready for the next lease; a group with a limit that
+// could not be set back is removed instead
+static mrb_value mrb_cgroup_pool_release(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_pool *p = mrb_cgroup_get_open_pool(mrb, self);
+    mrb_value leases = mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "leases"));
+    mrb_value group, leased, keys, val;
+    unsigned id;
+    mrb_int i;
+    int ret, err = 0;
+    mrb_get_args(mrb, "S", &group);
+
+    id = mrb_cgroup_pool_id(mrb, self, group);
+    mrb_cgroup_pool_drain(p, id);
+
+    // counters the v1 kernel lets reset, missing files are fine
+    mrb_cgroup_pool_reset(mrb, p, RSTRING_PTR(group), "cpuacct.usage");
+    mrb_cgroup_pool_reset(mrb, p, RSTRING_PTR(group), "memory.max_usage_in_bytes");
+    leased = mrb_hash_get(mrb, leases, group);
+    keys = mrb_hash_keys(mrb, leased);
+    for (i = 0; i < RARRAY_LEN(keys) && !err; i++) {
+        val = mrb_hash_get(mrb, leased, mrb_ary_ref(mrb, keys, i));
+        if (mrb_nil_p(val)) {
+            err = ENOENT;
+        } else if (mrb_cgroup_write_key(mrb, RSTRING_PTR(group), RSTRING_PTR(mrb_ary_ref(mrb, keys, i)),
+                                        RSTRING_PTR(val)) < 0) {
+            err = errno;
+        }
+    }
+    mrb_hash_delete_key(mrb, leases, group);
+
+    pthread_mutex_lock(&p->lock);
+    p->nleased--;
+    ret = err ? -1 : mrb_cgroup_pool_push(p, id);
+    if (err) {
+        p->error = err;
+        p->removed++;
+    }
+    pthread_cond_signal(&p->wake);
+    pthread_mutex_unlock(&p->lock);
+    if (ret < 0) {
+        mrb_cgroup_pool_rmdir(p, id, p->ndirs);
+    }
+
+    return self;
+}
+
+// {:idle=>4, :leased=>2, :created=>6, :removed=>0, :error=>nil}
+static mrb_value mrb_cgroup_pool_stats(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_pool *p = mrb_cgroup_get_pool(mrb, self);
+    mrb_value h = mrb_hash_new(mrb);
+    int64_t created, removed;
+    int nidle, nleased, error;
+
+    pthread_mutex_lock(&p->lock);
+    nidle = p->nidle;
+    nleased = p->nleased;
+    created = p->created;
+    removed = p->removed;
+    error = p->error;
+    pthread_mutex_unlock(&p->lock);
+
+    mrb_hash_set(mrb, h, mrb_symbol_value(mrb_intern_lit(mrb, "idle")), mrb_fixnum_value(nidle));
+    mrb_hash_set(mrb, h, mrb_symbol_value(mrb_intern_lit(mrb, "leased")), mrb_fixnum_value(nleased));
+    mrb_hash_set(mrb, h, mrb_symbol_value(mrb_intern_lit(mrb, "created")), mrb_fixnum_value(created));
+    mrb_hash_set(mrb, h, mrb_symbol_value(mrb_intern_lit(mrb, "removed")), mrb_fixnum_value(removed));
+    mrb_hash_set(mrb, h, mrb_symbol_value(mrb_intern_lit(mrb, "error")),
+                 error ? mrb_str_new_cstr(mrb, strerror(error)) : mrb_nil_value());
+
+    return h;
+}
+
+// stops the thread and removes the idle groups, leased ones are left to their owners
+static mrb_value mrb_cgroup_pool_close(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_pool *p = mrb_cgroup_get_pool(mrb, self);
+
+    mrb_cgroup_pool_stop(p);
+    mrb_cgroup_pool_drop_idle(p);
+    p->closed = 1;
+
+    return mrb_nil_value();
+}
+
+void mrb_cgroup_pool_init(mrb_state *mrb, struct RClass *cgroup)
+{
+    struct RClass *pool;
+
+    pool = mrb_define_class_under(mrb, cgroup, "Pool", mrb->object_class);
+    MRB_SET_INSTANCE_TT(pool, MRB_TT_DATA);
+    mrb_define_method(mrb, pool, "initialize", mrb_cgroup_pool_initialize, MRB_ARGS_ARG(2, 1));
+    mrb_define_method(mrb, pool, "lease", mrb_cgroup_pool_lease, MRB_ARGS_OPT(1));
+    mrb_define_method(mrb, pool, "attach", mrb_cgroup_pool_attach, MRB_ARGS_ARG(1, 1));
+    mrb_define_method(mrb, pool, "release", mrb_cgroup_pool_release, MRB_ARGS_REQ(1));
+    mrb_define_method(mrb, pool, "stats", mrb_cgroup_pool_stats, MRB_ARGS_NONE());
+    mrb_define_method(mrb, pool, "close", mrb_cgroup_pool_close, MRB_ARGS_NONE());
+    DONE;
+}
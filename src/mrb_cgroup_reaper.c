@@ -0,0 +1,694 @@
+/*
+** mrb_cgroup_reaper - removal of empty groups on a background thread for mruby-cgroup
+**
+** See Copyright Notice in mrb_cgroup.c
+*/
+
+// pipe2
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mruby.h"
+#include "mruby/array.h"
+#include "mruby/class.h"
+#include "mruby/data.h"
+#include "mruby/hash.h"
+#include "mruby/string.h"
+
+#include "mrb_cgroup.h"
+
+#define DONE mrb_gc_arena_restore(mrb, 0);
+#define REAPER_BUCKETS 1024
+#define REAPER_EVENTS_SIZE 16384
+
+typedef struct {
+    // absolute directory, NULL for a free slot
+    char *path;
+    int depth;
+    // hash chain, or the free list for a free slot
+    int next;
+    // v2 watches on the directory (new children) and on its cgroup.events (populated), -1 on v1
+    int dir_wd, events_wd;
+    // monotonic nsec since the group was first seen empty, 0 while it has tasks
+    int64_t empty_since;
+    // generation of the last full scan that found the directory
+    unsigned seen;
+} mrb_cgroup_reaper_group;
+
+typedef struct {
+    pthread_t thread;
+    // held while the table is scanned and reaped, released while waiting
+    pthread_mutex_t lock;
+    int running;
+    int stop;
+    int stop_pipe[2];
+
+    // fixed at new
+    char *root;
+    // directories left alone with their subtree
+    char **exclude;
+    int nexclude;
+    int v2, fake, drain, batch;
+    int64_t min_age_ns;
+    int interval_ms;
+    int inotify_fd;
+
+    mrb_cgroup_reaper_group *groups;
+    int ngroups, capa, free;
+    int buckets[REAPER_BUCKETS];
+    // inotify wd -> group index
+    int *wds;
+    int nwds;
+    unsigned gen;
+
+    int64_t removed, drained, errors;
+    int error;
+} mrb_cgroup_reaper;
+
+static int64_t reaper_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// FNV-1a
+static unsigned reaper_hash(const char *s)
+{
+    uint32_t h = 2166136261u;
+
+    while (*s) {
+        h = (h ^ (unsigned char)*s++) * 16777619u;
+    }
+
+    return h % REAPER_BUCKETS;
+}
+
+static int reaper_find(mrb_cgroup_reaper *r, const char *path)
+{
+    int i;
+
+    for (i = r->buckets[reaper_hash(path)]; i >= 0 && strcmp(r->groups[i].path, path); i = r->groups[i].next) {
+    }
+
+    return i;
+}
+
+static void reaper_map_wd(mrb_cgroup_reaper *r, int wd, int idx)
+{
+    int *wds, n;
+
+    if (wd < 0) {
+        return;
+    }
+    if (wd >= r->nwds) {
+        for (n = r->nwds ? r->nwds : 256; n <= wd; n *= 2) {
+        }
+        if ((wds = (int *)realloc(r->wds, n * sizeof(int))) == NULL) {
+            return;
+        }
+        while (r->nwds < n) {
+            wds[r->nwds++] = -1;
+        }
+        r->wds = wds;
+    }
+    r->wds[wd] = idx;
+}
+
+static int reaper_excluded(mrb_cgroup_reaper *r, const char *path)
+{
+    int i;
+
+    for (i = 0; i < r->nexclude && !mrb_cgroup_path_under(path, r->exclude[i]); i++) {
+    }
+
+    return i < r->nexclude;
+}
+
+static int reaper_wd(mrb_cgroup_reaper *r, int wd)
+{
+    return (wd >= 0 && wd < r->nwds) ? r->wds[wd] : -1;
+}
+
+// returns the index of path in the table, added (and watched on v2) when new, -1 when out of memory
+static int reaper_add(mrb_cgroup_reaper *r, const char *path, int depth)
+{
+    char file[FILENAME_MAX];
+    mrb_cgroup_reaper_group *groups, *g;
+    unsigned h = reaper_hash(path);
+    int i;
+
+    if ((i = reaper_find(r, path)) >= 0) {
+        return i;
+    }
+    if (r->free < 0) {
+        if (r->ngroups == r->capa) {
+            if ((groups = (mrb_cgroup_reaper_group *)realloc(r->groups, (r->capa * 2 + 64) * sizeof(*groups))) ==
+                NULL) {
+                return -1;
+            }
+            r->groups = groups;
+            r->capa = r->capa * 2 + 64;
+        }
+        r->free = r->ngroups++;
+        r->groups[r->free].next = -1;
+    }
+    i = r->free;
+    g = &r->groups[i];
+    r->free = g->next;
+    if ((g->path = strdup(path)) == NULL) {
+        g->next = r->free;
+        r->free = i;
+        return -1;
+    }
+    g->depth = depth;
+    g->empty_since = 0;
+    g->seen = r->gen;
+    g->dir_wd = g->events_wd = -1;
+    g->next = r->buckets[h];
+    r->buckets[h] = i;
+    if (r->inotify_fd >= 0) {
+        g->dir_wd = inotify_add_watch(r->inotify_fd, path, IN_CREATE | IN_ONLYDIR);
+        snprintf(file, sizeof(file), "%s/cgroup.events", path);
+        g->events_wd = inotify_add_watch(r->inotify_fd, file, IN_MODIFY);
+        reaper_map_wd(r, g->dir_wd, i);
+        reaper_map_wd(r, g->events_wd, i);
+    }
+
+    return i;
+}
+
+static void reaper_forget(mrb_cgroup_reaper *r, int i)
+{
+    mrb_cgroup_reaper_group *g = &r->groups[i];
+    int *p;
+
+    // the watches of a removed directory are dropped by the kernel (IN_IGNORED), the map is cleared here
+    if (g->dir_wd >= 0) {
+        inotify_rm_watch(r->inotify_fd, g->dir_wd);
+        reaper_map_wd(r, g->dir_wd, -1);
+    }
+    if (g->events_wd >= 0) {
+        inotify_rm_watch(r->inotify_fd, g->events_wd);
+        reaper_map_wd(r, g->events_wd, -1);
+    }
+    for (p = &r->buckets[reaper_hash(g->path)]; *p != i; p = &r->groups[*p].next) {
+    }
+    *p = g->next;
+    free(g->path);
+    g->path = NULL;
+    g->next = r->free;
+    r->free = i;
+}
+
+// 1 when the group has no task (v2: none in the whole subtree), 0 when it has, -1 when it is gone
+static int reaper_empty(mrb_cgroup_reaper *r, const char *path)
+{
+    char file[FILENAME_MAX], buf[256], *p;
+    ssize_t len;
+    int fd;
+
+    snprintf(file, sizeof(file), "%s/%s", path, r->v2 ? "cgroup.events" : "tasks");
+    if ((fd = open(file, O_RDONLY | O_CLOEXEC)) < 0) {
+        return -1;
+    }
+    len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len < 0) {
+        return -1;
+    }
+    buf[len] = '\0';
+    if (!r->v2) {
+        return len == 0;
+    }
+    // a fake root without the file content counts as empty
+    return (p = strstr(buf, "populated ")) == NULL || p[10] == '0';
+}
+
+static void reaper_check(mrb_cgroup_reaper *r, int i, int64_t now)
+{
+    mrb_cgroup_reaper_group *g = &r->groups[i];
+    int empty;
+
+    // the root itself is never removed
+    if (g->depth == 0) {
+        return;
+    }
+    if ((empty = reaper_empty(r, g->path)) < 0) {
+        reaper_forget(r, i);
+    } else if (!empty) {
+        g->empty_since = 0;
+    } else if (g->empty_since == 0) {
+        g->empty_since = now;
+    }
+}
+
+// pre-order walk below path, every directory found is added, checked and marked with the current generation
+static void reaper_scan(mrb_cgroup_reaper *r, const char *path, int depth, int64_t now)
+{
+    char child[FILENAME_MAX];
+    struct dirent *ent;
+    DIR *dp;
+    int i;
+
+    if ((dp = opendir(path)) == NULL) {
+        return;
+    }
+    while ((ent = readdir(dp))) {
+        if (ent->d_type != DT_DIR || !strcmp(ent->d_name, ".") || !strcmp(ent->d_name, "..")) {
+            continue;
+        }
+        snprintf(child, sizeof(child), "%s/%s", path, ent->d_name);
+        if (reaper_excluded(r, child) || (i = reaper_add(r, child, depth + 1)) < 0) {
+            continue;
+        }
+        r->groups[i].seen = r->gen;
+        reaper_check(r, i, now);
+        reaper_scan(r, child, depth + 1, now);
+    }
+    closedir(dp);
+}
+
+// a scan of the whole tree, directories not found any more are dropped
+static void reaper_full_scan(mrb_cgroup_reaper *r, int64_t now)
+{
+    int i;
+
+    r->gen++;
+    if ((i = reaper_add(r, r->root, 0)) >= 0) {
+        r->groups[i].seen = r->gen;
+    }
+    reaper_scan(r, r->root, 0, now);
+    for (i = 0; i < r->ngroups; i++) {
+        if (r->groups[i].path && r->groups[i].seen != r->gen) {
+            reaper_forget(r, i);
+        }
+    }
+}
+
+// reads the pending inotify events, returns -1 when the queue overflowed and a full scan is needed
+static int reaper_events(mrb_cgroup_reaper *r, int64_t now)
+{
+    char buf[REAPER_EVENTS_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+    char child[FILENAME_MAX];
+    const struct inotify_event *ev;
+    ssize_t len, off;
+    int i, j, ret = 0;
+
+    while ((len = read(r->inotify_fd, buf, sizeof(buf))) > 0) {
+        for (off = 0; off < len; off += sizeof(struct inotify_event) + ev->len) {
+            ev = (const struct inotify_event *)(buf + off);
+            if (ev->mask & IN_Q_OVERFLOW) {
+                ret = -1;
+                continue;
+            }
+            if (ev->mask & IN_IGNORED) {
+                reaper_map_wd(r, ev->wd, -1);
+                continue;
+            }
+            if ((i = reaper_wd(r, ev->wd)) < 0 || r->groups[i].path == NULL) {
+                continue;
+            }
+            if (ev->wd == r->groups[i].dir_wd && (ev->mask & IN_CREATE) && (ev->mask & IN_ISDIR) && ev->len) {
+                snprintf(child, sizeof(child), "%s/%s", r->groups[i].path, ev->name);
+                if (!reaper_excluded(r, child) && (j = reaper_add(r, child, r->groups[i].depth + 1)) >= 0) {
+                    reaper_check(r, j, now);
+                    // children made before the watch was in place
+                    reaper_scan(r, child, r->groups[j].depth, now);
+                }
+            } else if (ev->wd == r->groups[i].events_wd) {
+                reaper_check(r, i, now);
+            }
+        }
+    }
+
+    return ret;
+}
+
+// moves the tasks left in path into its parent through one open fd
+static void reaper_drain(mrb_cgroup_reaper *r, const char *path)
+{
+    const char *tasks = r->v2 ? "cgroup.procs" : "tasks";
+    char file[FILENAME_MAX], pid[32], *slash;
+    FILE *fp;
+    int fd;
+
+    snprintf(file, sizeof(file), "%s/%s", path, tasks);
+    if ((fp = fopen(file, "r")) == NULL) {
+        return;
+    }
+    snprintf(file, sizeof(file), "%s", path);
+    if ((slash = strrchr(file, '/'))) {
+        snprintf(slash, sizeof(file) - (slash - file), "/%s", tasks);
+        if ((fd = open(file, O_WRONLY | O_CLOEXEC)) >= 0) {
+            while (fscanf(fp, "%31s", pid) == 1) {
+                // an exiting task can not be moved and does not have to
+                if (write(fd, pid, strlen(pid)) > 0) {
+                    r->drained++;
+                }
+            }
+            close(fd);
+        }
+    }
+    fclose(fp);
+}
+
+static int reaper_cmp(const void *a, const void *b)
+{
+    const int *x = a, *y = b;
+
+    // deepest first, so children go before their parents in one batch
+    return y[0] - x[0];
+}
+
+// removes up to batch groups empty for min_age, returns the number removed
+static int reaper_reap(mrb_cgroup_reaper *r, int64_t now)
+{
+    mrb_cgroup_reaper_group *g;
+    int (*todo)[2], n = 0, i, removed = 0, ret;
+
+    if ((todo = malloc(sizeof(*todo) * (r->ngroups + 1))) == NULL) {
+        return 0;
+    }
+    for (i = 0; i < r->ngroups; i++) {
+        g = &r->groups[i];
+        if (g->path && g->empty_since && now - g->empty_since >= r->min_age_ns) {
+            todo[n][0] = g->depth;
+            todo[n][1] = i;
+            n++;
+        }
+    }
+    qsort(todo, n, sizeof(*todo), reaper_cmp);
+
+    for (i = 0; i < n && removed < r->batch; i++) {
+        g = &r->groups[todo[i][1]];
+        // a Cgroup::Pool prefix, or a group a Cgroup object of the process made or reads
+        if (mrb_cgroup_registry_held(g->path)) {
+            g->empty_since = now;
+            continue;
+        }
+        // tasks that joined since the check are moved out, or the group is left to the next event
+        if ((ret = mrb_cgroup_rmdir_one(g->path, r->fake)) < 0 && errno == EBUSY && r->drain) {
+            reaper_drain(r, g->path);
+            ret = mrb_cgroup_rmdir_one(g->path, r->fake);
+        }
+        if (ret == 0 || errno == ENOENT) {
+            removed += (ret == 0);
+            reaper_forget(r, todo[i][1]);
+        } else if (errno == EBUSY || errno == ENOTEMPTY) {
+            // children not removed yet, or tasks; tried again when min_age passed once more
+            g->empty_since = now;
+        } else {
+            r->errors++;
+            r->error = errno;
+            g->empty_since = now;
+        }
+    }
+    r->removed += removed;
+    free(todo);
+
+    return removed;
+}
+
+// on v2 the tree is scanned once and followed through inotify, on v1 it is scanned on every interval
+static void *reaper_main(void *arg)
+{
+    mrb_cgroup_reaper *r = arg;
+    struct pollfd fds[2];
+    int64_t now;
+    int rescan = 1;
+
+    pthread_mutex_lock(&r->lock);
+    while (!r->stop) {
+        now = reaper_now();
+        if (r->inotify_fd >= 0 && reaper_events(r, now) < 0) {
+            rescan = 1;
+        }
+        if (rescan || r->inotify_fd < 0) {
+            reaper_full_scan(r, now);
+            rescan = 0;
+        }
+        reaper_reap(r, now);
+        pthread_mutex_unlock(&r->lock);
+
+        fds[0].fd = r->stop_pipe[0];
+        fds[0].events = POLLIN;
+        fds[1].fd = r->inotify_fd;
+        fds[1].events = POLLIN;
+        poll(fds, (r->inotify_fd >= 0) ? 2 : 1, r->interval_ms);
+        pthread_mutex_lock(&r->lock);
+    }
+    pthread_mutex_unlock(&r->lock);
+
+    return NULL;
+}
+
+static void reaper_stop(mrb_cgroup_reaper *r)
+{
+    char c;
+
+    if (!r->running) {
+        return;
+    }
+    pthread_mutex_lock(&r->lock);
+    r->stop = 1;
+    pthread_mutex_unlock(&r->lock);
+    if (write(r->stop_pipe[1], "x", 1) < 0) {
+    }
+    pthread_join(r->thread, NULL);
+    while (read(r->stop_pipe[0], &c, 1) > 0) {
+    }
+    r->running = 0;
+}
+
+static void mrb_cgroup_reaper_free(mrb_state *mrb, void *p)
+{
+    mrb_cgroup_reaper *r = p;
+    int i;
+
+    reaper_stop(r);
+    for (i = 0; i < r->ngroups; i++) {
+        free(r->groups[i].path);
+    }
+    free(r->groups);
+    free(r->wds);
+    free(r->root);
+    for (i = 0; i < r->nexclude; i++) {
+        free(r->exclude[i]);
+    }
+    free(r->exclude);
+    if (r->inotify_fd >= 0) {
+        close(r->inotify_fd);
+    }
+    if (r->stop_pipe[0] >= 0) {
+        close(r->stop_pipe[0]);
+        close(r->stop_pipe[1]);
+    }
+    pthread_mutex_destroy(&r->lock);
+    mrb_free(mrb, r);
+}
+
+static const struct mrb_data_type mrb_cgroup_reaper_type = {
+    "mrb_cgroup_reaper", mrb_cgroup_reaper_free,
+};
+
+static mrb_cgroup_reaper *mrb_cgroup_get_reaper(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_reaper *r = (mrb_cgroup_reaper *)mrb_data_get_ptr(mrb, self, &mrb_cgroup_reaper_type);
+
+    if (!r)
+        mrb_raise(mrb, E_RUNTIME_ERROR, "get mrb_cgroup_reaper failed");
+
+    return r;
+}
+
+static mrb_value mrb_cgroup_reaper_opt(mrb_state *mrb, mrb_value opts, const char *name, mrb_value def)
+{
+    mrb_value val;
+
+    if (mrb_nil_p(opts)) {
+        return def;
+    }
+    val = mrb_hash_get(mrb, opts, mrb_symbol_value(mrb_intern_cstr(mrb, name)));
+
+    return mrb_nil_p(val) ? def : val;
+}
+
+// Cgroup::Reaper.new(root, controller = "cpu", min_age_ms: 5000, batch: 64, interval_ms: 1000, drain: false,
+//                    exclude: [])
+static mrb_value mrb_cgroup_reaper_initialize(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_reaper *r = (mrb_cgroup_reaper *)DATA_PTR(self);
+    mrb_value opts = mrb_nil_value(), exclude, val;
+    char *root, *controller = "cpu";
+    char path[FILENAME_MAX];
+    size_t len;
+    int i;
+    mrb_get_args(mrb, "z|zH", &root, &controller, &opts);
+
+    if (mrb_cgroup_controller_path(mrb, controller, root, path, sizeof(path)) < 0) {
+        mrb_sys_fail(mrb, controller);
+    }
+    for (len = strlen(path); len > 1 && path[len - 1] == '/'; len--) {
+        path[len - 1] = '\0';
+    }
+    exclude = mrb_cgroup_reaper_opt(mrb, opts, "exclude", mrb_ary_new(mrb));
+    if (!mrb_array_p(exclude)) {
+        mrb_raise(mrb, E_TYPE_ERROR, "exclude must be an Array");
+    }
+
+    if (r) {
+        mrb_cgroup_reaper_free(mrb, r);
+    }
+    DATA_TYPE(self) = &mrb_cgroup_reaper_type;
+    DATA_PTR(self) = NULL;
+
+    r = (mrb_cgroup_reaper *)mrb_calloc(mrb, 1, sizeof(mrb_cgroup_reaper));
+    pthread_mutex_init(&r->lock, NULL);
+    r->inotify_fd = r->stop_pipe[0] = r->stop_pipe[1] = -1;
+    r->free = -1;
+    for (i = 0; i < REAPER_BUCKETS; i++) {
+        r->buckets[i] = -1;
+    }
+    DATA_PTR(self) = r;
+    r->root = strdup(path);
+    r->exclude = (char **)calloc(RARRAY_LEN(exclude) + 1, sizeof(char *));
+    for (i = 0; i < RARRAY_LEN(exclude); i++) {
+        // groups of the hierarchy, as root
+        val = mrb_ary_ref(mrb, exclude, i);
+        if (mrb_cgroup_controller_path(mrb, controller, mrb_string_value_cstr(mrb, &val), path, sizeof(path)) < 0) {
+            mrb_sys_fail(mrb, controller);
+        }
+        for (len = strlen(path); len > 1 && path[len - 1] == '/'; len--) {
+            path[len - 1] = '\0';
+        }
+        r->exclude[r->nexclude++] = strdup(path);
+    }
+    r->v2 = mrb_cgroup_unified(mrb);
+    r->fake = mrb_cgroup_fake(mrb);
+    r->min_age_ns =
+        mrb_fixnum(mrb_to_int(mrb, mrb_cgroup_reaper_opt(mrb, opts, "min_age_ms", mrb_fixnum_value(5000)))) * 1000000;
+    r->batch = mrb_fixnum(mrb_to_int(mrb, mrb_cgroup_reaper_opt(mrb, opts, "batch", mrb_fixnum_value(64))));
+    r->interval_ms =
+        mrb_fixnum(mrb_to_int(mrb, mrb_cgroup_reaper_opt(mrb, opts, "interval_ms", mrb_fixnum_value(1000))));
+    r->drain = mrb_test(mrb_cgroup_reaper_opt(mrb, opts, "drain", mrb_false_value()));
+    if (r->min_age_ns < 0 || r->batch <= 0 || r->interval_ms <= 0) {
+        mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid min_age_ms/batch/interval_ms");
+    }
+    if (pipe2(r->stop_pipe, O_CLOEXEC | O_NONBLOCK) < 0) {
+        mrb_sys_fail(mrb, "pipe2");
+    }
+    // v1 files do not notify, cgroup.events of v2 does on every change of populated
+    if (r->v2 && (r->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) {
+        mrb_sys_fail(mrb, "inotify_init1");
+    }
+
+    return self;
+}
+
+static mrb_value mrb_cgroup_reaper_start(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_reaper *r = mrb_cgroup_get_reaper(mrb, self);
+
+    if (r->running) {
+        return self;
+    }
+    r->stop = 0;
+    if (pthread_create(&r->thread, NULL, reaper_main, r)) {
+        mrb_raise(mrb, E_RUNTIME_ERROR, "pthread_create failed");
+    }
+    r->running = 1;
+
+    return self;
+}
+
+static mrb_value mrb_cgroup_reaper_stop(mrb_state *mrb, mrb_value self)
+{
+    reaper_stop(mrb_cgroup_get_reaper(mrb, self));
+    return self;
+}
+
+static mrb_value mrb_cgroup_reaper_running_p(mrb_state *mrb, mrb_value self)
+{
+    return mrb_bool_value(mrb_cgroup_get_reaper(mrb, self)->running);
+}
+
+// reap => number of groups removed by one full scan and one batch, on the calling thread
+static mrb_value mrb_cgroup_reaper_reap(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_reaper *r = mrb_cgroup_get_reaper(mrb, self);
+    int64_t now = reaper_now();
+    int removed;
+
+    pthread_mutex_lock(&r->lock);
+    if (r->inotify_fd >= 0) {
+        reaper_events(r, now);
+    }
+    reaper_full_scan(r, now);
+    removed = reaper_reap(r, now);
+    pthread_mutex_unlock(&r->lock);
+
+    return mrb_fixnum_value(removed);
+}
+
+// {:groups=>1200, :empty=>3, :removed=>840, :drained=>0, :errors=>0, :error=>nil}
+static mrb_value mrb_cgroup_reaper_stats(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_reaper *r = mrb_cgroup_get_reaper(mrb, self);
+    mrb_value h = mrb_hash_new(mrb);
+    int64_t removed, drained, errors;
+    int groups = 0, empty = 0, error, i;
+
+    pthread_mutex_lock(&r->lock);
+    for (i = 0; i < r->ngroups; i++) {
+        if (r->groups[i].path) {
+            groups++;
+            empty += (r->groups[i].empty_since != 0);
+        }
+    }
+    removed = r->removed;
+    drained = r->drained;
+    errors = r->errors;
+    error = r->error;
+    pthread_mutex_unlock(&r->lock);
+
+    mrb_hash_set(mrb, h, mrb_symbol_value(mrb_intern_lit(mrb, "groups")), mrb_fixnum_value(groups));
+    mrb_hash_set(mrb, h, mrb_symbol_value(mrb_intern_lit(mrb, "empty")), mrb_fixnum_value(empty));
+    mrb_hash_set(mrb, h, mrb_symbol_value(mrb_intern_lit(mrb, "removed")), mrb_fixnum_value(removed));
+    mrb_hash_set(mrb, h, mrb_symbol_value(mrb_intern_lit(mrb, "drained")), mrb_fixnum_value(drained));
+    mrb_hash_set(mrb, h, mrb_symbol_value(mrb_intern_lit(mrb, "errors")), mrb_fixnum_value(errors));
+    mrb_hash_set(mrb, h, mrb_symbol_value(mrb_intern_lit(mrb, "error")),
+                 error ? mrb_str_new_cstr(mrb, strerror(error)) : mrb_nil_value());
+
+    return h;
+}
+
+void mrb_cgroup_reaper_init(mrb_state *mrb, struct RClass *cgroup)
+{
+    struct RClass *reaper;
+
+    reaper = mrb_define_class_under(mrb, cgroup, "Reaper", mrb->object_class);
+    MRB_SET_INSTANCE_TT(reaper, MRB_TT_DATA);
+    mrb_define_method(mrb, reaper, "initialize", mrb_cgroup_reaper_initialize, MRB_ARGS_ARG(1, 2));
+    mrb_define_method(mrb, reaper, "start", mrb_cgroup_reaper_start, MRB_ARGS_NONE());
+    mrb_define_method(mrb, reaper, "stop", mrb_cgroup_reaper_stop, MRB_ARGS_NONE());
+    mrb_define_method(mrb, reaper, "running?", mrb_cgroup_reaper_running_p, MRB_ARGS_NONE());
+    mrb_define_method(mrb, reaper, "reap", mrb_cgroup_reaper_reap, MRB_ARGS_NONE());
+    mrb_define_method(mrb, reaper, "stats", mrb_cgroup_reaper_stats, MRB_ARGS_NONE());
+    DONE;
+}
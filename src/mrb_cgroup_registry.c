@@ -0,0 +1,327 @@
+/*
+** mrb_cgroup_registry - process wide group state shared by every mrb_state for mruby-cgroup
+**
+** See Copyright Notice in mrb_cgroup.c
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mruby.h"
+#include "mruby/hash.h"
+
+#include "mrb_cgroup.h"
+
+#define DONE mrb_gc_arena_restore(mrb, 0);
+#define REGISTRY_BUCKETS 256
+#define ENTRY_FILE_SIZE 64
+
+// one per group directory, alive while a context of any mrb_state holds it
+struct mrb_cgroup_entry {
+    struct mrb_cgroup_entry *next;
+    char *dir;
+    // under the registry lock
+    int refs;
+    // set once the directory was removed; the entry is out of the table, its holders move to a new one
+    int stale;
+    // serializes the opens, lookups read nfds with acquire and go without it; slots are never reused
+    // while the entry is alive, so a fd handed out stays valid for every holder
+    pthread_mutex_t lock;
+    int nfds;
+    struct {
+        char file[ENTRY_FILE_SIZE];
+        int write;
+        int fd;
+    } fds[LIVE_FDS_SIZE];
+};
+
+static pthread_mutex_t mrb_cgroup_registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static mrb_cgroup_entry *mrb_cgroup_registry[REGISTRY_BUCKETS];
+static int mrb_cgroup_registry_groups;
+
+// directories kept with their whole subtree from Cgroup::Reaper, one per hold (the prefixes of Cgroup::Pool)
+typedef struct mrb_cgroup_hold {
+    struct mrb_cgroup_hold *next;
+    char *dir;
+} mrb_cgroup_hold;
+static mrb_cgroup_hold *mrb_cgroup_registry_holds;
+
+// cgroup_init() rebuilds the mount table of libcgroup, which every mrb_state of the process reads; the tables
+// built are listed newest first, the first one of a root is its current one
+static pthread_mutex_t mrb_cgroup_init_lock = PTHREAD_MUTEX_INITIALIZER;
+static mrb_cgroup_mounts *mrb_cgroup_mounts_list;
+unsigned mrb_cgroup_mounts_gen;
+// handed out when a table can not be allocated
+static mrb_cgroup_mounts mrb_cgroup_mounts_none = {NULL, NULL, ECGOTHER};
+
+static int mrb_cgroup_root_eq(const char *a, const char *b)
+{
+    return (a == NULL || b == NULL) ? a == b : !strcmp(a, b);
+}
+
+const mrb_cgroup_mounts *mrb_cgroup_shared_init(const char *root, int reload, void (*fill)(mrb_cgroup_mounts *m))
+{
+    mrb_cgroup_mounts *m, *cur;
+
+    pthread_mutex_lock(&mrb_cgroup_init_lock);
+    for (cur = mrb_cgroup_mounts_list; cur && !mrb_cgroup_root_eq(cur->root, root); cur = cur->next) {
+    }
+    if (cur && !reload && cur->init_code == 0) {
+        pthread_mutex_unlock(&mrb_cgroup_init_lock);
+        return cur;
+    }
+    if ((m = (mrb_cgroup_mounts *)calloc(1, sizeof(mrb_cgroup_mounts))) == NULL ||
+        (root && (m->root = strdup(root)) == NULL)) {
+        free(m);
+        pthread_mutex_unlock(&mrb_cgroup_init_lock);
+        return cur ? cur : &mrb_cgroup_mounts_none;
+    }
+    fill(m);
+    m->next = mrb_cgroup_mounts_list;
+    mrb_cgroup_mounts_list = m;
+    __atomic_fetch_add(&mrb_cgroup_mounts_gen, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&mrb_cgroup_init_lock);
+
+    return m;
+}
+
+// FNV-1a
+static unsigned mrb_cgroup_registry_hash(const char *s)
+{
+    uint32_t h = 2166136261u;
+
+    while (*s) {
+        h = (h ^ (unsigned char)*s++) * 16777619u;
+    }
+
+    return h % REGISTRY_BUCKETS;
+}
+
+// takes e out of the table, a group made again at the same path gets a new entry and fresh fds; the fds of e
+// stay open until its last holder releases it
+static void mrb_cgroup_entry_unlink(mrb_cgroup_entry *e)
+{
+    mrb_cgroup_entry **p;
+
+    for (p = &mrb_cgroup_registry[mrb_cgroup_registry_hash(e->dir)]; *p != e; p = &(*p)->next) {
+    }
+    *p = e->next;
+    mrb_cgroup_registry_groups--;
+    __atomic_store_n(&e->stale, 1, __ATOMIC_RELEASE);
+}
+
+mrb_cgroup_entry *mrb_cgroup_entry_acquire(const char *dir)
+{
+    unsigned h = mrb_cgroup_registry_hash(dir);
+    mrb_cgroup_entry *e;
+
+    pthread_mutex_lock(&mrb_cgroup_registry_lock);
+    for (e = mrb_cgroup_registry[h]; e && strcmp(e->dir, dir); e = e->next) {
+    }
+    if (e == NULL && (e = (mrb_cgroup_entry *)calloc(1, sizeof(mrb_cgroup_entry)))) {
+        if ((e->dir = strdup(dir)) == NULL) {
+            free(e);
+            e = NULL;
+        } else {
+            pthread_mutex_init(&e->lock, NULL);
+            e->next = mrb_cgroup_registry[h];
+            mrb_cgroup_registry[h] = e;
+            mrb_cgroup_registry_groups++;
+        }
+    }
+    if (e) {
+        e->refs++;
+    }
+    pthread_mutex_unlock(&mrb_cgroup_registry_lock);
+
+    return e;
+}
+
+void mrb_cgroup_entry_release(mrb_cgroup_entry *e)
+{
+    int i;
+
+    pthread_mutex_lock(&mrb_cgroup_registry_lock);
+    if (--e->refs > 0) {
+        pthread_mutex_unlock(&mrb_cgroup_registry_lock);
+        return;
+    }
+    if (!e->stale) {
+        mrb_cgroup_entry_unlink(e);
+    }
+    pthread_mutex_unlock(&mrb_cgroup_registry_lock);
+
+    for (i = 0; i < e->nfds; i++) {
+        close(e->fds[i].fd);
+    }
+    pthread_mutex_destroy(&e->lock);
+    free(e->dir);
+    free(e);
+}
+
+void mrb_cgroup_entry_evict(mrb_cgroup_entry *e)
+{
+    pthread_mutex_lock(&mrb_cgroup_registry_lock);
+    if (!e->stale) {
+        mrb_cgroup_entry_unlink(e);
+    }
+    pthread_mutex_unlock(&mrb_cgroup_registry_lock);
+}
+
+// called once the directory dir is removed
+void mrb_cgroup_registry_evict(const char *dir)
+{
+    mrb_cgroup_entry *e;
+
+    pthread_mutex_lock(&mrb_cgroup_registry_lock);
+    for (e = mrb_cgroup_registry[mrb_cgroup_registry_hash(dir)]; e && strcmp(e->dir, dir); e = e->next) {
+    }
+    if (e) {
+        mrb_cgroup_entry_unlink(e);
+    }
+    pthread_mutex_unlock(&mrb_cgroup_registry_lock);
+}
+
+int mrb_cgroup_entry_stale(mrb_cgroup_entry *e)
+{
+    return __atomic_load_n(&e->stale, __ATOMIC_ACQUIRE);
+}
+
+int mrb_cgroup_path_under(const char *path, const char *dir)
+{
+    size_t len = strlen(dir);
+
+    return !strncmp(path, dir, len) && (path[len] == '\0' || path[len] == '/');
+}
+
+int mrb_cgroup_registry_hold(const char *dir)
+{
+    mrb_cgroup_hold *h;
+
+    if ((h = (mrb_cgroup_hold *)malloc(sizeof(mrb_cgroup_hold))) == NULL || (h->dir = strdup(dir)) == NULL) {
+        free(h);
+        errno = ENOMEM;
+        return -1;
+    }
+    pthread_mutex_lock(&mrb_cgroup_registry_lock);
+    h->next = mrb_cgroup_registry_holds;
+    mrb_cgroup_registry_holds = h;
+    pthread_mutex_unlock(&mrb_cgroup_registry_lock);
+
+    return 0;
+}
+
+void mrb_cgroup_registry_unhold(const char *dir)
+{
+    mrb_cgroup_hold **p, *h = NULL;
+
+    pthread_mutex_lock(&mrb_cgroup_registry_lock);
+    for (p = &mrb_cgroup_registry_holds; *p && strcmp((*p)->dir, dir); p = &(*p)->next) {
+    }
+    if ((h = *p)) {
+        *p = h->next;
+    }
+    pthread_mutex_unlock(&mrb_cgroup_registry_lock);
+
+    if (h) {
+        free(h->dir);
+        free(h);
+    }
+}
+
+int mrb_cgroup_registry_held(const char *path)
+{
+    mrb_cgroup_entry *e;
+    mrb_cgroup_hold *h;
+
+    pthread_mutex_lock(&mrb_cgroup_registry_lock);
+    for (e = mrb_cgroup_registry[mrb_cgroup_registry_hash(path)]; e && strcmp(e->dir, path); e = e->next) {
+    }
+    for (h = mrb_cgroup_registry_holds; e == NULL && h && !mrb_cgroup_path_under(path, h->dir); h = h->next) {
+    }
+    pthread_mutex_unlock(&mrb_cgroup_registry_lock);
+
+    return e || h;
+}
+
+static int mrb_cgroup_entry_find(mrb_cgroup_entry *e, int from, int to, const char *file, int write)
+{
+    int i;
+
+    for (i = from; i < to; i++) {
+        if (e->fds[i].write == write && !strcmp(e->fds[i].file, file)) {
+            return e->fds[i].fd;
+        }
+    }
+
+    return -1;
+}
+
+int mrb_cgroup_entry_fd(mrb_cgroup_entry *e, const char *file, int write)
+{
+    char path[FILENAME_MAX];
+    int n = __atomic_load_n(&e->nfds, __ATOMIC_ACQUIRE), fd;
+
+    if ((fd = mrb_cgroup_entry_find(e, 0, n, file, write)) >= 0) {
+        return fd;
+    }
+
+    pthread_mutex_lock(&e->lock);
+    // opened by another thread in the meantime
+    if ((fd = mrb_cgroup_entry_find(e, n, e->nfds, file, write)) >= 0) {
+        pthread_mutex_unlock(&e->lock);
+        return fd;
+    }
+    if (e->nfds == LIVE_FDS_SIZE || strlen(file) >= ENTRY_FILE_SIZE) {
+        pthread_mutex_unlock(&e->lock);
+        errno = ENOSPC;
+        return -1;
+    }
+    snprintf(path, sizeof(path), "%s/%s", e->dir, file);
+    MRB_CGROUP_SYSCALL(1);
+    if ((fd = open(path, (write ? O_WRONLY : O_RDONLY) | O_CLOEXEC)) < 0) {
+        pthread_mutex_unlock(&e->lock);
+        return -1;
+    }
+    snprintf(e->fds[e->nfds].file, ENTRY_FILE_SIZE, "%s", file);
+    e->fds[e->nfds].write = write;
+    e->fds[e->nfds].fd = fd;
+    __atomic_store_n(&e->nfds, e->nfds + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&e->lock);
+
+    return fd;
+}
+
+// Cgroup.registry_stats => {:groups=>, :fds=>}, for the whole process
+static mrb_value mrb_cgroup_registry_stats(mrb_state *mrb, mrb_value self)
+{
+    mrb_value result = mrb_hash_new(mrb);
+    mrb_cgroup_entry *e;
+    int groups, fds = 0, i;
+
+    pthread_mutex_lock(&mrb_cgroup_registry_lock);
+    groups = mrb_cgroup_registry_groups;
+    for (i = 0; i < REGISTRY_BUCKETS; i++) {
+        for (e = mrb_cgroup_registry[i]; e; e = e->next) {
+            fds += __atomic_load_n(&e->nfds, __ATOMIC_ACQUIRE);
+        }
+    }
+    pthread_mutex_unlock(&mrb_cgroup_registry_lock);
+
+    mrb_hash_set(mrb, result, mrb_symbol_value(mrb_intern_lit(mrb, "groups")), mrb_fixnum_value(groups));
+    mrb_hash_set(mrb, result, mrb_symbol_value(mrb_intern_lit(mrb, "fds")), mrb_fixnum_value(fds));
+
+    return result;
+}
+
+void mrb_cgroup_registry_init(mrb_state *mrb, struct RClass *cgroup)
+{
+    mrb_define_class_method(mrb, cgroup, "registry_stats", mrb_cgroup_registry_stats, MRB_ARGS_NONE());
+    DONE;
+}
@@ -0,0 +1,457 @@
+/*
+** mrb_cgroup_sampler - batched stat reads over many groups for mruby-cgroup
+**
+** See Copyright Notice in mrb_cgroup.c
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mruby.h"
+#include "mruby/array.h"
+#include "mruby/class.h"
+#include "mruby/data.h"
+#include "mruby/string.h"
+
+#include "mrb_cgroup.h"
+
+#define DONE mrb_gc_arena_restore(mrb, 0);
+#define SAMPLER_BUF_SIZE 4096
+#define SAMPLER_THREADS_MAX 64
+// value of a file that could not be read, nil in Ruby
+#define SAMPLER_NO_VALUE INT64_MIN
+
+typedef struct {
+    int fd;
+    // set by a read that found the group removed, the fd is opened again by the next sample or reopen
+    int stale;
+    const mrb_cgroup_v2_key *conv;
+} mrb_cgroup_sampler_file;
+
+typedef struct mrb_cgroup_sampler mrb_cgroup_sampler;
+
+typedef struct {
+    pthread_t thread;
+    mrb_cgroup_sampler *sampler;
+    size_t begin, end;
+} mrb_cgroup_sampler_worker;
+
+// files are laid out group major: files[group * nkeys + key], values alike
+struct mrb_cgroup_sampler {
+    size_t ngroups;
+    size_t nkeys;
+    size_t nfiles;
+    // copies of the names given to new, the caller may change its arrays afterwards
+    char **groups;
+    char **keys;
+    mrb_cgroup_sampler_file *files;
+    int64_t *values;
+    // number of stale files, counted by the workers
+    int nstale;
+    // CLOCK_MONOTONIC nsec at the start of the last sample
+    int64_t timestamp;
+
+    // the pool runs one pass per generation, each worker over its own range of files; nthreads as asked for,
+    // the pool is started again by reopen after close
+    int nthreads;
+    int nworkers;
+    mrb_cgroup_sampler_worker *workers;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    unsigned long generation;
+    int running;
+    int stop;
+};
+
+static void mrb_cgroup_sampler_read(mrb_cgroup_sampler *s, size_t begin, size_t end)
+{
+    char buf[SAMPLER_BUF_SIZE];
+    ssize_t len;
+    size_t i;
+
+    for (i = begin; i < end; i++) {
+        s->values[i] = SAMPLER_NO_VALUE;
+        if (s->files[i].fd < 0 || (len = pread(s->files[i].fd, buf, sizeof(buf) - 1, 0)) <= 0) {
+            if (s->files[i].fd >= 0 && len < 0 && (errno == ENODEV || errno == ENOENT)) {
+                s->files[i].stale = 1;
+                __atomic_fetch_add(&s->nstale, 1, __ATOMIC_RELAXED);
+            }
+            continue;
+        }
+        while (len > 0 && (buf[len - 1] == '\n' || buf[len - 1] == ' ')) {
+            len--;
+        }
+        buf[len] = '\0';
+        if (s->files[i].conv && mrb_cgroup_v2_to_v1(s->files[i].conv, buf, sizeof(buf)) <= 0) {
+            continue;
+        }
+        s->values[i] = (int64_t)strtoll(buf, NULL, 10);
+    }
+}
+
+static void *mrb_cgroup_sampler_worker_main(void *arg)
+{
+    mrb_cgroup_sampler_worker *w = arg;
+    mrb_cgroup_sampler *s = w->sampler;
+    unsigned long seen = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&s->lock);
+        while (!s->stop && s->generation == seen) {
+            pthread_cond_wait(&s->start, &s->lock);
+        }
+        if (s->stop) {
+            pthread_mutex_unlock(&s->lock);
+            return NULL;
+        }
+        seen = s->generation;
+        pthread_mutex_unlock(&s->lock);
+
+        mrb_cgroup_sampler_read(s, w->begin, w->end);
+
+        pthread_mutex_lock(&s->lock);
+        if (--s->running == 0) {
+            pthread_cond_signal(&s->done);
+        }
+        pthread_mutex_unlock(&s->lock);
+    }
+}
+
+static void mrb_cgroup_sampler_pass(mrb_cgroup_sampler *s)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    s->timestamp = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+    if (s->nworkers == 0) {
+        mrb_cgroup_sampler_read(s, 0, s->nfiles);
+        return;
+    }
+
+    pthread_mutex_lock(&s->lock);
+    s->running = s->nworkers;
+    s->generation++;
+    pthread_cond_broadcast(&s->start);
+    while (s->running > 0) {
+        pthread_cond_wait(&s->done, &s->lock);
+    }
+    pthread_mutex_unlock(&s->lock);
+}
+
+static void mrb_cgroup_sampler_close(mrb_cgroup_sampler *s)
+{
+    size_t i;
+    int j;
+
+    if (s->workers) {
+        pthread_mutex_lock(&s->lock);
+        s->stop = 1;
+        pthread_cond_broadcast(&s->start);
+        pthread_mutex_unlock(&s->lock);
+        for (j = 0; j < s->nworkers; j++) {
+            pthread_join(s->workers[j].thread, NULL);
+        }
+        free(s->workers);
+        s->workers = NULL;
+        s->nworkers = 0;
+    }
+    for (i = 0; i < s->nfiles; i++) {
+        if (s->files[i].fd >= 0) {
+            close(s->files[i].fd);
+            s->files[i].fd = -1;
+        }
+        s->files[i].stale = 0;
+    }
+    s->nstale = 0;
+}
+
+static void mrb_cgroup_sampler_free_names(mrb_state *mrb, char **names, size_t n)
+{
+    size_t i;
+
+    if (names) {
+        for (i = 0; i < n; i++) {
+            mrb_free(mrb, names[i]);
+        }
+        mrb_free(mrb, names);
+    }
+}
+
+static void mrb_cgroup_sampler_free(mrb_state *mrb, void *p)
+{
+    mrb_cgroup_sampler *s = p;
+
+    mrb_cgroup_sampler_close(s);
+    mrb_cgroup_sampler_free_names(mrb, s->groups, s->ngroups);
+    mrb_cgroup_sampler_free_names(mrb, s->keys, s->nkeys);
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->start);
+    pthread_cond_destroy(&s->done);
+    mrb_free(mrb, s->files);
+    mrb_free(mrb, s->values);
+    mrb_free(mrb, s);
+}
+
+static const struct mrb_data_type mrb_cgroup_sampler_type = {
+    "mrb_cgroup_sampler", mrb_cgroup_sampler_free,
+};
+
+static mrb_cgroup_sampler *mrb_cgroup_get_sampler(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_sampler *s = (mrb_cgroup_sampler *)mrb_data_get_ptr(mrb, self, &mrb_cgroup_sampler_type);
+
+    if (!s)
+        mrb_raise(mrb, E_RUNTIME_ERROR, "get mrb_cgroup_sampler failed");
+
+    return s;
+}
+
+// (re)opens the files that are not open yet or stale, groups created after new (or removed and made again)
+// are picked up this way; called with the workers idle
+static void mrb_cgroup_sampler_open(mrb_state *mrb, mrb_cgroup_sampler *s)
+{
+    mrb_cgroup_sampler_file *f;
+    char path[FILENAME_MAX];
+    size_t g, k;
+
+    s->nstale = 0;
+    for (g = 0; g < s->ngroups; g++) {
+        for (k = 0; k < s->nkeys; k++) {
+            f = &s->files[g * s->nkeys + k];
+            if (f->stale) {
+                close(f->fd);
+                f->fd = -1;
+                f->stale = 0;
+            }
+            if (f->fd >= 0) {
+                continue;
+            }
+            if (mrb_cgroup_key_path(mrb, s->groups[g], s->keys[k], path, sizeof(path), &f->conv) < 0) {
+                continue;
+            }
+            if ((f->fd = open(path, O_RDONLY | O_CLOEXEC)) < 0 && (errno == EMFILE || errno == ENFILE)) {
+                mrb_sys_fail(mrb, "too many files for Cgroup::Sampler, raise RLIMIT_NOFILE");
+            }
+        }
+    }
+}
+
+// starts the worker pool unless it runs already or nthreads asks for none
+static void mrb_cgroup_sampler_start(mrb_state *mrb, mrb_cgroup_sampler *s)
+{
+    int nthreads = ((size_t)s->nthreads > s->nfiles) ? (int)s->nfiles : s->nthreads, i;
+
+    if (s->workers || nthreads <= 1) {
+        return;
+    }
+    s->workers = (mrb_cgroup_sampler_worker *)calloc(nthreads, sizeof(mrb_cgroup_sampler_worker));
+    if (s->workers == NULL) {
+        mrb_sys_fail(mrb, "calloc");
+    }
+    s->stop = 0;
+    s->generation = 0;
+    for (i = 0; i < nthreads; i++) {
+        s->workers[i].sampler = s;
+        s->workers[i].begin = s->nfiles * i / nthreads;
+        s->workers[i].end = s->nfiles * (i + 1) / nthreads;
+        if (pthread_create(&s->workers[i].thread, NULL, mrb_cgroup_sampler_worker_main, &s->workers[i])) {
+            break;
+        }
+        s->nworkers++;
+    }
+    if (s->nworkers < nthreads) {
+        mrb_cgroup_sampler_close(s);
+        mrb_raise(mrb, E_RUNTIME_ERROR, "pthread_create failed");
+    }
+}
+
+// the Strings of names into a NULL filled array of C strings owned by the sampler
+static char **mrb_cgroup_sampler_names(mrb_state *mrb, mrb_value names)
+{
+    char **copy = (char **)mrb_calloc(mrb, RARRAY_LEN(names) ? RARRAY_LEN(names) : 1, sizeof(char *));
+    mrb_value name;
+    mrb_int i;
+
+    for (i = 0; i < RARRAY_LEN(names); i++) {
+        name = mrb_ary_ref(mrb, names, i);
+        copy[i] = (char *)mrb_malloc(mrb, RSTRING_LEN(name) + 1);
+        memcpy(copy[i], RSTRING_PTR(name), RSTRING_LEN(name));
+        copy[i][RSTRING_LEN(name)] = '\0';
+    }
+
+    return copy;
+}
+
+static mrb_value mrb_cgroup_sampler_names_value(mrb_state *mrb, char **names, size_t n)
+{
+    mrb_value ary = mrb_ary_new_capa(mrb, n);
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        mrb_ary_push(mrb, ary, mrb_str_new_cstr(mrb, names[i]));
+    }
+
+    return ary;
+}
+
+// a new Array of the elements of ary converted with to_str, ary is left as it is
+static mrb_value mrb_cgroup_sampler_strings(mrb_state *mrb, mrb_value ary)
+{
+    mrb_value strings = mrb_ary_new_capa(mrb, RARRAY_LEN(ary));
+    mrb_int i;
+
+    for (i = 0; i < RARRAY_LEN(ary); i++) {
+        mrb_ary_push(mrb, strings, mrb_str_to_str(mrb, mrb_ary_ref(mrb, ary, i)));
+    }
+
+    return strings;
+}
+
+// Cgroup::Sampler.new(groups, keys, threads = 0)
+static mrb_value mrb_cgroup_sampler_initialize(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_sampler *s = (mrb_cgroup_sampler *)DATA_PTR(self);
+    mrb_value groups, keys;
+    mrb_int nthreads = 0;
+    size_t j;
+    mrb_get_args(mrb, "AA|i", &groups, &keys, &nthreads);
+
+    groups = mrb_cgroup_sampler_strings(mrb, groups);
+    keys = mrb_cgroup_sampler_strings(mrb, keys);
+    if (nthreads < 0 || nthreads > SAMPLER_THREADS_MAX) {
+        mrb_raise(mrb, E_ARGUMENT_ERROR, "threads out of range");
+    }
+
+    if (s) {
+        mrb_cgroup_sampler_free(mrb, s);
+    }
+    DATA_TYPE(self) = &mrb_cgroup_sampler_type;
+    DATA_PTR(self) = NULL;
+
+    s = (mrb_cgroup_sampler *)mrb_calloc(mrb, 1, sizeof(mrb_cgroup_sampler));
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->start, NULL);
+    pthread_cond_init(&s->done, NULL);
+    DATA_PTR(self) = s;
+
+    s->groups = mrb_cgroup_sampler_names(mrb, groups);
+    s->ngroups = RARRAY_LEN(groups);
+    s->keys = mrb_cgroup_sampler_names(mrb, keys);
+    s->nkeys = RARRAY_LEN(keys);
+    s->nfiles = s->ngroups * s->nkeys;
+    s->files = (mrb_cgroup_sampler_file *)mrb_calloc(mrb, s->nfiles ? s->nfiles : 1, sizeof(mrb_cgroup_sampler_file));
+    s->values = (int64_t *)mrb_calloc(mrb, s->nfiles ? s->nfiles : 1, sizeof(int64_t));
+    for (j = 0; j < s->nfiles; j++) {
+        s->files[j].fd = -1;
+        s->values[j] = SAMPLER_NO_VALUE;
+    }
+    s->nthreads = (int)nthreads;
+    mrb_cgroup_sampler_open(mrb, s);
+    mrb_cgroup_sampler_start(mrb, s);
+
+    return self;
+}
+
+// reads every file once; fills values (or a new Array) with groups.size * keys.size values, group major
+static mrb_value mrb_cgroup_sampler_sample(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_sampler *s = mrb_cgroup_get_sampler(mrb, self);
+    mrb_value values = mrb_nil_value();
+    size_t i;
+    mrb_get_args(mrb, "|A", &values);
+
+    // groups removed since the last pass, made again at the same path or not
+    if (s->nstale) {
+        mrb_cgroup_sampler_open(mrb, s);
+    }
+    mrb_cgroup_sampler_pass(s);
+
+    if (mrb_nil_p(values)) {
+        values = mrb_ary_new_capa(mrb, s->nfiles);
+    }
+    for (i = 0; i < s->nfiles; i++) {
+        mrb_ary_set(mrb, values, i,
+                    (s->values[i] == SAMPLER_NO_VALUE) ? mrb_nil_value() : mrb_fixnum_value(s->values[i]));
+    }
+    while ((size_t)RARRAY_LEN(values) > s->nfiles) {
+        mrb_ary_pop(mrb, values);
+    }
+
+    return values;
+}
+
+// value of the last sample
+static mrb_value mrb_cgroup_sampler_value(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_sampler *s = mrb_cgroup_get_sampler(mrb, self);
+    mrb_int group, key;
+    int64_t val;
+    mrb_get_args(mrb, "ii", &group, &key);
+
+    if (group < 0 || (size_t)group >= s->ngroups || key < 0 || (size_t)key >= s->nkeys) {
+        mrb_raise(mrb, E_INDEX_ERROR, "index out of range");
+    }
+    val = s->values[group * s->nkeys + key];
+
+    return (val == SAMPLER_NO_VALUE) ? mrb_nil_value() : mrb_fixnum_value(val);
+}
+
+static mrb_value mrb_cgroup_sampler_timestamp(mrb_state *mrb, mrb_value self)
+{
+    return mrb_fixnum_value(mrb_cgroup_get_sampler(mrb, self)->timestamp);
+}
+
+static mrb_value mrb_cgroup_sampler_groups(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_sampler *s = mrb_cgroup_get_sampler(mrb, self);
+    return mrb_cgroup_sampler_names_value(mrb, s->groups, s->ngroups);
+}
+
+static mrb_value mrb_cgroup_sampler_keys(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_sampler *s = mrb_cgroup_get_sampler(mrb, self);
+    return mrb_cgroup_sampler_names_value(mrb, s->keys, s->nkeys);
+}
+
+// opens what is missing and starts the pool again after close
+static mrb_value mrb_cgroup_sampler_reopen(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_sampler *s = mrb_cgroup_get_sampler(mrb, self);
+
+    mrb_cgroup_sampler_open(mrb, s);
+    mrb_cgroup_sampler_start(mrb, s);
+
+    return self;
+}
+
+static mrb_value mrb_cgroup_sampler_close_m(mrb_state *mrb, mrb_value self)
+{
+    mrb_cgroup_sampler_close(mrb_cgroup_get_sampler(mrb, self));
+    return mrb_nil_value();
+}
+
+void mrb_cgroup_sampler_init(mrb_state *mrb, struct RClass *cgroup)
+{
+    struct RClass *sampler;
+
+    sampler = mrb_define_class_under(mrb, cgroup, "Sampler", mrb->object_class);
+    MRB_SET_INSTANCE_TT(sampler, MRB_TT_DATA);
+    mrb_define_method(mrb, sampler, "initialize", mrb_cgroup_sampler_initialize, MRB_ARGS_ARG(2, 1));
+    mrb_define_method(mrb, sampler, "sample", mrb_cgroup_sampler_sample, MRB_ARGS_OPT(1));
+    mrb_define_method(mrb, sampler, "value", mrb_cgroup_sampler_value, MRB_ARGS_REQ(2));
+    mrb_define_method(mrb, sampler, "timestamp", mrb_cgroup_sampler_timestamp, MRB_ARGS_NONE());
+    mrb_define_method(mrb, sampler, "groups", mrb_cgroup_sampler_groups, MRB_ARGS_NONE());
+    mrb_define_method(mrb, sampler, "keys", mrb_cgroup_sampler_keys, MRB_ARGS_NONE());
+    mrb_define_method(mrb, sampler, "reopen", mrb_cgroup_sampler_reopen, MRB_ARGS_NONE());
+    mrb_define_method(mrb, sampler, "close", mrb_cgroup_sampler_close_m, MRB_ARGS_NONE());
+    DONE;
+}
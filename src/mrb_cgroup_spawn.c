@@ -0,0 +1,250 @@
+/*
+** mrb_cgroup_spawn - start processes inside their cgroups for mruby-cgroup
+**
+** See Copyright Notice in mrb_cgroup.c
+*/
+
+// pipe2
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mruby.h"
+#include "mruby/array.h"
+#include "mruby/class.h"
+#include "mruby/data.h"
+#include "mruby/hash.h"
+#include "mruby/string.h"
+#include "mruby/variable.h"
+
+#include "mrb_cgroup.h"
+
+#define DONE mrb_gc_arena_restore(mrb, 0);
+#define SPAWN_GROUPS_MAX 16
+
+#ifndef SYS_clone3
+#define SYS_clone3 435
+#endif
+#ifndef CLONE_INTO_CGROUP
+#define CLONE_INTO_CGROUP 0x200000000ULL
+#endif
+
+// struct clone_args of linux/sched.h up to the cgroup field (CLONE_ARGS_SIZE_VER2)
+struct mrb_cgroup_clone_args {
+    uint64_t flags;
+    uint64_t pidfd;
+    uint64_t child_tid;
+    uint64_t parent_tid;
+    uint64_t exit_signal;
+    uint64_t stack;
+    uint64_t stack_size;
+    uint64_t tls;
+    uint64_t set_tid;
+    uint64_t set_tid_size;
+    uint64_t cgroup;
+};
+
+static int64_t mrb_cgroup_spawn_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// runs in the child, only async-signal-safe calls: attaches itself through the fds opened by the parent
+// and execs, errno goes back through errfd on failure
+static void mrb_cgroup_spawn_child(char **argv, const int *fds, int nfds, int errfd)
+{
+    int i, err;
+
+    for (i = 0; i < nfds; i++) {
+        // "0" is the writing task itself
+        if (write(fds[i], "0", 1) != 1) {
+            goto fail;
+        }
+    }
+    execvp(argv[0], argv);
+fail:
+    err = errno;
+    if (write(errfd, &err, sizeof(err)) < 0) {
+    }
+    _exit(127);
+}
+
+// Cgroup.spawn(argv, groups: [cpu, memory, ...]) => {:pid=>, :method=>"clone3" or "fork", ...}
+//   on v2 the child is created inside the group by clone3(CLONE_INTO_CGROUP); otherwise (or when clone3 is
+//   not available) the child writes itself into every tasks/cgroup.procs file before exec
+static mrb_value mrb_cgroup_spawn(mrb_state *mrb, mrb_value self)
+{
+    mrb_value args, argl, opts = mrb_nil_value(), groups, result;
+    mrb_cgroup_context *ctx;
+    struct mrb_cgroup_clone_args ca;
+    char path[FILENAME_MAX], first[FILENAME_MAX];
+    int fds[SPAWN_GROUPS_MAX], nfds = 0, nv1, cgfd = -1, procfd = -1, fd, pipefd[2], mismatch = 0, err = 0, i;
+    int64_t start, forked, done;
+    const char *method = "clone3";
+    char **argv;
+    ssize_t n;
+    pid_t pid = -1;
+    mrb_int j;
+    mrb_get_args(mrb, "A|H", &args, &opts);
+
+    groups = mrb_nil_p(opts) ? mrb_nil_value()
+                             : mrb_hash_get(mrb, opts, mrb_symbol_value(mrb_intern_lit(mrb, "groups")));
+    if (mrb_nil_p(groups)) {
+        groups = mrb_ary_new(mrb);
+    } else if (!mrb_array_p(groups)) {
+        groups = mrb_ary_new_from_values(mrb, 1, &groups);
+    }
+    if (RARRAY_LEN(args) == 0) {
+        mrb_raise(mrb, E_ARGUMENT_ERROR, "empty argv");
+    }
+    if (RARRAY_LEN(groups) > SPAWN_GROUPS_MAX) {
+        mrb_raise(mrb, E_ARGUMENT_ERROR, "too many groups");
+    }
+    // the strings of argv, the caller's array is left as it is
+    argl = mrb_ary_new_capa(mrb, RARRAY_LEN(args));
+    for (j = 0; j < RARRAY_LEN(args); j++) {
+        mrb_ary_push(mrb, argl, mrb_str_to_str(mrb, mrb_ary_ref(mrb, args, j)));
+    }
+    // checks the types before anything is opened
+    for (j = 0; j < RARRAY_LEN(groups); j++) {
+        mrb_cgroup_get_context(mrb, mrb_ary_ref(mrb, groups, j));
+    }
+
+    path[0] = first[0] = '\0';
+    start = mrb_cgroup_spawn_now();
+    for (j = 0; j < RARRAY_LEN(groups); j++) {
+        ctx = mrb_cgroup_get_context(mrb, mrb_ary_ref(mrb, groups, j));
+        if (mrb_cgroup_path(mrb, ctx, NULL, path, sizeof(path)) < 0) {
+            err = errno;
+            break;
+        }
+        // one hierarchy on v2, the controllers of a group share its directory; on a hybrid host the v1 groups
+        // are joined by the child through their tasks files
+        if (ctx->v2 && first[0]) {
+            if (strcmp(path, first)) {
+                mismatch = 1;
+                err = EINVAL;
+                break;
+            }
+            continue;
+        }
+        if (ctx->v2) {
+            snprintf(first, sizeof(first), "%s", path);
+            if ((cgfd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+                err = errno;
+                break;
+            }
+        }
+        if (mrb_cgroup_path(mrb, ctx, ctx->v2 ? "cgroup.procs" : "tasks", path, sizeof(path)) < 0 ||
+            (fd = open(path, O_WRONLY | O_CLOEXEC)) < 0) {
+            err = errno;
+            break;
+        }
+        if (ctx->v2) {
+            procfd = fd;
+        } else {
+            fds[nfds++] = fd;
+        }
+    }
+    // the v1 fds first, clone3 leaves out the cgroup.procs one
+    nv1 = nfds;
+    if (procfd >= 0) {
+        fds[nfds++] = procfd;
+    }
+    if (err == 0 && pipe2(pipefd, O_CLOEXEC) < 0) {
+        err = errno;
+        snprintf(path, sizeof(path), "pipe2");
+    }
+    if (err) {
+        while (nfds > 0) {
+            close(fds[--nfds]);
+        }
+        if (cgfd >= 0) {
+            close(cgfd);
+        }
+        errno = err;
+        mrb_sys_fail(mrb, mismatch ? "groups on the unified hierarchy must name one group" : path);
+    }
+
+    argv = (char **)mrb_malloc(mrb, (RARRAY_LEN(argl) + 1) * sizeof(char *));
+    for (j = 0; j < RARRAY_LEN(argl); j++) {
+        argv[j] = RSTRING_PTR(mrb_ary_ref(mrb, argl, j));
+    }
+    argv[j] = NULL;
+
+    if (cgfd >= 0) {
+        memset(&ca, 0, sizeof(ca));
+        ca.flags = CLONE_INTO_CGROUP;
+        ca.exit_signal = SIGCHLD;
+        ca.cgroup = cgfd;
+        if ((pid = syscall(SYS_clone3, &ca, sizeof(ca))) == 0) {
+            mrb_cgroup_spawn_child(argv, fds, nv1, pipefd[1]);
+        }
+    }
+    // kernels before 5.7, v1, or a fake root whose directories are not cgroups
+    if (pid < 0) {
+        method = "fork";
+        if ((pid = fork()) == 0) {
+            mrb_cgroup_spawn_child(argv, fds, nfds, pipefd[1]);
+        }
+    }
+    forked = mrb_cgroup_spawn_now();
+    err = (pid < 0) ? errno : 0;
+    mrb_free(mrb, argv);
+    close(pipefd[1]);
+    for (i = 0; i < nfds; i++) {
+        close(fds[i]);
+    }
+    if (cgfd >= 0) {
+        close(cgfd);
+    }
+
+    // EOF once exec closed the write end
+    if (pid > 0) {
+        while ((n = read(pipefd[0], &err, sizeof(err))) < 0 && errno == EINTR) {
+        }
+        if (n != sizeof(err)) {
+            err = 0;
+        } else {
+            while (waitpid(pid, NULL, 0) < 0 && errno == EINTR) {
+            }
+        }
+    }
+    close(pipefd[0]);
+    done = mrb_cgroup_spawn_now();
+    if (err) {
+        errno = err;
+        mrb_sys_fail(mrb, RSTRING_PTR(mrb_ary_ref(mrb, argl, 0)));
+    }
+
+    result = mrb_hash_new(mrb);
+    mrb_hash_set(mrb, result, mrb_symbol_value(mrb_intern_lit(mrb, "pid")), mrb_fixnum_value(pid));
+    mrb_hash_set(mrb, result, mrb_symbol_value(mrb_intern_lit(mrb, "method")), mrb_str_new_cstr(mrb, method));
+    // opening the control files and clone3/fork, then until exec succeeded
+    mrb_hash_set(mrb, result, mrb_symbol_value(mrb_intern_lit(mrb, "fork_usec")), mrb_fixnum_value(forked - start));
+    mrb_hash_set(mrb, result, mrb_symbol_value(mrb_intern_lit(mrb, "exec_usec")), mrb_fixnum_value(done - forked));
+    mrb_hash_set(mrb, result, mrb_symbol_value(mrb_intern_lit(mrb, "spawn_usec")), mrb_fixnum_value(done - start));
+
+    return result;
+}
+
+void mrb_cgroup_spawn_init(mrb_state *mrb, struct RClass *cgroup)
+{
+    mrb_define_class_method(mrb, cgroup, "spawn", mrb_cgroup_spawn, MRB_ARGS_ARG(1, 1));
+    DONE;
+}
@@ -0,0 +1,287 @@
+/*
+** mrb_cgroup_walk - hierarchy enumeration for mruby-cgroup
+**
+** See Copyright Notice in mrb_cgroup.c
+*/
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "mruby.h"
+#include "mruby/array.h"
+#include "mruby/class.h"
+#include "mruby/data.h"
+#include "mruby/hash.h"
+#include "mruby/string.h"
+#include "mruby/variable.h"
+
+#include "mrb_cgroup.h"
+
+#define DONE mrb_gc_arena_restore(mrb, 0);
+#define WALK_DENTS_SIZE 4096
+#define WALK_FILE_SIZE 64
+
+// the layout getdents64 fills, not every libc declares it
+struct mrb_cgroup_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+typedef struct {
+    // file name in the walked hierarchy, the v2 file on the unified hierarchy
+    char file[WALK_FILE_SIZE];
+    const mrb_cgroup_v2_key *conv;
+} mrb_cgroup_walk_key;
+
+// the walk runs with no Ruby object involved, records are yielded after all directories are closed:
+// path '\0' then, per key, '\1' value '\0' or a lone '\0' when the file could not be read
+typedef struct {
+    char *buf;
+    size_t len, capa;
+    size_t nrecords;
+    int nkeys;
+    mrb_cgroup_walk_key *keys;
+} mrb_cgroup_walk;
+
+static void mrb_cgroup_walk_free(mrb_state *mrb, void *p)
+{
+    mrb_cgroup_walk *w = p;
+
+    free(w->buf);
+    free(w->keys);
+    mrb_free(mrb, w);
+}
+
+static const struct mrb_data_type mrb_cgroup_walk_type = {
+    "mrb_cgroup_walk", mrb_cgroup_walk_free,
+};
+
+static int mrb_cgroup_walk_append(mrb_cgroup_walk *w, const char *s, size_t len)
+{
+    char *buf;
+    size_t capa;
+
+    if (w->len + len > w->capa) {
+        for (capa = w->capa ? w->capa : 65536; capa < w->len + len; capa *= 2) {
+        }
+        if ((buf = (char *)realloc(w->buf, capa)) == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+        w->buf = buf;
+        w->capa = capa;
+    }
+    memcpy(w->buf + w->len, s, len);
+    w->len += len;
+
+    return 0;
+}
+
+// reads every key of the group open as dirfd into the record
+static int mrb_cgroup_walk_values(mrb_cgroup_walk *w, int dirfd)
+{
+    char buf[LIVE_BUF_SIZE];
+    ssize_t len;
+    int i, fd;
+
+    for (i = 0; i < w->nkeys; i++) {
+        len = -1;
+        if ((fd = openat(dirfd, w->keys[i].file, O_RDONLY | O_CLOEXEC)) >= 0) {
+            len = read(fd, buf, sizeof(buf) - 1);
+            close(fd);
+        }
+        if (len >= 0) {
+            while (len > 0 && (buf[len - 1] == '\n' || buf[len - 1] == ' ')) {
+                len--;
+            }
+            buf[len] = '\0';
+            if (w->keys[i].conv) {
+                len = mrb_cgroup_v2_to_v1(w->keys[i].conv, buf, sizeof(buf));
+            }
+        }
+        if (len < 0 || (w->keys[i].conv && len == 0)) {
+            if (mrb_cgroup_walk_append(w, "", 1) < 0) {
+                return -1;
+            }
+        } else if (mrb_cgroup_walk_append(w, "\1", 1) < 0 || mrb_cgroup_walk_append(w, buf, len + 1) < 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// pre-order walk of the directory open as dirfd, path holds its group name; returns -1 with errno set
+static int mrb_cgroup_walk_dir(mrb_cgroup_walk *w, int dirfd, char *path, size_t plen, size_t size)
+{
+    char dents[WALK_DENTS_SIZE];
+    struct mrb_cgroup_dirent64 *d;
+    struct stat st;
+    long n, off;
+    size_t len;
+    int fd, ret;
+
+    if (mrb_cgroup_walk_append(w, path, plen + 1) < 0 || mrb_cgroup_walk_values(w, dirfd) < 0) {
+        return -1;
+    }
+    w->nrecords++;
+
+    while ((n = syscall(SYS_getdents64, dirfd, dents, sizeof(dents))) > 0) {
+        for (off = 0; off < n; off += d->d_reclen) {
+            d = (struct mrb_cgroup_dirent64 *)(dents + off);
+            if (d->d_name[0] == '.' && (d->d_name[1] == '\0' || (d->d_name[1] == '.' && d->d_name[2] == '\0'))) {
+                continue;
+            }
+            if (d->d_type != DT_DIR &&
+                (d->d_type != DT_UNKNOWN || fstatat(dirfd, d->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0 ||
+                 !S_ISDIR(st.st_mode))) {
+                continue;
+            }
+            len = plen + (path[plen - 1] != '/') + strlen(d->d_name);
+            if (len >= size) {
+                errno = ENAMETOOLONG;
+                return -1;
+            }
+            // removed while walking
+            if ((fd = openat(dirfd, d->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)) < 0) {
+                if (errno == ENOENT) {
+                    continue;
+                }
+                return -1;
+            }
+            snprintf(path + plen, size - plen, "%s%s", (path[plen - 1] != '/') ? "/" : "", d->d_name);
+            ret = mrb_cgroup_walk_dir(w, fd, path, len, size);
+            close(fd);
+            path[plen] = '\0';
+            if (ret < 0) {
+                return -1;
+            }
+        }
+    }
+
+    return (n < 0) ? -1 : 0;
+}
+
+// numbers as Integer, anything else as String
+static mrb_value mrb_cgroup_walk_value(mrb_state *mrb, const char *s)
+{
+    char *end;
+    long long val;
+
+    errno = 0;
+    val = strtoll(s, &end, 10);
+    if (*s && *end == '\0' && errno == 0) {
+        return mrb_fixnum_value(val);
+    }
+
+    return mrb_str_new_cstr(mrb, s);
+}
+
+// Cgroup.each_group(root = "/", controller = "cpu", keys = nil) { |path, values| }
+//   walks every group under root in pre-order, root included. With keys ["cpu.shares", ...], values is
+//   {"cpu.shares"=>1024, ...} read from each group directory (nil for a file that could not be read), nil
+//   otherwise. v1 key names are mapped on the unified hierarchy. Without a block, returns an Array of
+//   paths, or of [path, values] with keys.
+static mrb_value mrb_cgroup_each_group(mrb_state *mrb, mrb_value self)
+{
+    char *root = "/", *controller = "cpu";
+    mrb_value keys = mrb_nil_value(), names, blk, result, obj, path, values, args[2];
+    char dir[FILENAME_MAX], name[FILENAME_MAX], file[FILENAME_MAX];
+    mrb_cgroup_walk *w;
+    const char *p, *base;
+    size_t i, len;
+    int k, fd, err, ai;
+    mrb_get_args(mrb, "&|zzo", &blk, &root, &controller, &keys);
+
+    if (!mrb_nil_p(keys) && !mrb_array_p(keys)) {
+        mrb_raise(mrb, E_TYPE_ERROR, "keys must be an Array");
+    }
+    // the strings of keys, the caller's array is left as it is
+    names = mrb_ary_new(mrb);
+    for (k = 0; !mrb_nil_p(keys) && k < RARRAY_LEN(keys); k++) {
+        mrb_ary_push(mrb, names, mrb_str_to_str(mrb, mrb_ary_ref(mrb, keys, k)));
+    }
+    if (mrb_cgroup_controller_path(mrb, controller, root, dir, sizeof(dir)) < 0) {
+        mrb_sys_fail(mrb, controller);
+    }
+
+    w = (mrb_cgroup_walk *)mrb_calloc(mrb, 1, sizeof(mrb_cgroup_walk));
+    obj = mrb_obj_value(Data_Wrap_Struct(mrb, mrb->object_class, &mrb_cgroup_walk_type, (void *)w));
+    if (RARRAY_LEN(names) > 0) {
+        w->keys = (mrb_cgroup_walk_key *)calloc(RARRAY_LEN(names), sizeof(mrb_cgroup_walk_key));
+        if (w->keys == NULL) {
+            mrb_sys_fail(mrb, "calloc");
+        }
+        for (k = 0; k < RARRAY_LEN(names); k++) {
+            base = RSTRING_PTR(mrb_ary_ref(mrb, names, k));
+            if (mrb_cgroup_key_path(mrb, root, base, file, sizeof(file), &w->keys[k].conv) == 0 &&
+                (p = strrchr(file, '/'))) {
+                base = p + 1;
+            }
+            snprintf(w->keys[k].file, WALK_FILE_SIZE, "%s", base);
+        }
+        w->nkeys = RARRAY_LEN(names);
+    }
+
+    // group names are given without trailing slashes, "/" stays as is
+    snprintf(name, sizeof(name), "%s", *root ? root : "/");
+    for (len = strlen(name); len > 1 && name[len - 1] == '/'; len--) {
+        name[len - 1] = '\0';
+    }
+    if ((fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+        mrb_sys_fail(mrb, dir);
+    }
+    if (mrb_cgroup_walk_dir(w, fd, name, len, sizeof(name)) < 0) {
+        err = errno;
+        close(fd);
+        errno = err;
+        mrb_sys_fail(mrb, dir);
+    }
+    close(fd);
+
+    result = mrb_nil_p(blk) ? mrb_ary_new_capa(mrb, w->nrecords) : self;
+    ai = mrb_gc_arena_save(mrb);
+    for (i = 0, p = w->buf; i < w->nrecords; i++) {
+        path = mrb_str_new_cstr(mrb, p);
+        p += strlen(p) + 1;
+        values = w->nkeys ? mrb_hash_new(mrb) : mrb_nil_value();
+        for (k = 0; k < w->nkeys; k++) {
+            mrb_hash_set(mrb, values, mrb_ary_ref(mrb, names, k),
+                         (*p == '\1') ? mrb_cgroup_walk_value(mrb, p + 1) : mrb_nil_value());
+            p += (*p == '\1') ? strlen(p) + 1 : 1;
+        }
+        if (!mrb_nil_p(blk)) {
+            args[0] = path;
+            args[1] = values;
+            mrb_yield_argv(mrb, blk, 2, args);
+        } else if (w->nkeys) {
+            args[0] = path;
+            args[1] = values;
+            mrb_ary_push(mrb, result, mrb_ary_new_from_values(mrb, 2, args));
+        } else {
+            mrb_ary_push(mrb, result, path);
+        }
+        mrb_gc_arena_restore(mrb, ai);
+    }
+    // the records stay alive until here through the arena
+    (void)obj;
+
+    return result;
+}
+
+void mrb_cgroup_walk_init(mrb_state *mrb, struct RClass *cgroup)
+{
+    mrb_define_class_method(mrb, cgroup, "each_group", mrb_cgroup_each_group, MRB_ARGS_OPT(3) | MRB_ARGS_BLOCK());
+    DONE;
+}
@@ -0,0 +1,126 @@
+##
+## Cgroup Test
+##
+## Run by rake test against the trees of bench/fake_cgroupfs.sh, MRUBY_CGROUP_ROOT=<tmp>/v1 or <tmp>/v2
+
+def cgroup_fake?
+  %w(/v1 /v2).include? Cgroup.root[-3, 3]
+end
+
+def cgroup_v2?
+  Cgroup.root[-3, 3] == "/v2"
+end
+
+assert("Cgroup.root") do
+  skip unless cgroup_fake?
+  root = Cgroup.root
+  c = Cgroup::PIDS.new "/t_root"
+  c.create
+  begin
+    Cgroup.root = root + "/nothing"
+    assert_equal root + "/nothing", Cgroup.root
+    # made under the old root, read from there
+    assert_equal 12, c.current
+  ensure
+    Cgroup.root = root
+  end
+  assert_equal root, Cgroup.root
+  c.delete
+  assert_false c.exist?
+end
+
+assert("Cgroup::MEMORY getters and setters") do
+  skip unless cgroup_fake?
+  mem = Cgroup::MEMORY.new "/t_getset"
+  assert_false mem.exist?
+  mem.create
+  assert_true mem.exist?
+  assert_equal 104857600, mem.usage_in_bytes
+  assert_equal 209715200, mem.max_usage_in_bytes
+  assert_equal(-1, mem.limit_in_bytes) if cgroup_v2?
+
+  # setters only record the value
+  mem.limit_in_bytes = 268435456
+  assert_not_equal 268435456, mem.limit_in_bytes
+  mem.modify
+  assert_equal 268435456, mem.limit_in_bytes
+  mem.delete
+end
+
+assert("Cgroup#modify and #apply write the keys set since the last apply") do
+  skip unless cgroup_fake?
+  mem = Cgroup::MEMORY.new "/t_apply"
+  pids = Cgroup::PIDS.new "/t_apply"
+  mem.limit_in_bytes = 268435456
+  mem.create
+  assert_equal 268435456, mem.limit_in_bytes
+
+  # a key written behind the object's back is not written again
+  mem.set "memory.limit_in_bytes", 536870912
+  mem.modify
+  assert_equal({}, mem.apply)
+  assert_equal 536870912, mem.limit_in_bytes
+
+  pids.max = 100
+  mem.limit_in_bytes = 134217728
+  assert_equal [{}, {}], Cgroup.apply([mem, pids])
+  assert_equal 100, pids.max
+  assert_equal 134217728, mem.limit_in_bytes
+
+  # neither tree has memory.swappiness, the key fails on its own
+  mem.swappiness = 10
+  mem.limit_in_bytes = 268435456
+  assert_equal ["memory.swappiness"], mem.apply.keys
+  assert_equal 268435456, mem.limit_in_bytes
+  Cgroup.reset_metrics
+  mem.swappiness = 10
+  assert_raise(RuntimeError) { mem.modify }
+  assert_equal 1, Cgroup.metrics[:create][:errors]
+  pids.delete
+  mem.delete
+end
+
+assert("Cgroup#get and #set") do
+  skip unless cgroup_fake?
+  pids = Cgroup::PIDS.new "/t_keys"
+  pids.create
+  assert_equal 12, pids.get("pids.current")
+  assert_equal 12, pids.get(:"pids.current")
+  assert_equal(-1, pids.get("pids.max"))
+  pids.set "pids.max", 100
+  assert_equal 100, pids.get("pids.max")
+  assert_nil pids.get("pids.nothing")
+  assert_raise(ArgumentError) { pids.set "pids.current", 1 }
+  assert_equal({"pids.current" => 12, "pids.max" => 100}, pids.get_many(["pids.current", "pids.max"]))
+  pids.delete
+
+  mem = Cgroup::MEMORY.new "/t_keys"
+  mem.create
+  mem.set "memory.limit_in_bytes", 268435456
+  assert_equal 268435456, mem.get("memory.limit_in_bytes")
+  assert_equal 268435456, mem.limit_in_bytes
+  mem.set "memory.limit_in_bytes", nil
+  assert_equal(-1, mem.get("memory.limit_in_bytes"))
+  mem.delete
+end
+
+assert("Cgroup.each_group") do
+  skip unless cgroup_fake?
+  groups = %w(/t_walk /t_walk/a /t_walk/a/c /t_walk/b).map do |name|
+    g = Cgroup::PIDS.new name
+    g.create
+    g
+  end
+  assert_equal %w(/t_walk /t_walk/a /t_walk/a/c /t_walk/b), Cgroup.each_group("/t_walk", "pids").sort
+
+  keys = ["pids.current", "pids.nothing"]
+  seen = {}
+  Cgroup.each_group("/t_walk", "pids", keys) { |path, values| seen[path] = values }
+  assert_equal ["pids.current", "pids.nothing"], keys
+  assert_equal 4, seen.size
+  assert_equal({"pids.current" => 12, "pids.nothing" => nil}, seen["/t_walk/a/c"])
+  pairs = Cgroup.each_group("/t_walk", "pids", ["pids.current"])
+  assert_equal 4, pairs.size
+  assert_equal({"pids.current" => 12}, pairs.find { |path, values| path == "/t_walk/b" }[1])
+  groups.reverse_each { |g| g.delete }
+end
@@ -0,0 +1,52 @@
+##
+## Cgroup::Pool Test
+##
+
+def cgroup_fake?
+  %w(/v1 /v2).include? Cgroup.root[-3, 3]
+end
+
+assert("Cgroup::Pool#lease and #release") do
+  skip unless cgroup_fake?
+  controllers = ["pids"]
+  pool = Cgroup::Pool.new("/t_pool", controllers, {min_idle: 0, max_idle: 2, limits: {"pids.max" => 200}})
+  assert_equal ["pids"], controllers
+
+  g = pool.lease({"pids.max" => 100})
+  assert_equal "/t_pool/", g[0, 8]
+  assert_equal 100, Cgroup::PIDS.new(g).get("pids.max")
+  stats = pool.stats
+  assert_equal 0, stats[:idle]
+  assert_equal 1, stats[:leased]
+  assert_equal 1, stats[:created]
+
+  # the value the lease changed is written back, the group goes back to the pool
+  pool.release g
+  assert_equal 200, Cgroup::PIDS.new(g).get("pids.max")
+  stats = pool.stats
+  assert_equal 1, stats[:idle]
+  assert_equal 0, stats[:leased]
+  assert_equal 0, stats[:removed]
+  assert_nil stats[:error]
+  assert_raise(ArgumentError) { pool.release g }
+
+  assert_equal g, pool.lease
+  assert_equal 200, Cgroup::PIDS.new(g).get("pids.max")
+  pool.release g
+  pool.close
+  assert_raise(RuntimeError) { pool.lease }
+  assert_raise(RuntimeError) { pool.release g }
+end
+
+assert("Cgroup::Pool skips the groups of another pool on the prefix") do
+  skip unless cgroup_fake?
+  a = Cgroup::Pool.new("/t_pool2", ["pids"], {min_idle: 0})
+  b = Cgroup::Pool.new("/t_pool2", ["pids"], {min_idle: 0})
+  ga = a.lease
+  gb = b.lease
+  assert_not_equal ga, gb
+  a.release ga
+  b.release gb
+  a.close
+  b.close
+end
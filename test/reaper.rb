@@ -0,0 +1,34 @@
+##
+## Cgroup::Reaper Test
+##
+
+def cgroup_fake?
+  %w(/v1 /v2).include? Cgroup.root[-3, 3]
+end
+
+assert("Cgroup::Reaper#reap") do
+  skip unless cgroup_fake?
+  %w(/t_reap /t_reap/a /t_reap/a/b /t_reap/keep /t_reap/keep/c).each do |name|
+    g = Cgroup::PIDS.new name
+    g.create
+    # not held by the process any more
+    g.live = false
+  end
+  held = Cgroup::PIDS.new "/t_reap/held"
+  held.create
+
+  r = Cgroup::Reaper.new("/t_reap", "pids", {min_age_ms: 0, exclude: ["/t_reap/keep"]})
+  assert_false r.running?
+  assert_equal 2, r.reap
+  assert_equal %w(/t_reap /t_reap/held /t_reap/keep /t_reap/keep/c), Cgroup.each_group("/t_reap", "pids").sort
+  stats = r.stats
+  assert_equal 2, stats[:removed]
+  assert_equal 0, stats[:errors]
+  assert_equal 0, r.reap
+
+  r.start
+  assert_true r.running?
+  r.stop
+  assert_false r.running?
+  held.delete
+end
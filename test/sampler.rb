@@ -0,0 +1,55 @@
+##
+## Cgroup::Sampler and Cgroup.measure Test
+##
+
+def cgroup_fake?
+  %w(/v1 /v2).include? Cgroup.root[-3, 3]
+end
+
+assert("Cgroup::Sampler#sample") do
+  skip unless cgroup_fake?
+  g = Cgroup::PIDS.new "/t_sampler"
+  g.create
+  groups = ["/t_sampler", "/"]
+  keys = ["pids.current", "pids.nothing"]
+  [0, 2].each do |threads|
+    s = Cgroup::Sampler.new groups, keys, threads
+    assert_equal [12, nil, 12, nil], s.sample
+    values = [1, 2, 3, 4, 5]
+    assert_true s.sample(values).equal?(values)
+    assert_equal [12, nil, 12, nil], values
+    assert_equal 12, s.value(1, 0)
+    assert_true s.timestamp > 0
+
+    s.close
+    assert_equal [nil, nil, nil, nil], s.sample
+    s.reopen
+    assert_equal [12, nil, 12, nil], s.sample
+    s.close
+  end
+
+  # the sampler keeps its own copy of the names
+  s = Cgroup::Sampler.new groups, keys
+  groups << "/other"
+  keys[0] = "pids.max"
+  assert_equal ["/t_sampler", "/"], s.groups
+  assert_equal ["pids.current", "pids.nothing"], s.keys
+  s.close
+  g.delete
+end
+
+assert("Cgroup.measure") do
+  skip unless cgroup_fake?
+  m = Cgroup.measure("/t_measure") { 1 + 1 }
+  assert_kind_of Cgroup::Measurement, m
+  assert_true m.wall_usec >= 0
+  assert_true m.cpu_usec.nil? || m.cpu_usec >= 0
+  h = m.to_h
+  assert_equal [:wall_usec, :cpu_usec, :memory_peak, :read_bytes, :write_bytes], h.keys
+  assert_equal m.wall_usec, h[:wall_usec]
+
+  # the thread is moved back when the block raises, the next measure works as well
+  assert_raise(RuntimeError) { Cgroup.measure("/t_measure") { raise "in the block" } }
+  assert_kind_of Cgroup::Measurement, Cgroup.measure("/t_measure") { Cgroup.measure("/t_measure") { } }
+  assert_raise(ArgumentError) { Cgroup.measure("/") { } }
+end